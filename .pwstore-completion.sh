@@ -31,7 +31,7 @@ function __pwstore_complete_lookup()
 {
     local cur=${COMP_WORDS[COMP_CWORD]}
     if [[ "$cur" != -?* ]] && [[ "$cur" == -* ]];then
-	COMPREPLY=( $( compgen -W "-i -o -n" $cur ))
+	COMPREPLY=( $( compgen -W "-i -o -n --ignore-case --fuzzy" $cur ))
     fi
 }
 
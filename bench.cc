@@ -0,0 +1,645 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// Benchmarks for pw_store::database, the encrypted store and merge. Build
+// and run with "make bench", "make bench_json" writes the results as JSON
+// for comparisons between releases.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "key_column.hh"
+#include "merge.hh"
+#include "pwstore.hh"
+#include "pwstore_api_cxx.hh"
+#include "simd_find.hh"
+#include "suffix_index.hh"
+#include "thread_pool.hh"
+#include "trigram_index.hh"
+
+namespace
+{
+
+// Results are printed as text right away or collected for JSON.
+struct result
+{
+    std::string name;
+    std::size_t records;
+    double value;
+    std::string unit;
+};
+
+bool json_output = false;
+std::vector<result> results;
+
+void report(const std::string &name, std::size_t records, double value,
+            const std::string &unit = "ms")
+{
+    if(json_output) {
+        results.push_back({name, records, value, unit});
+        return;
+    }
+    std::cout << "  " << name << ":"
+              << std::string(28 - std::min<std::size_t>(name.size(), 27), ' ');
+    if(unit == "bytes")
+        std::cout << static_cast<std::size_t>(value);
+    else
+        std::cout << value;
+    std::cout << " " << unit << "\n";
+}
+
+// names are ASCII, only quotes need escaping
+std::string json_string(const std::string &s)
+{
+    std::string quoted("\"");
+    for(const auto c : s) {
+        if(c == '"' || c == '\\')
+            quoted.push_back('\\');
+        quoted.push_back(c);
+    }
+    return quoted + "\"";
+}
+
+void print_json()
+{
+    // byte counts in full
+    std::cout.precision(12);
+    std::cout << "{\n  \"benchmarks\": [";
+    for(std::size_t i = 0; i < results.size(); i++) {
+        const auto &r = results[i];
+        std::cout << (i ? ",\n" : "\n") << "    {\"name\": "
+                  << json_string(r.name) << ", \"records\": " << r.records
+                  << ", \"value\": ";
+        // too fast to measure
+        if(std::isfinite(r.value))
+            std::cout << r.value;
+        else
+            std::cout << "null";
+        std::cout << ", \"unit\": " << json_string(r.unit) << "}";
+    }
+    std::cout << "\n  ]\n}\n";
+}
+
+// Deterministic synthetic vault, resembling real ones: few sites with many
+// accounts and a long tail of sites with one, urls with scheme and sometimes
+// a subdomain or path, usernames mostly mail addresses and nicknames.
+// Only rng() % n is used, the standard distributions differ between
+// library implementations.
+class vault_generator
+{
+public:
+    explicit vault_generator(std::size_t count)
+        : rng(count), sites(std::max<std::size_t>(100, count / 4))
+    {
+    }
+
+    pw_store::data_type next()
+    {
+        return pw_store::data_type(url(), user(), password());
+    }
+
+private:
+    std::string pick(const std::vector<std::string> &words)
+    {
+        return words[rng() % words.size()];
+    }
+
+    std::string word(std::size_t index)
+    {
+        static const std::vector<std::string> syllables = {
+            "ka", "lo", "mi", "ne", "tor", "ba", "zen", "ri", "su", "ve",
+            "dan", "po", "gu", "shi", "tra", "el", "on", "ar", "fy", "ix"};
+        std::string w;
+        do {
+            w += syllables[index % syllables.size()];
+            index /= syllables.size();
+        } while(index);
+        return w;
+    }
+
+    std::string url()
+    {
+        static const std::vector<std::string> subdomains = {
+            "", "", "", "www.", "www.", "mail.", "login.", "accounts.",
+            "admin.", "shop."};
+        static const std::vector<std::string> tlds = {
+            ".com", ".com", ".com", ".de", ".org", ".net", ".io", ".co.uk"};
+        static const std::vector<std::string> paths = {
+            "", "", "", "", "/login", "/signin", "/account", "/user/login"};
+
+        // skewed towards low site numbers, about zipf like
+        const double u = (rng() % 1000000) / 1000000.0;
+        const std::size_t site = sites * u * u * u;
+        return std::string(rng() % 10 ? "https://" : "http://") +
+               pick(subdomains) + word(site + 20) + tlds[site % tlds.size()] +
+               pick(paths);
+    }
+
+    std::string user()
+    {
+        static const std::vector<std::string> first = {
+            "anna", "ben", "clara", "david", "emma", "felix", "greta", "hans",
+            "ida", "jonas", "karl", "lena", "max", "nina", "otto", "paul"};
+        static const std::vector<std::string> last = {
+            "mueller", "schmidt", "smith", "jones", "weber", "wagner",
+            "becker", "brown", "hofmann", "koch", "richter", "klein"};
+        static const std::vector<std::string> mailers = {
+            "gmail.com", "web.de", "gmx.net", "outlook.com", "posteo.de"};
+
+        switch(rng() % 4) {
+        case 0:
+        case 1:
+            return pick(first) + "." + pick(last) + "@" + pick(mailers);
+        case 2:
+            return pick(first) + std::to_string(rng() % 100);
+        default:
+            return pick(first) + "_" + pick(last);
+        }
+    }
+
+    std::string password()
+    {
+        // printable, without the field and line separators
+        std::string pass(12 + rng() % 9, ' ');
+        for(auto &c : pass)
+            c = '!' + rng() % ('~' - '!' + 1);
+        return pass;
+    }
+
+    std::mt19937 rng;
+    std::size_t sites;
+};
+
+// Deterministic synthetic database content in the format parsed by
+// pw_store::database::parse().
+std::string synthetic_lines(std::size_t count)
+{
+    vault_generator generator(count);
+    std::string buffer;
+    for(std::size_t i = 0; i < count; i++) {
+        const auto date = generator.next();
+        buffer.append(date.url_string);
+        buffer.append("\t");
+        buffer.append(date.username);
+        buffer.append("\t");
+        buffer.append(date.password);
+        buffer.append("\t\n");
+    }
+    return buffer;
+}
+
+std::vector<pw_store::data_type> synthetic_vector(const std::string &buffer)
+{
+    pw_store::secure_buffer copy;
+    copy.assign(buffer.data(), buffer.size());
+    pw_store::database db(copy);
+    db.parse();
+    pw_store::result_type content;
+    db.dump_db(content);
+
+    std::vector<pw_store::data_type> dates(content.size());
+    for(std::size_t i = 0; i < content.size(); i++)
+        db.get(content[i].id, dates[i]);
+    return dates;
+}
+
+std::list<pw_store::data_type> synthetic_dates(const std::string &buffer)
+{
+    // Shuffle the records so inserts are random.
+    auto dates = synthetic_vector(buffer);
+    std::shuffle(dates.begin(), dates.end(), std::mt19937(dates.size()));
+    return std::list<pw_store::data_type>(dates.begin(), dates.end());
+}
+
+// Input file format of "pwstore add <file>", to create real databases.
+void generate(std::size_t count)
+{
+    vault_generator generator(count);
+    for(std::size_t i = 0; i < count; i++) {
+        const auto date = generator.next();
+        std::cout << (i ? "###\n###\n" : "") << date.url_string << "\n"
+                  << date.username << "\n" << date.password << "\n";
+    }
+}
+
+template <typename F> double time_ms(F f)
+{
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// The insert path before binary search insertion: push_back + full sort.
+void legacy_insert(std::vector<pw_store::data_type> &records,
+                   const pw_store::data_type &date)
+{
+    records.push_back(date);
+    std::sort(records.begin(), records.end(),
+              pw_store::data_type_cmp_enhanced());
+}
+
+void bench_insert(std::size_t count)
+{
+    const auto buffer = synthetic_lines(count);
+    const auto dates = synthetic_dates(buffer);
+
+    pw_store::secure_buffer parse_buffer;
+    parse_buffer.assign(buffer.data(), buffer.size());
+    pw_store::database parse_db(parse_buffer);
+    report("parse (bulk load)", count,
+           time_ms([&]() { parse_db.parse(); }));
+
+    pw_store::secure_buffer bulk_buffer;
+    pw_store::database bulk_db(bulk_buffer);
+    report("insert(list)", count, time_ms([&]() { bulk_db.insert(dates); }));
+
+    pw_store::secure_buffer single_buffer;
+    pw_store::database single_db(single_buffer);
+    report("insert(date) per record", count, time_ms([&]() {
+        for(const auto &date : dates)
+            single_db.insert(date);
+    }));
+
+    // ids of parsed records are 1..count
+    std::vector<pw_store::data_type::id_type> ids;
+    std::mt19937 rng(count);
+    for(std::size_t i = 0; i < 1000; i++)
+        ids.push_back(1 + rng() % count);
+    pw_store::data_type date;
+    report("get(id), 1000 ids", count, time_ms([&]() {
+        for(const auto id : ids)
+            parse_db.get(id, date);
+    }));
+    report("remove(id), 1000 ids", count, time_ms([&]() {
+        for(const auto id : ids)
+            parse_db.remove(id);
+    }));
+
+    pw_store::secure_buffer batch_buffer;
+    batch_buffer.assign(buffer.data(), buffer.size());
+    pw_store::database batch_db(batch_buffer);
+    batch_db.parse();
+    std::sort(std::begin(ids), std::end(ids));
+    ids.erase(std::unique(std::begin(ids), std::end(ids)), std::end(ids));
+    report("remove(ids), 1000 ids", count,
+           time_ms([&]() { batch_db.remove(ids); }));
+
+    // Serializing a sync after one insert: only the change for the journal,
+    // the whole buffer for a full write.
+    pw_store::secure_buffer sync_buffer;
+    sync_buffer.assign(buffer.data(), buffer.size());
+    pw_store::database sync_db(sync_buffer);
+    sync_db.parse();
+    sync_db.insert(dates.front());
+    pw_store::secure_buffer changes;
+    report("take_changes, one insert", count,
+           time_ms([&]() { sync_db.take_changes(changes); }));
+    report("take_changes size", count, changes.size(), "bytes");
+    report("synchronize_buffer", count,
+           time_ms([&]() { sync_db.synchronize_buffer(); }));
+    report("synchronize_buffer size", count, sync_buffer.size(), "bytes");
+    // the records are in the buffer now, the next call copies them in runs
+    sync_db.insert(dates.back());
+    report("synchronize_buffer again", count,
+           time_ms([&]() { sync_db.synchronize_buffer(); }));
+
+    // O(n^2 log n), this was the cost of parse() before bulk loading.
+    if(count <= 1000) {
+        std::vector<pw_store::data_type> records;
+        report("legacy push_back + sort", count, time_ms([&]() {
+            for(const auto &date : dates)
+                legacy_insert(records, date);
+        }));
+    }
+}
+
+void bench_lookup(std::size_t count)
+{
+    const auto lines = synthetic_lines(count);
+    pw_store::secure_buffer buffer;
+    buffer.assign(lines.data(), lines.size());
+    pw_store::database db(buffer);
+    db.parse();
+
+    // common words of the generated vault and a key that never matches
+    const std::vector<std::string> keys = {"mail", "admin", "kalo", "kaxe"};
+    pw_store::result_type matches;
+
+    report("lookup (scan)", count,
+           time_ms([&]() { db.lookup(keys[0], matches); }));
+    report("lookup (build index)", count,
+           time_ms([&]() { db.lookup(keys[1], matches); }));
+    // consecutive keys do not contain each other, so no narrowing
+    const std::size_t rounds = 100;
+    report("lookup (index)", count, time_ms([&]() {
+        for(std::size_t i = 0; i < rounds; i++) {
+            matches.clear();
+            db.lookup(keys[i % keys.size()], matches);
+        }
+    }) / rounds);
+    const std::string typed = "schmidt";
+    report("lookup (typing \"" + typed + "\")", count, time_ms([&]() {
+        for(std::size_t i = 1; i <= typed.size(); i++) {
+            matches.clear();
+            db.lookup(typed.substr(0, i), matches);
+        }
+    }));
+    for(const auto mode :
+        {pw_store::match_mode::ignore_case, pw_store::match_mode::fuzzy}) {
+        const auto per_key = time_ms([&]() {
+            for(std::size_t i = 1; i <= typed.size(); i++) {
+                matches.clear();
+                db.lookup(typed.substr(0, i), matches, mode);
+            }
+        }) / typed.size();
+        report(mode == pw_store::match_mode::fuzzy ? "lookup (fuzzy, per key)"
+                                                   : "lookup (icase, per key)",
+               count, per_key);
+    }
+
+    // The trigram index is updated by insert and remove, lookups right after
+    // a change need no rebuild.
+    const auto dates = synthetic_vector(synthetic_lines(1000));
+    report("insert(date) with index, 1000 records", count, time_ms([&]() {
+        for(const auto &date : dates)
+            db.insert(date);
+    }));
+    report("lookup after insert", count, time_ms([&]() {
+        matches.clear();
+        db.lookup(keys[2], matches);
+    }));
+    if(!matches.empty())
+        report("remove(id) with index", count, time_ms([&]() {
+            db.remove(matches.front().id);
+        }));
+
+    // memory of the index
+    pw_store::result_type content;
+    db.dump_db(content);
+    std::vector<pw_store::record> records;
+    records.reserve(content.size());
+    for(const auto &c : content)
+        records.emplace_back(c.url_string, c.username, pw_store::field_ref(),
+                             c.id);
+    pw_store::trigram_index trigrams;
+    trigrams.build(records);
+    report("trigram postings size", count, trigrams.posting_bytes(),
+           "bytes");
+
+    // the alternative: a suffix array over the column, rebuilt after changes
+    pw_store::database suffix_db(buffer);
+    suffix_db.parse();
+    suffix_db.index(pw_store::lookup_index::suffix_array);
+    suffix_db.lookup(keys[0], matches);
+    report("lookup (build suffix array)", count,
+           time_ms([&]() { suffix_db.lookup(keys[1], matches); }));
+    report("lookup (suffix array)", count, time_ms([&]() {
+        for(std::size_t i = 0; i < rounds; i++) {
+            matches.clear();
+            suffix_db.lookup(keys[i % keys.size()], matches);
+        }
+    }) / rounds);
+    pw_store::key_column column;
+    column.build(records);
+    pw_store::suffix_index suffixes;
+    suffixes.build(column);
+    report("suffix array size", count, suffixes.memory(), "bytes");
+
+    // large databases: column scans split over the thread pool, no index
+    const auto threads = pw_store::thread_pool::default_size();
+    if(threads < 2)
+        return;
+    pw_store::database parallel_db(buffer);
+    parallel_db.parse();
+    parallel_db.parallel_threshold(1);
+    const auto parallel = time_ms([&]() {
+        for(std::size_t i = 0; i < rounds; i++) {
+            matches.clear();
+            parallel_db.lookup(keys[i % keys.size()], matches);
+        }
+    });
+    report("lookup (parallel scan)", count, parallel / rounds);
+    report("lookup threads", count, threads, "threads");
+}
+
+// Scan throughput of the record layouts and the search kernels for one key
+// that never matches, but starts with a frequent pair of characters.
+void bench_scan(std::size_t count)
+{
+    const auto lines = synthetic_lines(count);
+    pw_store::secure_buffer buffer;
+    buffer.assign(lines.data(), lines.size());
+    pw_store::database db(buffer);
+    db.parse();
+    pw_store::result_type content;
+    db.dump_db(content);
+
+    // layout before zero-copy parsing: three heap strings per record
+    std::vector<pw_store::data_type> dates(content.size());
+    std::vector<pw_store::record> records;
+    std::size_t key_bytes = 0;
+    for(std::size_t i = 0; i < content.size(); i++) {
+        const auto &c = content[i];
+        db.get(c.id, dates[i]);
+        records.emplace_back(c.url_string, c.username, pw_store::field_ref());
+        key_bytes += c.url_string.size + c.username.size;
+    }
+    pw_store::key_column column;
+    column.build(records);
+    // the column is a copy beside the records and the database buffer
+    report("database buffer size", count, buffer.size(), "bytes");
+    report("records size", count, records.size() * sizeof(pw_store::record),
+           "bytes");
+    report("key_column size", count, column.memory(), "bytes");
+    column.fold();
+    report("key_column size, folded", count, column.memory(), "bytes");
+
+    const std::string key = "kaxe";
+    const std::size_t rounds = 10;
+    std::size_t hits = 0;
+    const auto throughput = [&](const std::string &name, double ms) {
+        report("scan " + name, count, key_bytes * rounds / (ms * 1000.0),
+               "MB/s");
+    };
+
+    throughput("std::string records", time_ms([&]() {
+        for(std::size_t r = 0; r < rounds; r++)
+            for(const auto &d : dates)
+                if(d.url_string.find(key) != std::string::npos
+                   || d.username.find(key) != std::string::npos)
+                    hits++;
+    }));
+    throughput("field_ref records", time_ms([&]() {
+        for(std::size_t r = 0; r < rounds; r++)
+            for(const auto &k : records)
+                if(k.url_string.contains(key) || k.username.contains(key))
+                    hits++;
+    }));
+    std::vector<std::size_t> slots;
+    throughput("key_column", time_ms([&]() {
+        for(std::size_t r = 0; r < rounds; r++) {
+            slots.clear();
+            column.scan(key, slots);
+        }
+    }));
+
+    // raw kernels over the column text
+    const char *begin = column.text().data();
+    const char *end = begin + column.text().size();
+    for(const auto &kernel : pw_store::find_kernels())
+        throughput(std::string("kernel ") + kernel.name, time_ms([&]() {
+            for(std::size_t r = 0; r < rounds; r++)
+                for(const char *p = begin;; p++) {
+                    p = kernel.find(p, end, key.data(), key.size());
+                    if(p == end)
+                        break;
+                    hits++;
+                }
+        }));
+
+    // keep the loops from being optimized away
+    if(hits == 1)
+        std::cout << "";
+}
+
+// Three overlapping inputs, like copies of one database changed on
+// different machines.
+void bench_merge(std::size_t count)
+{
+    const auto dates = synthetic_vector(synthetic_lines(count));
+    std::vector<std::vector<pw_store::data_type>> inputs(3);
+    for(std::size_t i = 0; i < dates.size(); i++) {
+        for(std::size_t input = 0; input < inputs.size(); input++)
+            if((i + input) % 4)
+                inputs[input].push_back(dates[i]);
+    }
+    for(auto &input : inputs)
+        std::shuffle(input.begin(), input.end(), std::mt19937(count));
+
+    report("merge sort inputs", count, time_ms([&]() {
+        for(auto &input : inputs)
+            pw_store::sort_for_merge(input);
+    }));
+    std::vector<pw_store::merged_record> merged;
+    report("merge_sorted, 3 inputs", count,
+           time_ms([&]() { pw_store::merge_sorted(inputs, merged); }));
+
+    std::list<pw_store::data_type> result;
+    for(const auto &record : merged)
+        result.push_back(record.date);
+    pw_store::secure_buffer buffer;
+    pw_store::database db(buffer);
+    db.parse();
+    report("merge bulk load result", count, time_ms([&]() {
+        db.insert(result);
+        db.synchronize_buffer();
+    }));
+}
+
+// Whole encrypted store in a temporary directory, including key derivation
+// on every open.
+void bench_encrypted(std::size_t count)
+{
+    const char *const tmp = std::getenv("TMPDIR");
+    std::string dir = std::string(tmp && tmp[0] ? tmp : "/tmp") +
+                      "/pwstore_bench-XXXXXX";
+    if(!mkdtemp(&dir[0])) {
+        std::cerr << "Could not create a temporary directory.\n";
+        return;
+    }
+    const std::string file = dir + "/bench.crypt";
+    const std::string password = "bench password";
+    const auto dates = synthetic_dates(synthetic_lines(count));
+
+    {
+        pw_store_api_cxx::pwstore_api db(file, password);
+        db.add(dates);
+        report("sync (full write)", count, time_ms([&]() { db.sync(); }));
+    }
+
+    pw_store::result_type content;
+    double open_ms;
+    {
+        std::unique_ptr<pw_store_api_cxx::pwstore_api> db;
+        open_ms = time_ms([&]() {
+            db.reset(new pw_store_api_cxx::pwstore_api(file, password));
+        });
+        report("open (KDF, page table)", count, open_ms);
+        pw_store::data_type date;
+        report("get(id) without load", count,
+               time_ms([&]() { db->get(count / 2 + 1, date); }));
+        report("load (decrypt, parse)", count,
+               time_ms([&]() { db->dump(content); }));
+        db->add(dates.front());
+        report("add + sync (journal)", count, time_ms([&]() { db->sync(); }));
+    }
+
+    std::remove((file + ".journal").c_str());
+    std::remove(file.c_str());
+    rmdir(dir.c_str());
+}
+}
+
+int main(int argc, char *argv[])
+{
+    // usage: pwstore_bench [--scan] [--json] [record counts..]
+    //        pwstore_bench --generate <count>
+    bool scan_only = false;
+    std::vector<std::size_t> sizes;
+    for(int i = 1; i < argc; i++) {
+        if(!std::strcmp(argv[i], "--scan"))
+            scan_only = true;
+        else if(!std::strcmp(argv[i], "--json"))
+            json_output = true;
+        else if(!std::strcmp(argv[i], "--generate") && i + 1 < argc) {
+            generate(std::strtoul(argv[i + 1], nullptr, 10));
+            return EXIT_SUCCESS;
+        } else
+            sizes.push_back(std::strtoul(argv[i], nullptr, 10));
+    }
+    if(sizes.empty())
+        sizes = {1000, 10000, 100000, 1000000};
+
+    for(const auto size : sizes) {
+        if(!json_output)
+            std::cout << size << " records:\n";
+        if(scan_only) {
+            bench_scan(size);
+            continue;
+        }
+        bench_insert(size);
+        bench_lookup(size);
+        bench_scan(size);
+        bench_merge(size);
+        bench_encrypted(size);
+    }
+    if(json_output)
+        print_json();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,68 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// Replacements of the global allocation functions, counting allocations for
+// pw_store::stats. Linked into pwstore and pwstore_bench only, other
+// programs using the library, e.g. qpwstore, keep the allocator of the
+// standard library. The sized variants of the standard library forward to
+// these.
+
+#include <cstdlib>
+#include <new>
+
+#include "stats.hh"
+
+void *operator new(std::size_t size)
+{
+    pw_store::stats::allocated();
+    if(!size)
+        size = 1;
+    while(true) {
+        if(void *p = std::malloc(size))
+            return p;
+        const std::new_handler handler = std::get_new_handler();
+        if(!handler)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    try {
+        return operator new(size);
+    } catch(...) {
+        return nullptr;
+    }
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    std::free(p);
+}
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    std::free(p);
+}
@@ -0,0 +1,360 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "crypto_segment.hh"
+
+#include <cstdio>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include "stats.hh"
+#ifndef NO_GOOD
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+pw_store::key_cache *cache = nullptr;
+
+const unsigned char *bytes(const std::string &s)
+{
+    return reinterpret_cast<const unsigned char *>(s.data());
+}
+
+#ifdef NO_GOOD
+bool write_and_close(FILE *f, const char *data, std::size_t size)
+{
+    const bool ok = std::fwrite(data, 1, size, f) == size && !std::fflush(f);
+    return !std::fclose(f) && ok;
+}
+#else
+// write(2) all of data and fsync, then close fd in any case.
+bool write_and_close(int fd, const char *data, std::size_t size)
+{
+    bool ok = true;
+    while(ok && size) {
+        const ssize_t written = write(fd, data, size);
+        if(written < 0 && errno == EINTR)
+            continue;
+        ok = written > 0;
+        if(ok) {
+            data += written;
+            size -= written;
+        }
+    }
+    ok = ok && !fsync(fd);
+    return !::close(fd) && ok;
+}
+
+// Make a rename in the directory of path durable.
+bool sync_directory(const std::string &path)
+{
+    const auto slash = path.rfind('/');
+    const std::string dir = slash == std::string::npos
+                                ? "."
+                                : slash == 0 ? "/" : path.substr(0, slash);
+    const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if(fd < 0)
+        return false;
+    // some file systems can not sync directories
+    const bool ok = !fsync(fd) || errno == EINVAL;
+    ::close(fd);
+    return ok;
+}
+#endif
+}
+
+void pw_store::put_u32(std::string &s, std::uint32_t v)
+{
+    for(int i = 0; i < 4; i++)
+        s.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+}
+
+void pw_store::put_u64(std::string &s, std::uint64_t v)
+{
+    for(int i = 0; i < 8; i++)
+        s.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+}
+
+std::uint32_t pw_store::get_u32(const char *p)
+{
+    std::uint32_t v = 0;
+    for(int i = 3; i >= 0; i--)
+        v = (v << 8) | static_cast<unsigned char>(p[i]);
+    return v;
+}
+
+std::uint64_t pw_store::get_u64(const char *p)
+{
+    std::uint64_t v = 0;
+    for(int i = 7; i >= 0; i--)
+        v = (v << 8) | static_cast<unsigned char>(p[i]);
+    return v;
+}
+
+bool pw_store::random_bytes(void *p, std::size_t size)
+{
+    return RAND_bytes(static_cast<unsigned char *>(p), size) == 1;
+}
+
+bool pw_store::derive_key(const std::string &password, const char *salt,
+                          std::uint32_t iterations,
+                          unsigned char key[KEY_SIZE])
+{
+    if(!iterations || iterations > MAX_ITERATIONS)
+        return false;
+    std::string id(salt, SALT_SIZE);
+    put_u32(id, iterations);
+    if(cache && password.empty()) {
+        const stats::phase timing("key cache");
+        return cache->find(id, key);
+    }
+
+    const stats::phase timing("kdf");
+    return PKCS5_PBKDF2_HMAC(password.data(), password.size(),
+                             reinterpret_cast<const unsigned char *>(salt),
+                             SALT_SIZE, iterations, EVP_sha256(), KEY_SIZE,
+                             key) == 1;
+}
+
+void pw_store::cache_key(const char *salt, std::uint32_t iterations,
+                         const unsigned char key[KEY_SIZE])
+{
+    if(!cache)
+        return;
+    std::string id(salt, SALT_SIZE);
+    put_u32(id, iterations);
+    cache->add(id, key);
+}
+
+void pw_store::set_key_cache(key_cache *key_cache) { cache = key_cache; }
+
+bool pw_store::seal_segment(const unsigned char *key, const std::string &aad,
+                            const char *plaintext, std::size_t size,
+                            std::string &out)
+{
+    const stats::phase timing("encrypt", size);
+    unsigned char nonce[NONCE_SIZE];
+    if(size > MAX_SEGMENT_SIZE || !random_bytes(nonce, sizeof(nonce)))
+        return false;
+
+    put_u32(out, size);
+    out.append(reinterpret_cast<const char *>(nonce), sizeof(nonce));
+    const std::size_t offset = out.size();
+    out.resize(offset + size + TAG_SIZE);
+    auto dest = reinterpret_cast<unsigned char *>(&out[offset]);
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    int len = 0;
+    const bool ok =
+        ctx &&
+        EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, nullptr,
+                           nullptr) == 1 &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, NONCE_SIZE,
+                            nullptr) == 1 &&
+        EVP_EncryptInit_ex(ctx, nullptr, nullptr, key, nonce) == 1 &&
+        EVP_EncryptUpdate(ctx, nullptr, &len, bytes(aad), aad.size()) == 1 &&
+        EVP_EncryptUpdate(
+            ctx, dest, &len,
+            reinterpret_cast<const unsigned char *>(plaintext), size) == 1 &&
+        EVP_EncryptFinal_ex(ctx, dest + len, &len) == 1 &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, TAG_SIZE,
+                            dest + size) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+bool pw_store::segment_size(const char *p, std::size_t left,
+                            std::size_t &size)
+{
+    if(left < 4)
+        return false;
+    size = get_u32(p);
+    return size <= MAX_SEGMENT_SIZE && left >= SEGMENT_OVERHEAD + size;
+}
+
+bool pw_store::unseal_segment(const unsigned char *key,
+                              const std::string &aad, const char *p,
+                              char *out)
+{
+    const std::size_t size = get_u32(p);
+    const stats::phase timing("decrypt", size);
+    auto nonce = reinterpret_cast<const unsigned char *>(p + 4);
+    auto in = nonce + NONCE_SIZE;
+    auto dest = reinterpret_cast<unsigned char *>(out);
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    int len = 0;
+    const bool ok =
+        ctx &&
+        EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, nullptr,
+                           nullptr) == 1 &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, NONCE_SIZE,
+                            nullptr) == 1 &&
+        EVP_DecryptInit_ex(ctx, nullptr, nullptr, key, nonce) == 1 &&
+        EVP_DecryptUpdate(ctx, nullptr, &len, bytes(aad), aad.size()) == 1 &&
+        EVP_DecryptUpdate(ctx, dest, &len, in, size) == 1 &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, TAG_SIZE,
+                            const_cast<unsigned char *>(in + size)) == 1 &&
+        EVP_DecryptFinal_ex(ctx, dest + len, &len) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+#ifdef NO_GOOD
+bool pw_store::file_view::open(const std::string &path, bool &exists)
+{
+    unmap();
+    exists = false;
+    FILE *f = std::fopen(path.c_str(), "rb");
+    if(!f)
+        return true;
+    exists = true;
+    char chunk[64 * 1024];
+    std::size_t n;
+    while((n = std::fread(chunk, 1, sizeof(chunk), f)) > 0)
+        buffer.append(chunk, n);
+    const bool ok = !std::ferror(f);
+    std::fclose(f);
+    view = buffer.data();
+    length = buffer.size();
+    return ok;
+}
+
+void pw_store::file_view::unmap()
+{
+    buffer.clear();
+    view = nullptr;
+    length = 0;
+}
+#else
+bool pw_store::file_view::open(const std::string &path, bool &exists)
+{
+    unmap();
+    exists = false;
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        return errno == ENOENT;
+    exists = true;
+    struct stat s;
+    if(fstat(fd, &s)) {
+        ::close(fd);
+        return false;
+    }
+    if(!s.st_size) {
+        ::close(fd);
+        return true;
+    }
+    void *p = mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(p == MAP_FAILED)
+        return false;
+    // every byte is read once, front to back
+    madvise(p, s.st_size, MADV_SEQUENTIAL);
+    view = static_cast<const char *>(p);
+    length = s.st_size;
+    return true;
+}
+
+void pw_store::file_view::unmap()
+{
+    if(view)
+        munmap(const_cast<char *>(view), length);
+    view = nullptr;
+    length = 0;
+}
+#endif
+
+#ifdef NO_GOOD
+bool pw_store::replace_file(const std::string &path, const std::string &data)
+{
+    const stats::phase timing("write", data.size());
+    const std::string tmp = path + ".tmp";
+    FILE *f = std::fopen(tmp.c_str(), "wb");
+    if(!f)
+        return false;
+    if(!write_and_close(f, data.data(), data.size())) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    std::remove(path.c_str());
+    return !std::rename(tmp.c_str(), path.c_str());
+}
+
+bool pw_store::append_file(const std::string &path, const std::string &data)
+{
+    const stats::phase timing("write", data.size());
+    FILE *f = std::fopen(path.c_str(), "ab");
+    return f && write_and_close(f, data.data(), data.size());
+}
+
+// No ftruncate, the prefix is written again.
+bool pw_store::truncate_file(const std::string &path, std::size_t size)
+{
+    file_view view;
+    bool exists;
+    if(!view.open(path, exists) || !exists || view.size() < size)
+        return false;
+    const std::string prefix(view.begin(), size);
+    view.unmap();
+    return replace_file(path, prefix);
+}
+#else
+bool pw_store::replace_file(const std::string &path, const std::string &data)
+{
+    const stats::phase timing("write", data.size());
+    const std::string tmp = path + ".tmp";
+    // left over from an interrupted write
+    unlink(tmp.c_str());
+    const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if(fd < 0)
+        return false;
+    if(!write_and_close(fd, data.data(), data.size()) ||
+       rename(tmp.c_str(), path.c_str())) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return sync_directory(path);
+}
+
+// Only files created by replace_file are appended to.
+bool pw_store::append_file(const std::string &path, const std::string &data)
+{
+    const stats::phase timing("write", data.size());
+    const int fd = ::open(path.c_str(), O_WRONLY | O_APPEND);
+    return fd >= 0 && write_and_close(fd, data.data(), data.size());
+}
+
+bool pw_store::truncate_file(const std::string &path, std::size_t size)
+{
+    const int fd = ::open(path.c_str(), O_WRONLY);
+    if(fd < 0)
+        return false;
+    int result;
+    do
+        result = ftruncate(fd, static_cast<off_t>(size));
+    while(result && errno == EINTR);
+    const bool ok = !result && !fsync(fd);
+    return !::close(fd) && ok;
+}
+#endif
@@ -0,0 +1,122 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _CRYPTO_SEGMENT_HH_
+#define _CRYPTO_SEGMENT_HH_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace pw_store
+{
+
+// Building blocks of the encrypted files written by pwstore itself, see
+// journal.hh and page_file.hh.
+// format is:
+//   segment = SIZE NONCE CIPHERTEXT TAG
+// SIZE is the 32 bit size of the plaintext. The ciphertext is AES-256-GCM
+// with a random NONCE, additional data passed by the caller is
+// authenticated together with it. Integers are stored little endian.
+
+const std::size_t KEY_SIZE = 32;
+const std::size_t SALT_SIZE = 16;
+const std::size_t NONCE_SIZE = 12;
+const std::size_t TAG_SIZE = 16;
+const std::size_t SEGMENT_OVERHEAD = 4 + NONCE_SIZE + TAG_SIZE;
+const std::uint32_t PBKDF2_ITERATIONS = 100000;
+// sanity limits for values read from files
+const std::uint32_t MAX_ITERATIONS = 10000000;
+const std::uint32_t MAX_SEGMENT_SIZE = 1u << 30;
+
+void put_u32(std::string &s, std::uint32_t v);
+void put_u64(std::string &s, std::uint64_t v);
+std::uint32_t get_u32(const char *p);
+std::uint64_t get_u64(const char *p);
+
+bool random_bytes(void *p, std::size_t size);
+// PBKDF2-HMAC-SHA256 of password and SALT_SIZE bytes salt. With a key
+// cache set an empty password takes the key from it instead.
+bool derive_key(const std::string &password, const char *salt,
+                std::uint32_t iterations, unsigned char key[KEY_SIZE]);
+// Add a key to the key cache, if one is set. Only keys that decrypted
+// something belong there, a mistyped password would replace the right key.
+void cache_key(const char *salt, std::uint32_t iterations,
+               const unsigned char key[KEY_SIZE]);
+
+// Keys derived before, found by SALT ITERATIONS. See key_agent.hh.
+class key_cache
+{
+public:
+    virtual ~key_cache() {}
+    virtual bool find(const std::string &id, unsigned char key[KEY_SIZE]) = 0;
+    virtual void add(const std::string &id,
+                     const unsigned char key[KEY_SIZE]) = 0;
+};
+// nullptr, the default, disables caching.
+void set_key_cache(key_cache *cache);
+
+// Encrypt the size bytes at plaintext and append the segment to out.
+bool seal_segment(const unsigned char *key, const std::string &aad,
+                  const char *plaintext, std::size_t size, std::string &out);
+// Plaintext size of the segment at p, given left bytes of input. Returns
+// false if the segment is incomplete or its size is invalid.
+bool segment_size(const char *p, std::size_t left, std::size_t &size);
+// Authenticate and decrypt the segment at p into out, which has room for
+// its plaintext. out is undefined if this fails.
+bool unseal_segment(const unsigned char *key, const std::string &aad,
+                    const char *p, char *out);
+
+// Read-only view of a whole file. The file is mapped where mmap is
+// available and read into memory otherwise.
+class file_view
+{
+public:
+    file_view() : view(nullptr), length(0) {}
+    ~file_view() { unmap(); }
+    file_view(const file_view &) = delete;
+    file_view &operator=(const file_view &) = delete;
+
+    // A missing file is no error, exists is set to false then.
+    bool open(const std::string &path, bool &exists);
+    void unmap();
+
+    const char *begin() const { return view; }
+    const char *end() const { return view + length; }
+    std::size_t size() const { return length; }
+
+private:
+    const char *view;
+    std::size_t length;
+#ifdef NO_GOOD
+    std::string buffer;
+#endif
+};
+
+// Replace the file at path with data. Readers see the old or the new file,
+// never a partial one. The new file is only readable by the user, it is on
+// disk before it replaces the old one and the rename is on disk before this
+// returns, so a crash leaves one of them. Nothing is left behind on errors.
+bool replace_file(const std::string &path, const std::string &data);
+bool append_file(const std::string &path, const std::string &data);
+// Cut the file at path to its first size bytes. The result is on disk before
+// this returns.
+bool truncate_file(const std::string &path, std::size_t size);
+}
+
+#endif
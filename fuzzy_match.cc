@@ -0,0 +1,196 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "fuzzy_match.hh"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+
+// scoring constants of fzf
+const int score_match = 16;
+const int score_gap_start = -3;
+const int score_gap_extension = -1;
+const int bonus_boundary = score_match / 2;
+const int bonus_non_word = score_match / 2;
+const int bonus_camel123 = bonus_boundary + score_gap_extension;
+const int bonus_consecutive = -(score_gap_start + score_gap_extension);
+const int bonus_first_char_multiplier = 2;
+
+enum char_class { non_word, lower, upper, number };
+
+char_class class_of(char c)
+{
+    if(c >= 'a' && c <= 'z')
+        return lower;
+    if(c >= 'A' && c <= 'Z')
+        return upper;
+    if(c >= '0' && c <= '9')
+        return number;
+    // bytes of UTF-8 sequences count as letters
+    if(static_cast<unsigned char>(c) >= 0x80)
+        return lower;
+    return non_word;
+}
+
+int bonus_for(char_class prev, char_class current)
+{
+    if(prev == non_word && current != non_word)
+        return bonus_boundary;
+    if((prev == lower && current == upper) ||
+       (prev != number && current == number))
+        return bonus_camel123;
+    if(current == non_word)
+        return bonus_non_word;
+    return 0;
+}
+
+// Best score possible for a window of size characters matching key_size
+// characters: every character on a word boundary, all gaps in one run.
+int score_bound(std::size_t key_size, std::size_t size)
+{
+    const int gaps = static_cast<int>(size - key_size);
+    return static_cast<int>(key_size) * (score_match + bonus_boundary) +
+           bonus_boundary * (bonus_first_char_multiplier - 1) +
+           (gaps ? score_gap_start + (gaps - 1) * score_gap_extension : 0);
+}
+
+// Shortest window [begin, end) of match_text containing key as subsequence
+// that ends at the first possible position. False if there is none.
+bool fuzzy_window(const char *match_text, std::size_t size,
+                  const std::string &key, std::size_t &begin,
+                  std::size_t &end)
+{
+    const char *p = match_text;
+    const char *const text_end = match_text + size;
+    for(const char c : key) {
+        p = static_cast<const char *>(std::memchr(p, c, text_end - p));
+        if(!p)
+            return false;
+        p++;
+    }
+    end = p - match_text;
+
+    std::size_t i = end;
+    for(auto k = key.rbegin(); k != key.rend(); k++) {
+        while(match_text[--i] != *k)
+            ;
+    }
+    begin = i;
+    return true;
+}
+
+int score_window(const char *text, const char *match_text, std::size_t begin,
+                 std::size_t end, const std::string &key)
+{
+    int score = 0;
+    bool in_gap = false;
+    int consecutive = 0;
+    int first_bonus = 0;
+    std::size_t k = 0;
+    char_class prev = begin ? class_of(text[begin - 1]) : non_word;
+    for(std::size_t i = begin; i < end; i++) {
+        const char_class current = class_of(text[i]);
+        if(k < key.size() && match_text[i] == key[k]) {
+            score += score_match;
+            int bonus = bonus_for(prev, current);
+            if(consecutive == 0)
+                first_bonus = bonus;
+            else {
+                // a boundary inside a run of consecutive matches
+                if(bonus >= bonus_boundary && bonus > first_bonus)
+                    first_bonus = bonus;
+                bonus = std::max(std::max(bonus, first_bonus),
+                                 bonus_consecutive);
+            }
+            score += k == 0 ? bonus * bonus_first_char_multiplier : bonus;
+            in_gap = false;
+            consecutive++;
+            k++;
+        } else {
+            score += in_gap ? score_gap_extension : score_gap_start;
+            in_gap = true;
+            consecutive = 0;
+            first_bonus = 0;
+        }
+        prev = current;
+    }
+    return score;
+}
+}
+
+bool pw_store::fuzzy_score(const char *text, const char *match_text,
+                           std::size_t size, const std::string &key,
+                           int &score)
+{
+    std::size_t begin, end;
+    if(key.empty() || !fuzzy_window(match_text, size, key, begin, end))
+        return false;
+    score = score_window(text, match_text, begin, end, key);
+    return true;
+}
+
+void pw_store::fuzzy_top_k(const key_column &column, const std::string &key,
+                           std::size_t k, std::size_t first,
+                           std::size_t last, std::vector<fuzzy_hit> &hits)
+{
+    if(!k || key.empty() || !column.built())
+        return;
+
+    // smart case like fzf
+    const bool ignore_case =
+        std::none_of(std::begin(key), std::end(key),
+                     [](char c) { return c >= 'A' && c <= 'Z'; });
+    const std::string pattern = ignore_case ? fold_case(key) : key;
+    const char *const text = column.text().data();
+    const char *const match_text =
+        ignore_case ? column.folded_text().data() : text;
+
+    // min-heap of the k best hits, the worst one on top
+    std::vector<fuzzy_hit> best;
+    best.reserve(k + 1);
+    for(auto slot = first; slot < last; slot++) {
+        const std::size_t offset = column.record_begin(slot);
+        // without the trailing '\n'
+        const std::size_t size = column.record_end(slot) - offset - 1;
+        std::size_t begin, end;
+        if(!fuzzy_window(match_text + offset, size, pattern, begin, end))
+            continue;
+        if(best.size() == k &&
+           score_bound(pattern.size(), end - begin) < best.front().score)
+            continue;
+
+        const fuzzy_hit hit = {slot,
+                               score_window(text + offset, match_text + offset,
+                                            begin, end, pattern),
+                               static_cast<std::uint32_t>(size)};
+        if(best.size() == k) {
+            if(!fuzzy_better(hit, best.front()))
+                continue;
+            std::pop_heap(std::begin(best), std::end(best), fuzzy_better);
+            best.back() = hit;
+        } else
+            best.push_back(hit);
+        std::push_heap(std::begin(best), std::end(best), fuzzy_better);
+    }
+
+    std::sort_heap(std::begin(best), std::end(best), fuzzy_better);
+    hits.insert(std::end(hits), std::begin(best), std::end(best));
+}
@@ -0,0 +1,68 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _FUZZY_MATCH_HH_
+#define _FUZZY_MATCH_HH_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "key_column.hh"
+#include "pwstore.hh"
+
+namespace pw_store
+{
+
+// Score of key as a subsequence of text, following the v1 algorithm of fzf:
+// the first occurrence of the subsequence is shrunk from its end to the
+// shortest window, which is scored with a bonus per matched character,
+// more for word starts, camelCase humps and consecutive characters, and a
+// penalty per skipped character. Characters are compared in match_text, the
+// word boundaries are taken from text. Both have the same size.
+// Returns false if key is no subsequence of text.
+bool fuzzy_score(const char *text, const char *match_text, std::size_t size,
+                 const std::string &key, int &score);
+
+struct fuzzy_hit
+{
+    std::size_t slot;
+    int score;
+    std::uint32_t length;
+};
+
+// Higher score first, then shorter records, then lower slots.
+inline bool fuzzy_better(const fuzzy_hit &a, const fuzzy_hit &b)
+{
+    if(a.score != b.score)
+        return a.score > b.score;
+    if(a.length != b.length)
+        return a.length < b.length;
+    return a.slot < b.slot;
+}
+
+// Append the k best fuzzy matches of key in the records [first, last) of
+// column to hits, best first. Records that can not beat the worst of the
+// current k best are skipped before scoring. Case is ignored unless key
+// contains upper case characters.
+void fuzzy_top_k(const key_column &column, const std::string &key,
+                 std::size_t k, std::size_t first, std::size_t last,
+                 std::vector<fuzzy_hit> &hits);
+}
+
+#endif
@@ -0,0 +1,407 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "journal.hh"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "crypto_segment.hh"
+#include "secure_arena.hh"
+
+namespace
+{
+const std::string MAGIC = "PWSJRNL1";
+// hex digits
+const std::size_t GENERATION_SIZE = 32;
+const std::size_t HEADER_SIZE =
+    8 + pw_store::SALT_SIZE + 4 + GENERATION_SIZE;
+
+std::string segment_aad(const std::string &header, std::uint64_t index)
+{
+    std::string aad(header);
+    pw_store::put_u64(aad, index);
+    return aad;
+}
+
+// Plaintext segments between the thread decrypting them and the caller of
+// journal::open applying them. At most depth segments wait in between.
+class segment_queue
+{
+public:
+    explicit segment_queue(std::size_t depth)
+        : depth(depth), closed(false), cancelled(false)
+    {
+    }
+    ~segment_queue() { cancel(); }
+
+    // Takes the plaintext, waits while the queue is full. Returns false if
+    // the consumer cancelled.
+    bool push(pw_store::secure_buffer &plaintext)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock,
+                     [this]() { return cancelled || queue.size() < depth; });
+        if(cancelled)
+            return false;
+        queue.emplace_back();
+        queue.back().swap(plaintext);
+        changed.notify_all();
+        return true;
+    }
+    // Waits for the next segment. Returns false after close() once all
+    // segments are taken.
+    bool pop(pw_store::secure_buffer &plaintext)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return closed || !queue.empty(); });
+        if(queue.empty())
+            return false;
+        plaintext.swap(queue.front());
+        queue.pop_front();
+        changed.notify_all();
+        return true;
+    }
+    // no more segments follow
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        changed.notify_all();
+    }
+    // stop the producer and wipe the waiting segments
+    void cancel()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cancelled = true;
+        queue.clear();
+        changed.notify_all();
+    }
+
+private:
+    const std::size_t depth;
+    std::mutex mutex;
+    std::condition_variable changed;
+    // plaintext stays in locked memory, wiped when it is dropped
+    std::deque<pw_store::secure_buffer> queue;
+    bool closed;
+    bool cancelled;
+};
+
+// Outcome of reading the segments of a journal.
+struct read_state
+{
+    enum { complete, incomplete, corrupt, unauthentic } result;
+    std::uint64_t segments;
+    // end of the last complete segment
+    std::size_t end;
+};
+
+// Runs on the reader thread of journal::open(): decrypts the segments
+// following the header in [begin, end).
+void read_segments(const char *begin, const char *end,
+                   const unsigned char *key, const std::string &header,
+                   segment_queue &queue, read_state &state)
+{
+    state.result = read_state::complete;
+    state.segments = 0;
+    state.end = HEADER_SIZE;
+
+    pw_store::secure_buffer plaintext;
+    for(const char *p = begin + HEADER_SIZE; p < end;) {
+        // Only an append interrupted by a crash leaves a segment running
+        // past the end of the file. Invalid sizes are corruption, every
+        // segment starts with the time of writing.
+        const std::size_t left = end - p;
+        if(left < 4) {
+            state.result = read_state::incomplete;
+            break;
+        }
+        const std::size_t size = pw_store::get_u32(p);
+        if(size < 8 || size > pw_store::MAX_SEGMENT_SIZE) {
+            state.result = read_state::corrupt;
+            break;
+        }
+        if(left < pw_store::SEGMENT_OVERHEAD + size) {
+            state.result = read_state::incomplete;
+            break;
+        }
+
+        if(!pw_store::unseal_segment(key, segment_aad(header, state.segments),
+                                     p, plaintext.allocate(size))) {
+            plaintext.clear();
+            state.result = read_state::unauthentic;
+            break;
+        }
+        if(!queue.push(plaintext))
+            break;
+        state.segments++;
+        p += pw_store::SEGMENT_OVERHEAD + size;
+        state.end = p - begin;
+    }
+}
+}
+
+pw_store::journal::journal(const std::string &file)
+    : path(file), valid(false), torn(false), file_size(0), segment_count(0),
+      last_append(0)
+{
+    wipe(reinterpret_cast<char *>(key), sizeof(key));
+}
+
+bool pw_store::journal::derive_key(const std::string &password,
+                                   const std::string &key_id,
+                                   const unsigned char *shared_key)
+{
+    const char *const salt = header.data() + MAGIC.size();
+    if(shared_key && key_id.size() == SALT_SIZE + 4 &&
+       std::equal(std::begin(key_id), std::end(key_id), salt)) {
+        std::copy(shared_key, shared_key + sizeof(key), key);
+        return true;
+    }
+    return pw_store::derive_key(password, salt, get_u32(salt + SALT_SIZE),
+                                key);
+}
+
+void pw_store::journal::cache_key() const
+{
+    const char *const salt = header.data() + MAGIC.size();
+    pw_store::cache_key(salt, get_u32(salt + SALT_SIZE), key);
+}
+
+bool pw_store::journal::open(const std::string &password,
+                             const std::string &generation,
+                             const apply_function &apply,
+                             const std::string &key_id,
+                             const unsigned char *shared_key)
+{
+    close();
+    file_size = 0;
+    segment_count = 0;
+    last_append = 0;
+
+    file_view view;
+    bool exists;
+    if(!view.open(path, exists)) {
+        std::cerr << "Error: reading journal \"" << path << "\" failed.\n";
+        return false;
+    }
+    if(!exists) {
+        std::cerr << "Warning: journal \"" << path << "\" is missing, "
+                     "changes since the last full write may be lost.\n";
+        return true;
+    }
+    if(view.size() < HEADER_SIZE ||
+       !std::equal(std::begin(MAGIC), std::end(MAGIC), view.begin())) {
+        std::cerr << "Error: \"" << path << "\" is no journal.\n";
+        return false;
+    }
+    header.assign(view.begin(), HEADER_SIZE);
+    // Left over from a full write of the database that was interrupted, or
+    // replaced by an old copy.
+    if(header.compare(HEADER_SIZE - GENERATION_SIZE, GENERATION_SIZE,
+                      generation)) {
+        std::cerr << "Warning: journal \"" << path << "\" belongs to "
+                     "another version of the database and is ignored, "
+                     "changes since the last full write may be lost.\n";
+        return true;
+    }
+    if(!derive_key(password, key_id, shared_key)) {
+        std::cerr << "Error: deriving journal key failed.\n";
+        return false;
+    }
+
+    // Decryption of the next segments overlaps with applying the current
+    // one. The ciphertext is decrypted straight from the mapping, at most
+    // two plaintext segments are in memory.
+    segment_queue queue(2);
+    read_state state;
+    std::thread reader([this, &view, &queue, &state]() {
+        read_segments(view.begin(), view.end(), key, header, queue, state);
+        queue.close();
+    });
+    bool applied = true;
+    secure_buffer plaintext;
+    try {
+        while(applied && queue.pop(plaintext)) {
+            applied = apply(plaintext.data() + 8,
+                            plaintext.data() + plaintext.size());
+            last_append = static_cast<std::time_t>(get_u64(plaintext.data()));
+            plaintext.clear();
+        }
+    } catch(...) {
+        queue.cancel();
+        reader.join();
+        close();
+        throw;
+    }
+    queue.cancel();
+    reader.join();
+    view.unmap();
+
+    if(!applied) {
+        close();
+        return false;
+    }
+    switch(state.result) {
+    case read_state::complete:
+        break;
+    case read_state::incomplete:
+        // Usually an append interrupted by a crash, but a corrupt size of an
+        // earlier segment looks the same. The rest is kept until the next
+        // append, which saves it before cutting it off.
+        std::cerr << "Warning: journal \"" << path << "\" ends in an "
+                  << "incomplete segment after segment " << state.segments
+                  << ", ignoring the rest.\n";
+        torn = true;
+        break;
+    case read_state::corrupt:
+        std::cerr << "Error: journal segment " << state.segments
+                  << " is corrupt.\n";
+        close();
+        return false;
+    case read_state::unauthentic:
+        std::cerr << "Error: journal segment " << state.segments
+                  << " failed authentication.\n";
+        close();
+        return false;
+    }
+
+    file_size = state.end;
+    segment_count = state.segments;
+    valid = true;
+    // only proven right by a segment
+    if(segment_count && !password.empty())
+        cache_key();
+    return true;
+}
+
+bool pw_store::journal::create(const std::string &password,
+                               const std::string &generation,
+                               const std::string &key_id,
+                               const unsigned char *shared_key)
+{
+    close();
+    if(generation.size() != GENERATION_SIZE ||
+       (!key_id.empty() && key_id.size() != SALT_SIZE + 4))
+        return false;
+
+    header = MAGIC;
+    if(key_id.empty()) {
+        char salt[SALT_SIZE];
+        if(!random_bytes(salt, sizeof(salt)))
+            return false;
+        header.append(salt, sizeof(salt));
+        put_u32(header, PBKDF2_ITERATIONS);
+    } else
+        header.append(key_id);
+    header.append(generation);
+    if(!derive_key(password, key_id, shared_key) ||
+       !replace_file(path, header)) {
+        std::cerr << "Error: creating journal \"" << path << "\" failed.\n";
+        close();
+        return false;
+    }
+
+    file_size = header.size();
+    segment_count = 0;
+    last_append = 0;
+    valid = true;
+    if(!password.empty())
+        cache_key();
+    return true;
+}
+
+bool pw_store::journal::append(const secure_buffer &plaintext)
+{
+    if(!valid)
+        return false;
+    // appends must not follow the incomplete segment
+    if(torn && !cut_torn_tail()) {
+        std::cerr << "Error: cutting off the incomplete segment of journal \""
+                  << path << "\" failed.\n";
+        close();
+        return false;
+    }
+
+    const std::time_t now = std::time(nullptr);
+    std::string time;
+    put_u64(time, static_cast<std::uint64_t>(now));
+    secure_buffer payload;
+    char *const p = payload.allocate(time.size() + plaintext.size());
+    std::memcpy(p, time.data(), time.size());
+    if(!plaintext.empty())
+        std::memcpy(p + time.size(), plaintext.data(), plaintext.size());
+    std::string segment;
+    const bool sealed = seal_segment(key, segment_aad(header, segment_count),
+                                     payload.data(), payload.size(), segment);
+    payload.clear();
+    if(!sealed || !append_file(path, segment)) {
+        // The file may end in a partial segment now. Only a new journal
+        // can be appended to.
+        std::cerr << "Error: appending to journal \"" << path
+                  << "\" failed.\n";
+        close();
+        return false;
+    }
+
+    file_size += segment.size();
+    segment_count++;
+    last_append = now;
+    return true;
+}
+
+bool pw_store::journal::cut_torn_tail()
+{
+    file_view view;
+    bool exists;
+    if(!view.open(path, exists) || !exists || view.size() < file_size)
+        return false;
+    const std::string tail(view.begin() + file_size, view.end());
+    view.unmap();
+    if(!replace_file(path + ".torn", tail) || !truncate_file(path, file_size))
+        return false;
+    torn = false;
+    return true;
+}
+
+void pw_store::journal::close()
+{
+    wipe(reinterpret_cast<char *>(key), sizeof(key));
+    valid = false;
+    torn = false;
+}
+
+std::string pw_store::journal::new_generation()
+{
+    unsigned char random[GENERATION_SIZE / 2];
+    if(!random_bytes(random, sizeof(random)))
+        return "";
+    const char *const digits = "0123456789abcdef";
+    std::string generation;
+    for(const auto b : random) {
+        generation.push_back(digits[b >> 4]);
+        generation.push_back(digits[b & 0xf]);
+    }
+    return generation;
+}
@@ -0,0 +1,123 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _JOURNAL_HH_
+#define _JOURNAL_HH_
+
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <string>
+
+#include "secure_arena.hh"
+
+namespace pw_store
+{
+
+// Append-only side file of a database file. Changes written since the last
+// full write of the database are appended as encrypted segments, so a sync
+// costs the size of the change instead of the size of the database.
+// format is:
+//   header = MAGIC SALT ITERATIONS GENERATION
+//   segment = SIZE NONCE CIPHERTEXT TAG
+//   file = header segment*
+// Segments are encrypted with AES-256-GCM under a key derived from the
+// password and SALT with PBKDF2. The header and the index of the segment are
+// authenticated with every segment, so segments can not be modified,
+// reordered or moved to another journal.
+// GENERATION ties the journal to one full write of the database: the
+// database file stores it too (see database::journal_generation) and a
+// journal of another generation is ignored. A new generation is created with
+// every full write, which makes the journal of the previous one obsolete.
+class journal
+{
+public:
+    using apply_function = std::function<bool(const char *, const char *)>;
+
+    explicit journal(const std::string &file);
+    ~journal() { close(); }
+    journal(const journal &) = delete;
+    journal &operator=(const journal &) = delete;
+
+    // Read the journal of generation and pass the plaintext of every segment
+    // to apply, in the order of writing. A missing journal or a journal of
+    // another generation is not an error, e.g. after a crash during a full
+    // write, but it is reported with a warning and can not be appended to.
+    // Returns false if a segment is corrupt, fails authentication or apply
+    // fails. Only a last segment running past the end of the file, e.g.
+    // after a crash during append(), is ignored with a warning. The file is
+    // left unchanged by open(), the next append() cuts it off after the last
+    // complete segment and saves the cut bytes to file + ".torn".
+    // The file is mapped read-only: a second thread decrypts the next
+    // segments from the mapping while apply runs, holding at most two of
+    // them.
+    // shared_key is the key of SALT ITERATIONS key_id, e.g. of the database
+    // file (see page_file::file_key). It is used instead of deriving the key
+    // again if the journal has the same salt.
+    bool open(const std::string &password, const std::string &generation,
+              const apply_function &apply,
+              const std::string &key_id = std::string(),
+              const unsigned char *shared_key = nullptr);
+    // Replace the journal with an empty one of generation. The key is
+    // derived with a new salt, or with SALT ITERATIONS of key_id if given
+    // (see page_file::key_id). Passing its key as shared_key too saves
+    // deriving it again.
+    bool create(const std::string &password, const std::string &generation,
+                const std::string &key_id = std::string(),
+                const unsigned char *shared_key = nullptr);
+    // Encrypt and append one segment.
+    bool append(const secure_buffer &plaintext);
+    // Forget the key.
+    void close();
+
+    // true after a successful open() of a journal of the right generation
+    // or create().
+    bool usable() const { return valid; }
+    // bytes on disk
+    std::size_t size() const { return file_size; }
+    std::size_t segments() const { return segment_count; }
+    // time of the last append(), 0 if there are no segments.
+    std::time_t time_of_last_append() const { return last_append; }
+
+    // random generation as stored in the database file
+    static std::string new_generation();
+
+private:
+    // Take shared_key if the header has key_id, derive it otherwise.
+    bool derive_key(const std::string &password,
+                    const std::string &key_id = std::string(),
+                    const unsigned char *shared_key = nullptr);
+    // Add the key to the key cache, see pw_store::cache_key.
+    void cache_key() const;
+    // Save the bytes after the last complete segment and cut them off.
+    bool cut_torn_tail();
+
+    std::string path;
+    std::string header;
+    // AES-256 key, wiped by close()
+    unsigned char key[32];
+    bool valid;
+    // the file continues after file_size with an incomplete segment
+    bool torn;
+    std::size_t file_size;
+    std::uint64_t segment_count;
+    std::time_t last_append;
+};
+}
+
+#endif
@@ -0,0 +1,220 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include "key_agent.hh"
+
+#include <cstring>
+#include <iostream>
+
+#ifndef NO_GOOD
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "local_socket.hh"
+
+namespace
+{
+const std::size_t ID_SIZE = pw_store::SALT_SIZE + 4;
+const char FIND = 'f';
+const char ADD = 'a';
+const char FOUND = '+';
+const char MISSING = '-';
+}
+
+pw_store::key_agent::key_agent(const std::string &socket_path,
+                               std::time_t ttl)
+    : path(socket_path), ttl(ttl), listener(-1), keys(nullptr),
+      entries(max_keys)
+{
+}
+
+pw_store::key_agent::~key_agent() { shutdown(); }
+
+bool pw_store::key_agent::listen()
+{
+    keys = arena.allocate(max_keys * KEY_SIZE);
+    listener = listen_socket(path);
+    return listener >= 0;
+}
+
+bool pw_store::key_agent::run()
+{
+    if(listener < 0 && !listen())
+        return false;
+
+    catch_stop_signals();
+    while(!stop_signal_caught()) {
+        const int connection = accept_connection(listener, 1000);
+        expire();
+        if(connection < 0)
+            continue;
+        handle(connection);
+        close_socket(connection);
+    }
+
+    arena.release();
+    keys = nullptr;
+    return true;
+}
+
+#ifdef NO_GOOD
+bool pw_store::key_agent::detach() { return run(); }
+#else
+bool pw_store::key_agent::detach()
+{
+    if(listener < 0 && !listen())
+        return false;
+
+    const pid_t pid = fork();
+    if(pid < 0) {
+        std::cerr << "Error: starting the agent failed: "
+                  << std::strerror(errno) << "\n";
+        return false;
+    }
+    if(pid) {
+        close_socket(listener);
+        listener = -1;
+        arena.release();
+        keys = nullptr;
+        return true;
+    }
+
+    setsid();
+    const int null = open("/dev/null", O_RDWR);
+    if(null >= 0) {
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        if(null > STDERR_FILENO)
+            close(null);
+    }
+    const bool ok = run();
+    shutdown();
+    _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+#endif
+
+void pw_store::key_agent::shutdown()
+{
+    if(listener < 0)
+        return;
+    close_socket(listener);
+    listener = -1;
+    remove_socket(path);
+}
+
+void pw_store::key_agent::handle(int connection)
+{
+    char request[1 + ID_SIZE + KEY_SIZE];
+    if(!receive_all(connection, request, 1 + ID_SIZE))
+        return;
+    const std::string id(request + 1, ID_SIZE);
+
+    if(request[0] == FIND) {
+        char response[1 + KEY_SIZE];
+        std::size_t size = 1;
+        response[0] = MISSING;
+        if(const entry *e = find(id)) {
+            response[0] = FOUND;
+            std::memcpy(response + 1, keys + (e - &entries[0]) * KEY_SIZE,
+                        KEY_SIZE);
+            size = sizeof(response);
+        }
+        send_all(connection, response, size);
+        wipe(response, sizeof(response));
+    } else if(request[0] == ADD &&
+              receive_all(connection, request + 1 + ID_SIZE, KEY_SIZE)) {
+        const auto slot = slot_for(id);
+        std::memcpy(keys + slot * KEY_SIZE, request + 1 + ID_SIZE, KEY_SIZE);
+        entries[slot].id = id;
+        entries[slot].expires = std::time(nullptr) + ttl;
+        send_all(connection, &FOUND, 1);
+    }
+    wipe(request, sizeof(request));
+}
+
+void pw_store::key_agent::expire()
+{
+    const std::time_t now = std::time(nullptr);
+    for(std::size_t i = 0; i < entries.size(); i++)
+        if(!entries[i].id.empty() && entries[i].expires <= now) {
+            wipe(keys + i * KEY_SIZE, KEY_SIZE);
+            entries[i].id.clear();
+        }
+}
+
+pw_store::key_agent::entry *pw_store::key_agent::find(const std::string &id)
+{
+    const std::time_t now = std::time(nullptr);
+    for(auto &e : entries)
+        if(e.id == id && e.expires > now)
+            return &e;
+    return nullptr;
+}
+
+std::size_t pw_store::key_agent::slot_for(const std::string &id)
+{
+    for(std::size_t i = 0; i < entries.size(); i++)
+        if(entries[i].id == id)
+            return i;
+    std::size_t slot = 0;
+    for(std::size_t i = 0; i < entries.size(); i++) {
+        if(entries[i].id.empty())
+            return i;
+        if(entries[i].expires < entries[slot].expires)
+            slot = i;
+    }
+    return slot;
+}
+
+bool pw_store::agent_key_cache::find(const std::string &id,
+                                     unsigned char key[KEY_SIZE])
+{
+    const int fd = id.size() == ID_SIZE ? connect_socket(path) : -1;
+    if(fd < 0)
+        return false;
+    const std::string request = FIND + id;
+    char status = MISSING;
+    const bool found =
+        send_all(fd, request.data(), request.size()) &&
+        receive_all(fd, &status, 1) && status == FOUND &&
+        receive_all(fd, reinterpret_cast<char *>(key), KEY_SIZE);
+    close_socket(fd);
+    return found;
+}
+
+void pw_store::agent_key_cache::add(const std::string &id,
+                                    const unsigned char key[KEY_SIZE])
+{
+    const int fd = id.size() == ID_SIZE ? connect_socket(path) : -1;
+    if(fd < 0)
+        return;
+    char request[1 + ID_SIZE + KEY_SIZE];
+    request[0] = ADD;
+    std::memcpy(request + 1, id.data(), ID_SIZE);
+    std::memcpy(request + 1 + ID_SIZE, key, KEY_SIZE);
+    char status;
+    if(send_all(fd, request, sizeof(request)))
+        receive_all(fd, &status, 1);
+    wipe(request, sizeof(request));
+    close_socket(fd);
+}
@@ -0,0 +1,101 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef _KEY_AGENT_HH_
+#define _KEY_AGENT_HH_
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "crypto_segment.hh"
+#include "secure_arena.hh"
+
+namespace pw_store
+{
+
+// Process caching derived keys for other pwstore processes, so they neither
+// ask for the password nor run PBKDF2 again. It never sees a password, only
+// keys, kept in locked memory (see secure_arena) for ttl seconds after they
+// were added. Requests come in over a local socket (see local_socket.hh),
+// one per connection:
+//   request = 'f' ID | 'a' ID KEY
+//   response = STATUS [KEY]
+// with ID being SALT ITERATIONS of the key, see key_cache.
+class key_agent
+{
+public:
+    static const std::size_t max_keys = 64;
+
+    key_agent(const std::string &socket_path, std::time_t ttl);
+    ~key_agent();
+    key_agent(const key_agent &) = delete;
+    key_agent &operator=(const key_agent &) = delete;
+
+    // Create the socket. Clients can connect after this.
+    bool listen();
+    // Serve requests until SIGTERM or SIGINT.
+    bool run();
+    // run() in a child process detached from the terminal. Returns in the
+    // parent only, the socket belongs to the child then.
+    bool detach();
+
+private:
+    struct entry
+    {
+        std::string id;
+        std::time_t expires;
+    };
+    void handle(int connection);
+    // close and remove the socket
+    void shutdown();
+    void expire();
+    entry *find(const std::string &id);
+    // slot for id, reusing the one expiring first if all are taken
+    std::size_t slot_for(const std::string &id);
+
+    std::string path;
+    std::time_t ttl;
+    int listener;
+    secure_arena arena;
+    // keys[i * KEY_SIZE] belongs to entries[i]
+    char *keys;
+    std::vector<entry> entries;
+};
+
+// key_cache asking the agent listening on socket_path. Every failure is a
+// cache miss.
+class agent_key_cache : public key_cache
+{
+public:
+    explicit agent_key_cache(const std::string &socket_path)
+        : path(socket_path)
+    {
+    }
+
+    bool find(const std::string &id, unsigned char key[KEY_SIZE]) override;
+    void add(const std::string &id,
+             const unsigned char key[KEY_SIZE]) override;
+
+private:
+    std::string path;
+};
+}
+
+#endif
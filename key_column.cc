@@ -0,0 +1,105 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "key_column.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "simd_find.hh"
+
+void pw_store::key_column::build(const std::vector<record> &records)
+{
+    clear();
+
+    std::size_t size = 0;
+    for(const auto &r : records)
+        size += r.url_string.size + r.username.size + 2;
+    // offsets are stored as 32 bit values
+    if(size >= std::numeric_limits<std::uint32_t>::max())
+        return;
+
+    char *const begin = keys.allocate(size);
+    char *p = begin;
+    offsets.reserve(records.size() + 1);
+    for(const auto &r : records) {
+        offsets.push_back(p - begin);
+        if(r.url_string.size)
+            std::memcpy(p, r.url_string.data, r.url_string.size);
+        p += r.url_string.size;
+        *p++ = '\t';
+        if(r.username.size)
+            std::memcpy(p, r.username.data, r.username.size);
+        p += r.username.size;
+        *p++ = '\n';
+    }
+    offsets.push_back(p - begin);
+    valid = true;
+}
+
+void pw_store::key_column::fold()
+{
+    if(!valid || folded_built())
+        return;
+    char *const p = folded.allocate(keys.size());
+    std::transform(keys.data(), keys.data() + keys.size(), p,
+                   [](char c) { return fold_case(c); });
+}
+
+void pw_store::key_column::clear()
+{
+    keys.clear();
+    folded.clear();
+    offsets.clear();
+    valid = false;
+}
+
+std::size_t pw_store::key_column::record_at(std::size_t pos) const
+{
+    return std::upper_bound(offsets.begin(), offsets.end(), pos) -
+           offsets.begin() - 1;
+}
+
+bool pw_store::key_column::scan(const std::string &key,
+                                std::vector<std::size_t> &slots,
+                                std::size_t first, std::size_t last,
+                                bool ignore_case) const
+{
+    if(!valid || !searchable(key) || (ignore_case && !folded_built()))
+        return false;
+    if(first >= last)
+        return true;
+
+    const std::string &pattern = ignore_case ? fold_case(key) : key;
+    // Search the whole range at once. After a hit continue with the next
+    // record, every record is reported only once.
+    const char *const begin = ignore_case ? folded.data() : keys.data();
+    const char *const end = begin + offsets[last];
+    const char *p = begin + offsets[first];
+    while(true) {
+        p = simd_find(p, end, pattern.data(), pattern.size());
+        if(p == end)
+            break;
+        const auto slot = record_at(p - begin);
+        slots.push_back(slot);
+        p = begin + offsets[slot + 1];
+    }
+
+    return true;
+}
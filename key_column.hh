@@ -0,0 +1,107 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _KEY_COLUMN_HH_
+#define _KEY_COLUMN_HH_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "pwstore.hh"
+#include "secure_arena.hh"
+
+namespace pw_store
+{
+
+// Search layout of the keys of all records, struct-of-arrays style: url and
+// username of every record packed into one buffer as
+//   URL '\t' USERNAME '\n'
+// plus an offset table. Scans over it read only key bytes, the passwords
+// stay in the records and are never touched by a search.
+// It is a copy beside the records, which remain the storage: it costs the
+// key bytes plus 4 bytes per record, see memory(). A case folded copy of
+// the text with the same offsets serves lookups ignoring case and costs the
+// key bytes again, it is only made by fold(). Both are plaintext like the
+// records and kept in secure_buffers.
+class key_column
+{
+public:
+    key_column() : valid(false) {}
+    ~key_column() { clear(); }
+
+    void build(const std::vector<record> &records);
+    void clear();
+    bool built() const { return valid; }
+
+    // Make folded_text(), not safe concurrently with scans.
+    void fold();
+    bool folded_built() const { return valid && folded.size() == keys.size(); }
+    // bytes allocated by the column
+    std::size_t memory() const
+    {
+        return keys.size() + folded.size() +
+               offsets.capacity() * sizeof(std::uint32_t);
+    }
+
+    const secure_buffer &text() const { return keys; }
+    // text() passed through fold_case, empty until fold()
+    const secure_buffer &folded_text() const { return folded; }
+    // number of records
+    std::size_t size() const { return valid ? offsets.size() - 1 : 0; }
+    // slot of the record the text position pos belongs to
+    std::size_t record_at(std::size_t pos) const;
+    std::size_t record_begin(std::size_t slot) const
+    {
+        return offsets[slot];
+    }
+    std::size_t record_end(std::size_t slot) const
+    {
+        return offsets[slot + 1];
+    }
+
+    // A key containing a separator could match across field boundaries
+    // and can not be searched in the column.
+    static bool searchable(const std::string &key)
+    {
+        return !key.empty() && key.find_first_of("\t\n") == std::string::npos;
+    }
+
+    // Store the slots of all records with url or username containing key in
+    // slots, in ascending order. Returns false if the column can not answer
+    // the query, also for ignore_case before fold().
+    bool scan(const std::string &key, std::vector<std::size_t> &slots,
+              bool ignore_case = false) const
+    {
+        return scan(key, slots, 0, size(), ignore_case);
+    }
+    // Same for the records [first, last) only. Safe to call concurrently.
+    bool scan(const std::string &key, std::vector<std::size_t> &slots,
+              std::size_t first, std::size_t last,
+              bool ignore_case = false) const;
+
+private:
+    bool valid;
+    secure_buffer keys;
+    secure_buffer folded;
+    // offsets[i] is the start of record i in keys, offsets[size()] the end.
+    std::vector<std::uint32_t> offsets;
+};
+}
+
+#endif
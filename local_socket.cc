@@ -0,0 +1,289 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include "local_socket.hh"
+
+#include <cstring>
+#include <iostream>
+
+#include "secure_arena.hh"
+
+#ifndef NO_GOOD
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef NO_GOOD
+std::string pw_store::new_socket_path(const std::string &)
+{
+    return std::string();
+}
+
+int pw_store::listen_socket(const std::string &)
+{
+    std::cerr << "Error: UNIX domain sockets are not supported.\n";
+    return -1;
+}
+
+int pw_store::accept_connection(int, int) { return -1; }
+
+int pw_store::connect_socket(const std::string &) { return -1; }
+
+void pw_store::close_socket(int) {}
+
+void pw_store::remove_socket(const std::string &) {}
+
+bool pw_store::same_user(int) { return false; }
+
+bool pw_store::send_all(int, const char *, std::size_t) { return false; }
+
+bool pw_store::receive_all(int, char *, std::size_t, int) { return false; }
+
+bool pw_store::peer_closed(int) { return true; }
+
+bool pw_store::wait_readable(const std::vector<int> &, int,
+                             std::vector<bool> &)
+{
+    return false;
+}
+
+bool pw_store::receive_available(int, std::string &) { return false; }
+
+void pw_store::catch_stop_signals() {}
+
+bool pw_store::stop_signal_caught() { return false; }
+#else
+namespace
+{
+const int IO_TIMEOUT_MS = 1000;
+
+volatile std::sig_atomic_t stop_requested = 0;
+void stop_handler(int) { stop_requested = 1; }
+
+bool socket_address(const std::string &path, sockaddr_un &address)
+{
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(path.empty() || path.size() >= sizeof(address.sun_path))
+        return false;
+    std::memcpy(address.sun_path, path.data(), path.size());
+    return true;
+}
+
+bool wait_for(int fd, short events, int timeout_ms)
+{
+    pollfd p = {fd, events, 0};
+    int ready;
+    while((ready = poll(&p, 1, timeout_ms)) < 0 && errno == EINTR &&
+          !stop_requested)
+        ;
+    return ready == 1;
+}
+}
+
+std::string pw_store::new_socket_path(const std::string &name)
+{
+    const char *const tmp = std::getenv("TMPDIR");
+    std::string dir = std::string(tmp && tmp[0] ? tmp : "/tmp") +
+                      "/pwstore-XXXXXX";
+    // mkdtemp creates the directory with mode 0700
+    if(!mkdtemp(&dir[0]))
+        return std::string();
+    return dir + "/" + name;
+}
+
+int pw_store::listen_socket(const std::string &path)
+{
+    sockaddr_un address;
+    if(!socket_address(path, address)) {
+        std::cerr << "Error: invalid socket \"" << path << "\".\n";
+        return -1;
+    }
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 ||
+       bind(fd, reinterpret_cast<const sockaddr *>(&address),
+            sizeof(address)) ||
+       chmod(path.c_str(), 0600) || listen(fd, 16)) {
+        std::cerr << "Error: listening on \"" << path
+                  << "\" failed: " << std::strerror(errno) << "\n";
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int pw_store::accept_connection(int listener, int timeout_ms)
+{
+    if(!wait_for(listener, POLLIN, timeout_ms))
+        return -1;
+    const int fd = accept(listener, nullptr, nullptr);
+    if(fd >= 0 && !same_user(fd)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int pw_store::connect_socket(const std::string &path)
+{
+    sockaddr_un address;
+    if(!socket_address(path, address))
+        return -1;
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+        return -1;
+    if(connect(fd, reinterpret_cast<const sockaddr *>(&address),
+               sizeof(address))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void pw_store::close_socket(int fd)
+{
+    if(fd >= 0)
+        close(fd);
+}
+
+void pw_store::remove_socket(const std::string &path)
+{
+    unlink(path.c_str());
+    // fails for directories not made by new_socket_path(), they are not
+    // empty
+    const auto slash = path.rfind('/');
+    if(slash != std::string::npos && slash)
+        rmdir(path.substr(0, slash).c_str());
+}
+
+bool pw_store::same_user(int fd)
+{
+#ifdef SO_PEERCRED
+    ucred peer;
+    socklen_t size = sizeof(peer);
+    return !getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &size) &&
+           peer.uid == getuid();
+#else
+    // The socket directory is only accessible by the user.
+    (void)fd;
+    return true;
+#endif
+}
+
+bool pw_store::send_all(int fd, const char *p, std::size_t size)
+{
+    while(size) {
+        if(!wait_for(fd, POLLOUT, IO_TIMEOUT_MS))
+            return false;
+        const ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool pw_store::receive_all(int fd, char *p, std::size_t size,
+                           int timeout_ms)
+{
+    while(size) {
+        if(!wait_for(fd, POLLIN, timeout_ms))
+            return false;
+        const ssize_t n = recv(fd, p, size, 0);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool pw_store::peer_closed(int fd)
+{
+    if(!wait_for(fd, POLLIN, 0))
+        return false;
+    char c;
+    return recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) <= 0;
+}
+
+bool pw_store::wait_readable(const std::vector<int> &fds, int timeout_ms,
+                             std::vector<bool> &ready)
+{
+    std::vector<pollfd> polled;
+    polled.reserve(fds.size());
+    for(const auto fd : fds)
+        polled.push_back({fd, POLLIN, 0});
+    int count;
+    while((count = poll(polled.data(), polled.size(), timeout_ms)) < 0 &&
+          errno == EINTR && !stop_requested)
+        ;
+    ready.assign(fds.size(), false);
+    for(std::size_t i = 0; count > 0 && i < polled.size(); i++)
+        ready[i] = polled[i].revents != 0;
+    return count > 0;
+}
+
+bool pw_store::receive_available(int fd, std::string &data)
+{
+    char chunk[4096];
+    bool open = true;
+    while(true) {
+        const ssize_t n = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if(n <= 0) {
+            open = false;
+            break;
+        }
+        data.append(chunk, n);
+        if(static_cast<std::size_t>(n) < sizeof(chunk))
+            break;
+    }
+    // requests may carry passwords
+    wipe(chunk, sizeof(chunk));
+    return open;
+}
+
+void pw_store::catch_stop_signals()
+{
+    // no SA_RESTART, poll() has to return on these
+    struct sigaction act;
+    std::memset(&act, 0, sizeof(act));
+    act.sa_handler = stop_handler;
+    sigemptyset(&act.sa_mask);
+    sigaction(SIGTERM, &act, nullptr);
+    sigaction(SIGINT, &act, nullptr);
+}
+
+bool pw_store::stop_signal_caught() { return stop_requested; }
+#endif
@@ -0,0 +1,67 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef _LOCAL_SOCKET_HH_
+#define _LOCAL_SOCKET_HH_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace pw_store
+{
+
+// UNIX domain sockets connecting pwstore processes of one user, see
+// key_agent.hh and pwstore_server.hh. Without UNIX domain sockets (NO_GOOD)
+// all of these fail.
+
+// path of a socket named name in a new directory only the user can access
+std::string new_socket_path(const std::string &name);
+// Listening socket at path, only the user can connect to. -1 on errors.
+int listen_socket(const std::string &path);
+// Wait at most timeout_ms for a connection. -1 if there was none.
+int accept_connection(int listener, int timeout_ms);
+int connect_socket(const std::string &path);
+void close_socket(int fd);
+// Remove the socket at path and its directory if new_socket_path() made it.
+void remove_socket(const std::string &path);
+// true if the peer runs as the same user, where that can be checked.
+bool same_user(int fd);
+
+// Transfer exactly size bytes. Fails if the peer takes longer than
+// timeout_ms for any part.
+bool send_all(int fd, const char *p, std::size_t size);
+bool receive_all(int fd, char *p, std::size_t size, int timeout_ms = 1000);
+// true if the peer closed the connection
+bool peer_closed(int fd);
+// Wait at most timeout_ms until one of fds can be read. ready[i] tells if
+// fds[i] can, false if none can.
+bool wait_readable(const std::vector<int> &fds, int timeout_ms,
+                   std::vector<bool> &ready);
+// Append what can be read from fd without waiting to data. false if the
+// peer closed the connection or on errors.
+bool receive_available(int fd, std::string &data);
+
+// SIGTERM and SIGINT only set a flag from now on, so servers can clean up.
+// They interrupt accept_connection().
+void catch_stop_signals();
+bool stop_signal_caught();
+}
+
+#endif
@@ -18,8 +18,10 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 
 
+#include <algorithm>
 #include <chrono>
 #include <cstdlib>
+#include <ctime>
 #include <fstream>
 #include <functional>
 #include <list>
@@ -34,8 +36,16 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "libaan/x11_util.hh"
 #endif
 
+#include "key_agent.hh"
+#include "local_socket.hh"
+#include "merge.hh"
+#include "page_file.hh"
 #include "pwstore.hh"
 #include "pwstore_api_cxx.hh"
+#include "pwstore_server.hh"
+#include "query.hh"
+#include "stats.hh"
+#include "thread_pool.hh"
 
 #include "libaan/crypto_util.hh"
 
@@ -52,6 +62,16 @@ const std::string DEFAULT_CIPHER_DB = ".pwstore.crypt";
 const std::string DEFAULT_CIPHER_DB = ".pwstore.crypt";
 #endif
 
+// socket of the key agent, see pw_store::key_agent
+const char AGENT_SOCKET_ENV[] = "PWSTORE_AGENT_SOCK";
+const std::time_t DEFAULT_AGENT_TTL_SECS = 600;
+// socket of the server, see serve()
+const char SERVER_SOCKET_ENV[] = "PWSTORE_SERVER_SOCK";
+// lock db after this many seconds of inactivity
+const long DEFAULT_TIMEOUT_SECS = 120;
+// file to append --stats lines to, "-" for stderr
+const char STATS_ENV[] = "PWSTORE_STATS";
+
 bool SIGINT_CAUGHT = false;
 bool exit_on_sigint = false;
 void sigint_handler(int signum)
@@ -80,15 +100,26 @@ struct config_type
         REMOVE,
         CHANGE_PASSWD,
         GEN_PASSWD,
-        GET
+        GET,
+        AGENT,
+        SERVE,
+        BATCH
     } mode;
     bool interactive;
     bool force;
+    pw_store::match_mode match;
     std::string lookup_key;
     std::vector<pw_store::data_type::id_type> uids;
     std::string db_file;
-    std::string merge_input_files[2];
+    // inputs of merge, the input file of add
+    std::vector<std::string> merge_input_files;
+    std::time_t agent_ttl;
+    // where to write the timings of --stats, empty for none, "-" for stderr
+    std::string stats_output;
     std::function<bool(const std::string &)> provide_value_to_user;
+    // record of add from stdin, read before asking the server
+    pw_store::data_type date;
+    bool date_read;
 };
 
 std::list<pw_store::data_type> test_data = {
@@ -121,25 +152,32 @@ bool read_until(const std::list<int> &end_char, std::string &accumulate)
 
 // small cli-layer over pw_store_api_cxx
 
-bool add(pw_store_api_cxx::pwstore_api &db, config_type &config)
+// url, user and password of add from stdin
+bool read_date(pw_store::data_type &date)
 {
-    // read from stdin
-    if(config.merge_input_files[0].empty()) {
-        pw_store::data_type date;
+    std::cout << "Url:\n";
+    if(!read_until({'\n', '\r'}, date.url_string))
+        return false;
+    std::cout << "User:\n";
+    if(!read_until({'\n', '\r'}, date.username))
+        return false;
 
-        std::cout << "Url:\n";
-        if(!read_until({'\n', '\r'}, date.url_string))
-            return false;
-        std::cout << "User:\n";
-        if(!read_until({'\n', '\r'}, date.username))
-            return false;
+    const libaan::crypto::util::password_from_stdin password(0);
+    if(!password) {
+        std::cerr << "Password Error. Too short?\n";
+        return false;
+    }
+    date.password = password.password;
+    return true;
+}
 
-        const libaan::crypto::util::password_from_stdin password(0);
-        if(!password) {
-            std::cerr << "Password Error. Too short?\n";
+bool add(pw_store_api_cxx::pwstore_api &db, config_type &config)
+{
+    // read from stdin, unless that happened before asking the server
+    if(config.merge_input_files.empty()) {
+        pw_store::data_type &date = config.date;
+        if(!config.date_read && !read_date(date))
             return false;
-        }
-        date.password = password.password;
 
         if(!db.add(date)) {
             std::cerr << "Error: inserting in database failed.\n";
@@ -148,9 +186,9 @@ bool add(pw_store_api_cxx::pwstore_api &db, config_type &config)
 
         std::cout << "added: " << date << "\n";
     } else { // read from input file
-        std::ifstream fp(config.merge_input_files[0]);
+        std::ifstream fp(config.merge_input_files.front());
         if(!fp) {
-            std::cerr << "Invalid input file \"" << config.merge_input_files[0]
+            std::cerr << "Invalid input file \"" << config.merge_input_files.front()
                       << "\"\n";
             return false;
         }
@@ -179,13 +217,12 @@ bool add(pw_store_api_cxx::pwstore_api &db, config_type &config)
                 return false;
         }
 
-        for(const auto &date: insert) {
-            if(!db.add(date)) {
-                std::cerr << "Error: inserting in database failed.\n";
-                return false;
-            }
-            std::cerr << "Debug: inserted " << date.to_string() << ".\n";
+        if(!db.add(insert)) {
+            std::cerr << "Error: inserting in database failed.\n";
+            return false;
         }
+        for(const auto &date: insert)
+            std::cerr << "Debug: inserted " << date.to_string() << ".\n";
     }
 
     return db.sync();
@@ -193,11 +230,10 @@ bool add(pw_store_api_cxx::pwstore_api &db, config_type &config)
 
 bool lookup(pw_store_api_cxx::pwstore_api &db, config_type &config)
 {
-    std::list<std::tuple<pw_store::data_type::id_type, pw_store::data_type>>
-    matches;
-    db.lookup(matches, config.lookup_key, config.uids);
+    pw_store::result_type matches;
+    db.lookup(matches, config.lookup_key, config.uids, config.match);
     for(const auto &match : matches)
-        std::cout << std::get<0>(match) << ": " << std::get<1>(match) << "\n";
+        std::cout << match.id << ": " << match << "\n";
     std::cout << "\n";
     return true;
 }
@@ -241,138 +277,136 @@ open_db(const std::string &file, const std::string &password)
     return db;
 }
 
+// merge compares whole records, including the passwords.
+void dump_with_passwords(pw_store_api_cxx::pwstore_api &db,
+                         std::vector<pw_store::data_type> &content)
+{
+    pw_store::result_type ids;
+    db.dump(ids);
+    content.reserve(ids.size());
+    for(const auto &match : ids) {
+        pw_store::data_type date;
+        if(db.get(match.id, date))
+            content.push_back(date);
+    }
+}
+
+void wipe_passwords(std::vector<pw_store::data_type> &dates)
+{
+    for(auto &date : dates)
+        std::fill(std::begin(date.password), std::end(date.password), 0);
+}
+
+// Inputs are numbered from 1 in the output, a record is listed with the
+// inputs containing it. Records of all inputs are always kept, the others
+// are kept if one of their inputs is chosen.
 bool merge(config_type &config)
 {
     struct stat s;
-    if(stat(config.merge_input_files[0].c_str(), &s)) {
-        std::cerr << "Invalid input database specified \""
-                  << config.merge_input_files[0] << "\"\n";
-        return false;
-    }
-    if(stat(config.merge_input_files[1].c_str(), &s)) {
-        std::cerr << "Invalid input database specified \""
-                  << config.merge_input_files[1] << "\"\n";
-        return false;
+    for(const auto &file : config.merge_input_files) {
+        if(stat(file.c_str(), &s)) {
+            std::cerr << "Invalid input database specified \"" << file
+                      << "\"\n";
+            return false;
+        }
     }
 
     if(!stat(config.db_file.c_str(), &s)) {
-        std::cerr << "Output database must not exist. If you want to merge two dbs into an already existing one,\n"
-                  << "use two merge steps.\n";
+        std::cerr << "Output database must not exist. If you want to merge into an already existing one,\n"
+                  << "pass it as another input.\n";
         return false;
     }
 
-    // compare config.merge_input_files
-    const auto in1 = open_db(config.merge_input_files[0], "hallo");
-    if(!in1) {
-        std::cerr << "Could not open database file \""
-                  << config.merge_input_files[0] << "\".\n";
-        return false;
-    }
-    const auto in2 = open_db(config.merge_input_files[1], "hallo");
-    if(!in2) {
-        std::cerr << "Could not open database file \""
-                  << config.merge_input_files[1] << "\".\n";
-        return false;
+    // Decrypt and sort the inputs in parallel.
+    const auto count = config.merge_input_files.size();
+    std::vector<std::vector<pw_store::data_type>> inputs(count);
+    // not std::vector<bool>, the tasks write concurrently
+    std::vector<char> opened(count, false);
+    {
+        pw_store::thread_pool pool(
+            std::min(count, pw_store::thread_pool::default_size()));
+        pool.run(count, [&config, &inputs, &opened](std::size_t i) {
+            const auto in = open_db(config.merge_input_files[i], "hallo");
+            if(!in)
+                return;
+            dump_with_passwords(*in, inputs[i]);
+            pw_store::sort_for_merge(inputs[i]);
+            opened[i] = true;
+        });
     }
-
-    std::list<std::tuple<pw_store::data_type::id_type, pw_store::data_type>>
-        input1;
-    in1->dump(input1);
-    std::list<std::tuple<pw_store::data_type::id_type, pw_store::data_type>>
-        input2;
-    in2->dump(input2);
-    std::list<std::tuple<pw_store::data_type::id_type, pw_store::data_type>>
-        intersection;
-    std::list<std::tuple<pw_store::data_type::id_type, pw_store::data_type>>
-        complement_of_in1;
-    std::list<std::tuple<pw_store::data_type::id_type, pw_store::data_type>>
-        complement_of_in2;
-
-    struct {
-        bool operator()(const std::tuple<pw_store::data_type::id_type,
-                                         pw_store::data_type> &a,
-                        const std::tuple<pw_store::data_type::id_type,
-                                         pw_store::data_type> &b) const
-        {
-            pw_store::data_type_cmp_enhanced cmp_inner;
-            return cmp_inner(std::get<1>(a), std::get<1>(b));
+    for(std::size_t i = 0; i < count; i++) {
+        if(!opened[i]) {
+            std::cerr << "Could not open database file \""
+                      << config.merge_input_files[i] << "\".\n";
+            return false;
         }
-    } cmp;
-/*
-TODO:
-This algorithm has a problem with identical entries. If input1 has 2 identical entries D
-and input2 contains another copy of D, intersection will contain one D and complement A,B
-the other D. The result of the merge is consistent, but the shown output is incorrect.
-Solutions could be, find duplicates in pw_store::database::insert before doing the insert.
-Or provide db_check function which checks for things like:
-  is_sorted -> if no warn and ask yes/no for fix
-  all_unique -> adjacent_find for duplicates, only after sorting, ask yes/no if duplicates
-                should be deleted. out.erase(unique(out.begin, out.end), out.end)
-  integrity_check -> check if date stored in crypto file is sensible.. e.g. 2013->now
-                     should be a good timeframe
-*/
-    std::set_intersection(std::begin(input1), std::end(input1),
-                          std::begin(input2), std::end(input2),
-                          std::inserter(intersection, std::begin(intersection)),
-                          cmp);
-
-    std::cout << "Calculating Intersection.\n";
-    std::cout << "A:\n";
-    for(const auto &k : input1)
-        std::cout << "\t" << std::get<0>(k) << ": "
-                  << std::get<1>(k).to_string(true) << "\n";
-    std::cout << "\n";
-
-    std::cout << "B:\n";
-    for(const auto &k : input2)
-        std::cout << "\t" << std::get<0>(k) << ": "
-                  << std::get<1>(k).to_string(true) << "\n";
-    std::cout << "\n";
+    }
 
-    std::cout << "Intersection of A and B:\n";
-    for(const auto &k : intersection)
-        std::cout << "\t" << std::get<0>(k) << ": "
-                  << std::get<1>(k).to_string(true) << "\n";
-    std::cout << "\n";
+    std::vector<pw_store::merged_record> merged;
+    pw_store::merge_sorted(inputs, merged);
+    for(auto &input : inputs)
+        wipe_passwords(input);
 
-    std::set_difference(
-        std::begin(input1), std::end(input1), std::begin(input2),
-        std::end(input2),
-        std::inserter(complement_of_in1, std::begin(complement_of_in1)), cmp);
-    std::set_difference(
-        std::begin(input2), std::end(input2), std::begin(input1),
-        std::end(input1),
-        std::inserter(complement_of_in2, std::begin(complement_of_in2)), cmp);
-
-    std::cout << "Complement of A in B:\n";
-    for(const auto &k : complement_of_in1)
-        std::cout << "\t" << std::get<0>(k) << ": "
-                  << std::get<1>(k).to_string(true) << "\n";
+    std::cout << "Inputs:\n";
+    for(std::size_t i = 0; i < count; i++)
+        std::cout << "\t" << i + 1 << ": " << config.merge_input_files[i]
+                  << "\n";
     std::cout << "\n";
 
-    std::cout << "Complement of B in A:\n";
-    for(const auto &k : complement_of_in2)
-        std::cout << "\t" << std::get<0>(k) << ": "
-                  << std::get<1>(k).to_string(true) << "\n";
+    // inputs with records missing in another input
+    std::vector<bool> partial(count, false);
+    std::size_t conflicts = 0;
+    std::cout << "Records:\n";
+    for(const auto &record : merged) {
+        std::string in;
+        const bool everywhere =
+            std::find(std::begin(record.inputs), std::end(record.inputs),
+                      false) == std::end(record.inputs);
+        for(std::size_t i = 0; i < count; i++) {
+            if(!record.inputs[i])
+                continue;
+            in += (in.empty() ? "" : ",") + std::to_string(i + 1);
+            if(!everywhere)
+                partial[i] = true;
+        }
+        if(record.conflict)
+            conflicts++;
+        std::cout << "\t" << (everywhere ? std::string("all") : in) << ": "
+                  << record.date.to_string(true)
+                  << (record.conflict ? " (conflict)" : "") << "\n";
+    }
     std::cout << "\n";
-
-    bool use_ab = false;
-    std::cout << "Use complement of A in B?(Y/n)\n";
-    {
+    if(conflicts)
+        std::cout << conflicts << " records share url and user with a "
+                  "different password.\n";
+
+    std::vector<bool> use(count, false);
+    for(std::size_t i = 0; i < count; i++) {
+        if(!partial[i])
+            continue;
+        std::cout << "Use records of input " << i + 1
+                  << " missing in other inputs?(Y/n)\n";
         libaan::util::rawmode tty_raw;
         const auto in = tty_raw.getch();
         if(in == 'Y')
-            use_ab = true;
+            use[i] = true;
     }
 
-    bool use_ba = false;
-    std::cout << "Use complement of B in A?(Y/n)\n";
-    {
-        libaan::util::rawmode tty_raw;
-        const auto in = tty_raw.getch();
-        if(in == 'Y')
-            use_ba = true;
+    // merged is sorted, the new database gets it in storage order and does
+    // not have to sort again.
+    std::list<pw_store::data_type> result;
+    for(const auto &record : merged) {
+        bool keep = true;
+        for(std::size_t i = 0; i < count && keep; i++)
+            keep = record.inputs[i];
+        for(std::size_t i = 0; i < count && !keep; i++)
+            keep = record.inputs[i] && use[i];
+        if(keep)
+            result.push_back(record.date);
     }
+    for(auto &record : merged)
+        std::fill(std::begin(record.date.password),
+                  std::end(record.date.password), 0);
 
     auto out = open_db(config.db_file);
     if(!out) {
@@ -380,37 +414,16 @@ Or provide db_check function which checks for things like:
                   << "\".\n";
         return false;
     }
-
-    // insert intersecting elements
-    for(const auto &date: intersection) {
-        if(!out->add(std::get<1>(date))) {
-            std::cerr << "Error: inserting in database failed.\n";
-            return false;
-        }
-        std::cerr << "Debug: inserted " << std::get<1>(date).to_string() << ".\n";
-    }
-
-    if(use_ab) {
-        for(const auto &date: complement_of_in1) {
-            if(!out->add(std::get<1>(date))) {
-                std::cerr << "Error: inserting in database failed.\n";
-                return false;
-            }
-            std::cerr << "Debug: inserted " << std::get<1>(date).to_string() << ".\n";
-        }
-    }
-
-    if(use_ba) {
-        for(const auto &date: complement_of_in2) {
-            if(!out->add(std::get<1>(date))) {
-                std::cerr << "Error: inserting in database failed.\n";
-                return false;
-            }
-            std::cerr << "Debug: inserted " << std::get<1>(date).to_string() << ".\n";
-        }
+    const bool ret = out->add(result) && out->sync();
+    for(auto &date : result)
+        std::fill(std::begin(date.password), std::end(date.password), 0);
+    if(!ret) {
+        std::cerr << "Error: inserting in database failed.\n";
+        return false;
     }
+    std::cout << "Merged " << result.size() << " records.\n";
 
-    return out->sync();
+    return true;
 }
 
 bool get(pw_store_api_cxx::pwstore_api &db, config_type &config)
@@ -433,7 +446,6 @@ bool get(pw_store_api_cxx::pwstore_api &db, config_type &config)
     return true;
 }
 
-// needs non-const config_type since remove sorts the uid vector
 bool remove(pw_store_api_cxx::pwstore_api &db, config_type &config)
 {
     if(!config.force) {
@@ -496,14 +508,170 @@ bool gen_passwd(pw_store_api_cxx::pwstore_api &db, config_type &config)
     return db.sync();
 }
 
+std::vector<std::string> split_fields(const std::string &line)
+{
+    std::vector<std::string> fields;
+    std::size_t begin = 0;
+    while(true) {
+        const auto end = line.find('\t', begin);
+        fields.push_back(line.substr(begin, end - begin));
+        if(end == std::string::npos)
+            return fields;
+        begin = end + 1;
+    }
+}
+
+bool parse_uids(std::vector<std::string>::const_iterator begin,
+                std::vector<std::string>::const_iterator end,
+                std::vector<pw_store::data_type::id_type> &uids)
+{
+    for(auto field = begin; field != end; ++field) {
+        char *parse_end;
+        uids.push_back(std::strtoull(field->c_str(), &parse_end, 10));
+        if(field->empty() || *parse_end)
+            return false;
+    }
+    return begin != end;
+}
+
+// Why key is no valid query although it looks like one, empty otherwise.
+// The database searches such keys as plain text. Fuzzy keys are never
+// queries.
+std::string query_error(const std::string &key, pw_store::match_mode mode)
+{
+    std::string error;
+    if(mode != pw_store::match_mode::fuzzy && pw_store::query::is_query(key)) {
+        pw_store::query q;
+        q.compile(key, false, error);
+    }
+    return error;
+}
+
+// One command of batch(). Results are written to out, errors to error.
+bool batch_command(pw_store_api_cxx::pwstore_api &db,
+                   const std::vector<std::string> &fields, std::string &out,
+                   std::string &error)
+{
+    const auto &command = fields.front();
+    std::vector<pw_store::data_type::id_type> uids;
+    if(command == "lookup" && (fields.size() == 2 || fields.size() == 3)) {
+        auto mode = pw_store::match_mode::exact;
+        if(fields.size() == 3) {
+            if(fields[2] == "ignore-case")
+                mode = pw_store::match_mode::ignore_case;
+            else if(fields[2] == "fuzzy")
+                mode = pw_store::match_mode::fuzzy;
+            else if(fields[2] != "exact") {
+                error = "unknown match mode";
+                return false;
+            }
+        }
+        const auto invalid = query_error(fields[1], mode);
+        if(!invalid.empty()) {
+            error = "invalid query: " + invalid;
+            return false;
+        }
+        pw_store::result_type matches;
+        if(!db.lookup(matches, fields[1], {}, mode)) {
+            error = "lookup failed";
+            return false;
+        }
+        for(const auto &match : matches)
+            out += std::to_string(match.id) + "\t" + match.url_string.str() +
+                   "\t" + match.username.str() + "\n";
+        return true;
+    } else if(command == "get" && fields.size() == 2) {
+        pw_store::data_type date;
+        if(!parse_uids(fields.begin() + 1, fields.end(), uids) ||
+           !db.get(uids.front(), date)) {
+            error = "no such id";
+            return false;
+        }
+        out += fields[1] + "\t" + date.url_string + "\t" + date.username +
+               "\t" + date.password + "\n";
+        std::fill(std::begin(date.password), std::end(date.password), 0);
+        return true;
+    } else if(command == "add" && fields.size() == 4) {
+        if(!db.add(pw_store::data_type(fields[1], fields[2], fields[3]))) {
+            error = "add failed";
+            return false;
+        }
+        return true;
+    } else if(command == "remove" && fields.size() >= 2) {
+        if(!parse_uids(fields.begin() + 1, fields.end(), uids) ||
+           !db.remove(uids)) {
+            error = "no such id";
+            return false;
+        }
+        return true;
+    } else if(command == "gen_passwd" && fields.size() == 3) {
+        std::string password;
+        if(!db.gen_passwd(fields[2], fields[1], password)) {
+            error = "gen_passwd failed";
+            return false;
+        }
+        out += password + "\n";
+        std::fill(std::begin(password), std::end(password), 0);
+        return true;
+    }
+    error = "invalid command";
+    return false;
+}
+
+bool backup_db(const std::string &db_file);
+
+// Commands from stdin, one per line with tab separated fields:
+//   lookup KEY [exact|ignore-case|fuzzy]   -> ID URL USER per match
+//   get ID                                 -> ID URL USER PASSWORD
+//   add URL USER PASSWORD
+//   remove ID...
+//   gen_passwd URL USER                    -> PASSWORD
+// The output of every command is followed by a line "ok" or
+// "error <TAB> reason". Empty lines and lines starting with '#' are
+// skipped. Changes are synced once after the last command, the database is
+// backed up before if there are any.
+bool batch(pw_store_api_cxx::pwstore_api &db, const std::string &db_file)
+{
+    bool ret = true;
+    std::string line;
+    std::string out;
+    std::string error;
+    while(std::getline(std::cin, line)) {
+        if(!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if(line.empty() || line[0] == '#')
+            continue;
+
+        auto fields = split_fields(line);
+        out.clear();
+        error.clear();
+        if(batch_command(db, fields, out, error))
+            out += "ok\n";
+        else {
+            out.assign("error\t" + error + "\n");
+            ret = false;
+        }
+        std::cout << out << std::flush;
+
+        // passwords
+        std::fill(std::begin(line), std::end(line), 0);
+        std::fill(std::begin(out), std::end(out), 0);
+        for(auto &field : fields)
+            std::fill(std::begin(field), std::end(field), 0);
+    }
+
+    if(db.dirty() && !backup_db(db_file))
+        std::cerr << "Could not create database backup. Better be careful.\n";
+    return db.sync() && ret;
+}
+
 bool dump(const pw_store_api_cxx::pwstore_api &db)
 {
     std::cout << "Database dump:\n";
-    std::list<std::tuple<pw_store::data_type::id_type, pw_store::data_type>>
-    content;
+    pw_store::result_type content;
     db.dump(content);
     for(const auto &k : content)
-        std::cout << "\t" << std::get<0>(k) << ": " << std::get<1>(k) << "\n";
+        std::cout << "\t" << k.id << ": " << k << "\n";
 
     return true;
 }
@@ -550,7 +718,6 @@ bool interactive_lookup(pw_store_api_cxx::pwstore_api &db, config_type &config)
     } raii;
 
     const std::chrono::milliseconds dura(150);
-    const long DEFAULT_TIMEOUT_SECS = 120;
     auto time_of_last_change = std::chrono::high_resolution_clock::now();
 
     std::string input;
@@ -636,7 +803,7 @@ bool interactive_lookup(pw_store_api_cxx::pwstore_api &db, config_type &config)
                 } else if(state == ACCUMULATE) {
                     if(in == '\n' || in == '\r') {
                         pw_store::data_type::id_type id =
-                            std::strtol(accumulate.c_str(), nullptr, 10);
+                            std::strtoull(accumulate.c_str(), nullptr, 10);
                         pw_store::data_type date;
                         if(db.get(id, date)) {
                             exit_on_sigint = true;
@@ -696,12 +863,16 @@ bool interactive_lookup(pw_store_api_cxx::pwstore_api &db, config_type &config)
         // handle input
         if(input.length()) {
             last_lookup.clear();
-            std::list<std::tuple<pw_store::data_type::id_type,
-                                 pw_store::data_type>> matches;
-            db.lookup(matches, input, config.uids);
+            // e.g. while a query is typed
+            const auto invalid = query_error(input, config.match);
+            if(!invalid.empty())
+                last_lookup = "Incomplete query (" + invalid +
+                              "), searching it as plain text.\n";
+            pw_store::result_type matches;
+            db.lookup(matches, input, config.uids, config.match);
             for(const auto &match : matches)
-                last_lookup.append(std::to_string(std::get<0>(match)) +
-                                   std::get<1>(match).to_string() + "\n");
+                last_lookup.append(std::to_string(match.id) +
+                                   match.to_string() + "\n");
         }
 
         struct gui
@@ -757,25 +928,204 @@ bool interactive_lookup(pw_store_api_cxx::pwstore_api &db, config_type &config)
     return db.sync();
 }
 
+bool agent(const config_type &config)
+{
+    const auto socket_path = pw_store::new_socket_path("agent");
+    if(socket_path.empty()) {
+        std::cerr << "Error: creating a directory for the agent socket "
+                     "failed.\n";
+        return false;
+    }
+    pw_store::key_agent agent(socket_path, config.agent_ttl);
+    if(!agent.listen())
+        return false;
+    std::cout << AGENT_SOCKET_ENV << "=" << socket_path << "; export "
+              << AGENT_SOCKET_ENV << ";\n"
+              << std::flush;
+    return agent.detach();
+}
+
+bool serve(pw_store_api_cxx::pwstore_api &db)
+{
+    const auto socket_path = pw_store::new_socket_path("server");
+    if(socket_path.empty()) {
+        std::cerr << "Error: creating a directory for the server socket "
+                     "failed.\n";
+        return false;
+    }
+    pw_store_api_cxx::pwstore_server server(db, socket_path,
+                                            DEFAULT_TIMEOUT_SECS);
+    if(!server.listen())
+        return false;
+    std::cout << SERVER_SOCKET_ENV << "=" << socket_path << "; export "
+              << SERVER_SOCKET_ENV << ";\n"
+              << std::flush;
+    if(!server.run())
+        return false;
+    // Every change was synced before it was acknowledged. A database locked
+    // by the idle timeout can not sync and has nothing left to write.
+    return db.locked() || db.sync();
+}
+
+// lookup, get, add from stdin and remove --force are sent to the server
+// named in the environment, if there is one. handled is false if it can not
+// be reached.
+bool run_remote(const config_type &config, const std::string &socket_path,
+                bool &handled)
+{
+    using status = pw_store_api_cxx::pwstore_client::status;
+    pw_store_api_cxx::pwstore_client client(socket_path);
+    std::vector<pw_store_api_cxx::pwstore_client::match> matches;
+    pw_store::data_type date;
+    const auto request = [&]() {
+        switch(config.mode) {
+        case config_type::LOOKUP:
+            matches.clear();
+            return client.lookup(config.lookup_key, config.uids,
+                                 config.match, matches);
+        case config_type::GET:
+            return client.get(config.uids.front(), date);
+        case config_type::ADD:
+            return client.add(config.date);
+        default:
+            return client.remove(config.uids);
+        }
+    };
+
+    auto s = request();
+    if(s == status::locked) {
+        // the server may get the key from the agent
+        if(client.unlock(std::string()) != status::ok) {
+            std::cout << "Database of the server is locked.\n";
+            const libaan::crypto::util::password_from_stdin db_password(2);
+            if(!db_password) {
+                std::cerr << "Password Error. Too short?\n";
+                return false;
+            }
+            client.unlock(db_password);
+        }
+        s = request();
+    }
+    handled = s != status::unreachable;
+    if(s != status::ok) {
+        if(handled && config.mode == config_type::GET)
+            std::cerr << "Could not retrieve datum with id: "
+                      << config.uids.front() << ".\n";
+        else if(handled)
+            std::cerr << "Error: the server failed to answer the request.\n";
+        return false;
+    }
+
+    switch(config.mode) {
+    case config_type::LOOKUP:
+        for(const auto &match : matches)
+            std::cout << match.first << ": " << match.second << "\n";
+        std::cout << "\n";
+        return true;
+    case config_type::GET: {
+        exit_on_sigint = true;
+        const bool provided = config.provide_value_to_user(date.password);
+        exit_on_sigint = false;
+        std::fill(std::begin(date.password), std::end(date.password), 0);
+        if(!provided) {
+            std::cerr << "Could not retrieve datum with id: "
+                      << config.uids.front() << ".\n";
+            return false;
+        }
+        std::cout << "Retrieved value for <id> " << config.uids.front()
+                  << ".\n";
+        return true;
+    }
+    case config_type::ADD:
+        std::cout << "added: " << config.date << "\n";
+        return true;
+    default:
+        std::cout << "Removed the specified entries.\n";
+        return true;
+    }
+}
+
+// Keys derived while this exists are cached by the agent named in the
+// environment, if there is one.
+struct agent_client
+{
+    agent_client()
+    {
+        const auto socket_path = getenv(AGENT_SOCKET_ENV);
+        if(!socket_path || !socket_path[0])
+            return;
+        cache.reset(new pw_store::agent_key_cache(socket_path));
+        pw_store::set_key_cache(cache.get());
+    }
+    ~agent_client() { pw_store::set_key_cache(nullptr); }
+
+    std::unique_ptr<pw_store::agent_key_cache> cache;
+};
+
 bool run(config_type config)
 {
     if(config.mode == config_type::MERGE)
         return merge(config);
+    if(config.mode == config_type::AGENT)
+        return agent(config);
+
+    const auto server_socket = getenv(SERVER_SOCKET_ENV);
+    const bool add_from_stdin =
+        config.mode == config_type::ADD && config.merge_input_files.empty();
+    if(server_socket && server_socket[0] &&
+       (config.mode == config_type::LOOKUP || config.mode == config_type::GET ||
+        add_from_stdin ||
+        (config.mode == config_type::REMOVE && config.force))) {
+        // asked once, also if the database has to be opened after all
+        if(add_from_stdin) {
+            if(!read_date(config.date))
+                return false;
+            config.date_read = true;
+        }
+        bool handled;
+        const bool ret = run_remote(config, server_socket, handled);
+        if(handled)
+            return ret;
+        std::cerr << "No pwstore server at \"" << server_socket
+                  << "\", opening the database.\n";
+    }
 
-    const libaan::crypto::util::password_from_stdin db_password(2);
-    if(!db_password) {
-        std::cerr << "Password Error. Too short?\n";
-        return false;
+    const agent_client agent;
+    std::unique_ptr<pw_store_api_cxx::pwstore_api> opened;
+    // The agent may have the key, an empty password only asks it.
+    if(agent.cache && pw_store::page_file::detect(config.db_file) ==
+                          pw_store::page_file::format::pages) {
+        opened.reset(
+            new pw_store_api_cxx::pwstore_api(config.db_file, std::string()));
+        if(!*opened)
+            opened.reset(nullptr);
     }
-    pw_store_api_cxx::pwstore_api db(config.db_file, db_password);
-    if(!db)
-        return false;
+    if(!opened) {
+        std::unique_ptr<pw_store::stats::phase> prompt(
+            new pw_store::stats::phase("prompt"));
+        const libaan::crypto::util::password_from_stdin db_password(2);
+        prompt.reset(nullptr);
+        if(!db_password) {
+            std::cerr << "Password Error. Too short?\n";
+            return false;
+        }
+        opened.reset(
+            new pw_store_api_cxx::pwstore_api(config.db_file, db_password));
+        if(!*opened)
+            return false;
+    }
+    pw_store_api_cxx::pwstore_api &db = *opened;
 
-    if(!db.empty()) {
+    if(!db.empty() && config.mode == config_type::BATCH) {
+        // stdin holds the commands
+        std::cerr << "Authenticity verified. Date of last modification: "
+                  << db.time_of_last_write() << ".\n";
+    } else if(!db.empty()) {
         const auto mod_time = db.time_of_last_write();
         std::cout << "Authenticity verified. Date of last modification: "
                   << mod_time << ".\nVerify integrity by comparing dates.(Y/n)\n";
         {
+            const pw_store::stats::phase timing("prompt");
             libaan::util::rawmode tty_raw;
             const auto in = tty_raw.getch();
             if(in != 'Y')
@@ -812,7 +1162,14 @@ bool run(config_type config)
     case config_type::GET:
         ret = get(db, config);
         break;
+    case config_type::SERVE:
+        ret = serve(db);
+        break;
+    case config_type::BATCH:
+        ret = batch(db, config.db_file);
+        break;
     case config_type::MERGE:
+    case config_type::AGENT:
         ret = false;
         break;
     }
@@ -830,7 +1187,16 @@ void usage(int, char *argv[])
            "lookup/remove\n"
         << "                  multiple uids can be specified for remove\n"
         << "    -o            dump retrieved password to stdout\n"
-        << "    -i            interactive\n\n"
+        << "    -i            interactive\n"
+        << "    --ignore-case lookup ignores upper/lower case\n"
+        << "    --fuzzy       lookup matches the key characters in order, "
+           "best matches first\n"
+        << "    --stats       print the time spent per phase as JSON to stderr, "
+           "or append\n"
+        << "                  it to the file in $" << STATS_ENV
+        << " (\"-\" for stderr)\n"
+        << "    --            no flags and commands follow, e.g. for a key "
+           "starting with '-'\n\n"
         << "  possible commands are:\n"
         << "    add <optional_input_file>\n"
         << "      Interactively add one datum to database if no input file was specified.\n"
@@ -838,12 +1204,15 @@ void usage(int, char *argv[])
         << "      url\\nuser\\npassword\\n"
         << "    dump\n"
         << "      Dump database content.\n"
-        << "    lookup <optional-key> [-i] [-o] [-n <uid>]\n"
+        << "    lookup <optional-key> [-i] [-o] [-n <uid>] [--ignore-case|--fuzzy]\n"
         << "      Print all entries that match the specified uids or the specified key.\n"
+        << "      The key may be a query of terms for url, user or both, e.g.\n"
+        << "      'url:mail user:admin -url:staging' or '(url:a OR url:b) NOT user:test'.\n"
+        << "      A key starting with '-' follows --: lookup -- '-user:test'.\n"
         << "    get                   [-o] -n <uid>\n"
         << "      Retrieve password for entry with speciefied uid.\n"
-        << "    merge dbfile1 dbfile2 result\n"
-        << "      Compare dbfile1 and dbfile2 and try to merge them in a new dbfile result.\n"
+        << "    merge dbfile1 dbfile2 [dbfile...] result\n"
+        << "      Compare the dbfiles and try to merge them in a new dbfile result.\n"
         << "    remove                (-n <uid>)+ [--force]\n"
         << "      Remove specified entry.\n"
         << "    change_passwd         change password and reencrypt db-file\n"
@@ -851,6 +1220,24 @@ void usage(int, char *argv[])
         << "    gen_passwd            generate a password and store it in "
            "db-file\n"
         << "      Same as add, but password is created from pseudo random pool.\n"
+        << "    agent                 [-t <seconds>]\n"
+        << "      Start a background process keeping the keys of databases "
+           "opened later\n"
+        << "      for <seconds> (default " << DEFAULT_AGENT_TTL_SECS
+        << "). Prints the " << AGENT_SOCKET_ENV << " variable to export.\n"
+        << "    batch\n"
+        << "      Run commands from stdin in one session, one per line with tab "
+           "separated\n"
+        << "      fields: lookup KEY [exact|ignore-case|fuzzy], get ID, add URL "
+           "USER PASSWORD,\n"
+        << "      remove ID..., gen_passwd URL USER. Every output ends with a "
+           "line \"ok\" or\n"
+        << "      \"error<TAB>reason\".\n"
+        << "    serve\n"
+        << "      Keep the database open and answer lookup, get, add and "
+           "remove --force\n"
+        << "      of other calls, until interrupted. Prints the "
+        << SERVER_SOCKET_ENV << " variable to export.\n"
         << "  database name to be used is taken from:\n"
         << "    environment variable PWSTORE_DB_FILE\n"
         << "    -f <db-file> flag\n"
@@ -913,6 +1300,9 @@ bool backup_db(const std::string &db_file)
         const std::string entry(p->d_name);
         if(!std::equal(base.begin(), base.end(), entry.begin()))
             return;
+        // the journal belongs to the backup file before it
+        if(entry.find(".journal") != std::string::npos)
+            return;
         count_backup_files++;
     };
 
@@ -921,6 +1311,16 @@ bool backup_db(const std::string &db_file)
     const auto backup_file = BACKUP_FILE_PREFIX + libaan::util::to_string(now);
     if(!libaan::util::file::write_file(backup_file.c_str(), buff))
         return false;
+    // changes since the last full write of the database
+    const std::string journal_file = db_file + ".journal";
+    struct stat s;
+    if(!stat(journal_file.c_str(), &s)) {
+        std::string journal;
+        if(!libaan::util::file::read_file(journal_file.c_str(), journal) ||
+           !libaan::util::file::write_file(
+               (backup_file + ".journal").c_str(), journal))
+            return false;
+    }
 
     std::cerr << "Creating backup(\"" << backup_file << "\") of file(\""
               << db_file << "\")\n"
@@ -929,19 +1329,94 @@ bool backup_db(const std::string &db_file)
 }
 #endif
 
+const char *command_name(const config_type &config)
+{
+    switch(config.mode) {
+    case config_type::ADD:
+        return "add";
+    case config_type::DUMP:
+        return "dump";
+    case config_type::INIT:
+        return "init";
+    case config_type::INTERACTIVE_LOOKUP:
+        return "interactive";
+    case config_type::LOOKUP:
+        return "lookup";
+    case config_type::MERGE:
+        return "merge";
+    case config_type::REMOVE:
+        return "remove";
+    case config_type::CHANGE_PASSWD:
+        return "change_passwd";
+    case config_type::GEN_PASSWD:
+        return "gen_passwd";
+    case config_type::GET:
+        return "get";
+    case config_type::AGENT:
+        return "agent";
+    case config_type::SERVE:
+        return "serve";
+    case config_type::BATCH:
+        return "batch";
+    }
+    return "";
+}
+
+// One line of JSON per call, appended to a file to collect many calls.
+void write_stats(const config_type &config, bool ok, double total_ms)
+{
+    const auto line =
+        pw_store::stats::to_json(command_name(config), ok, total_ms);
+    if(config.stats_output == "-") {
+        std::cerr << line << "\n";
+        return;
+    }
+    std::ofstream out(config.stats_output, std::ios::app);
+    if(!(out << line << "\n"))
+        std::cerr << "Could not write stats to \"" << config.stats_output
+                  << "\".\n";
+}
+
 bool parse_and_check_args(int argc, char *argv[], config_type &config)
 {
     config.interactive = false;
     config.force = false;
+    config.date_read = false;
+    config.match = pw_store::match_mode::exact;
+    config.agent_ttl = 0;
     enum output_type { TO_X11, TO_STDOUT } output;
     output = TO_X11;
 
+    // key of lookup or input files of merge and add
+    const auto operand = [&config](const char *arg) {
+        if(config.mode == config_type::LOOKUP) {
+            config.lookup_key.assign(arg);
+        } else if(config.mode == config_type::MERGE) {
+            config.merge_input_files.push_back(arg);
+        } else if(config.mode == config_type::ADD) {
+            if(config.merge_input_files.empty())
+                config.merge_input_files.push_back(arg);
+        }
+    };
+
     // parse arguments
+    bool options_end = false;
     for(int arg_index = 1; arg_index < argc; arg_index++) {
-        if((argv[arg_index][0] == '-') && (argv[arg_index][1] == '-')) {
+        if(options_end) {
+            // after --, e.g. a key with a negated first term: -- -user:test
+            operand(argv[arg_index]);
+        } else if(!std::strcmp(argv[arg_index], "--")) {
+            options_end = true;
+        } else if((argv[arg_index][0] == '-') && (argv[arg_index][1] == '-')) {
             // arguments starting with --
             if(!std::strcmp(argv[arg_index], "--force"))
                 config.force = true;
+            else if(!std::strcmp(argv[arg_index], "--ignore-case"))
+                config.match = pw_store::match_mode::ignore_case;
+            else if(!std::strcmp(argv[arg_index], "--fuzzy"))
+                config.match = pw_store::match_mode::fuzzy;
+            else if(!std::strcmp(argv[arg_index], "--stats"))
+                config.stats_output = "-";
         } else if(argv[arg_index][0] == '-') {
             // flags starting with a single '-'
             if(argv[arg_index][1] == 'i')
@@ -950,11 +1425,17 @@ bool parse_and_check_args(int argc, char *argv[], config_type &config)
                 if(arg_index + 1 >= argc)
                     return false;
                 const auto uid_arg = argv[++arg_index];
-                config.uids.push_back(std::strtoul(uid_arg, nullptr, 10));
+                config.uids.push_back(std::strtoull(uid_arg, nullptr, 10));
             } else if(argv[arg_index][1] == 'f') {
                 if(arg_index + 1 >= argc)
                     return false;
                 config.db_file = std::string(argv[++arg_index]);
+            } else if(argv[arg_index][1] == 't') {
+                if(arg_index + 1 >= argc)
+                    return false;
+                config.agent_ttl = std::strtol(argv[++arg_index], nullptr, 10);
+                if(config.agent_ttl <= 0)
+                    return false;
             } else if(argv[arg_index][1] == 'o')
                 output = TO_STDOUT;
         } else {
@@ -977,24 +1458,14 @@ bool parse_and_check_args(int argc, char *argv[], config_type &config)
                 config.mode = config_type::GET;
             else if(!std::strcmp(argv[arg_index], "merge"))
                 config.mode = config_type::MERGE;
-            else {
-                if(config.mode == config_type::LOOKUP) {
-                    config.lookup_key.assign(argv[arg_index]);
-                } else if(config.mode == config_type::MERGE) {
-                    if(!config.merge_input_files[0].length())
-                        config.merge_input_files[0].assign(argv[arg_index]);
-                    else if(config.merge_input_files[0].length()
-                            && !config.merge_input_files[1].length())
-                        config.merge_input_files[1].assign(argv[arg_index]);
-                    else if(config.merge_input_files[0].length()
-                            && config.merge_input_files[1].length()
-                            && !config.db_file.length())
-                        config.db_file.assign(argv[arg_index]);
-                } else if(config.mode == config_type::ADD) {
-                    if(!config.merge_input_files[0].length())
-                        config.merge_input_files[0].assign(argv[arg_index]);
-                }
-            }
+            else if(!std::strcmp(argv[arg_index], "agent"))
+                config.mode = config_type::AGENT;
+            else if(!std::strcmp(argv[arg_index], "serve"))
+                config.mode = config_type::SERVE;
+            else if(!std::strcmp(argv[arg_index], "batch"))
+                config.mode = config_type::BATCH;
+            else
+                operand(argv[arg_index]);
         }
     }
 
@@ -1023,6 +1494,14 @@ bool parse_and_check_args(int argc, char *argv[], config_type &config)
         return false;
     }
 
+    if(config.match != pw_store::match_mode::exact &&
+       config.mode != config_type::LOOKUP &&
+       config.mode != config_type::INTERACTIVE_LOOKUP) {
+        std::cerr << "Error: --ignore-case and --fuzzy only used for lookup "
+                     "command.\n";
+        return false;
+    }
+
     // at least one must be set for lookup
     if(config.mode == config_type::LOOKUP && !config.uids.size() &&
        !config.lookup_key.length()) {
@@ -1036,6 +1515,14 @@ bool parse_and_check_args(int argc, char *argv[], config_type &config)
         return false;
     }
 
+    if((config.mode == config_type::SERVE ||
+        config.mode == config_type::BATCH) &&
+       (config.uids.size() || config.lookup_key.length())) {
+        std::cerr << "Error: serve and batch commands have no need for "
+                     "uids/<optional-key>.\n";
+        return false;
+    }
+
     if(config.mode == config_type::CHANGE_PASSWD &&
        (config.uids.size() || config.lookup_key.length())) {
         std::cerr << "Error: change_passwd command has no need for "
@@ -1052,13 +1539,41 @@ bool parse_and_check_args(int argc, char *argv[], config_type &config)
         return false;
     }
 
-    if(config.mode == config_type::MERGE)
-        if(!config.merge_input_files[0].length()
-           || !config.merge_input_files[1].length()
-           || !config.db_file.length()) {
+    // before asking for the password
+    const auto invalid = query_error(config.lookup_key, config.match);
+    if(!invalid.empty()) {
+        std::cerr << "Error: invalid query \"" << config.lookup_key
+                  << "\": " << invalid << ".\n";
+        return false;
+    }
+
+    if(config.agent_ttl && config.mode != config_type::AGENT) {
+        std::cerr << "Error: -t is only used for the agent command.\n";
+        return false;
+    }
+    if(config.mode == config_type::AGENT) {
+        if(config.uids.size() || config.lookup_key.length() ||
+           config.interactive) {
+            std::cerr << "Error: agent command has no need for "
+                         "uids/<optional-key>.\n";
+            return false;
+        }
+        if(!config.agent_ttl)
+            config.agent_ttl = DEFAULT_AGENT_TTL_SECS;
+        return true;
+    }
+
+    if(config.mode == config_type::MERGE) {
+        // the last file is the result, unless given with -f
+        if(!config.db_file.length() && !config.merge_input_files.empty()) {
+            config.db_file = config.merge_input_files.back();
+            config.merge_input_files.pop_back();
+        }
+        if(config.merge_input_files.size() < 2) {
             std::cout << "Invalid parameters for merge command.\n";
             return false;
         }
+    }
 
     if(!config.db_file.length()) {
         const auto env_db = getenv("PWSTORE_DB_FILE");
@@ -1137,7 +1652,13 @@ int main(int argc, char *argv[])
     case config_type::LOOKUP:
     case config_type::GET:
     case config_type::MERGE:
+    case config_type::AGENT:
         break;
+    // only known after reading the commands, see batch()
+    case config_type::BATCH:
+        break;
+    // clients may add and remove records
+    case config_type::SERVE:
     case config_type::ADD:
     case config_type::INIT:
     case config_type::REMOVE:
@@ -1149,8 +1670,19 @@ int main(int argc, char *argv[])
                 << "Could not create database backup. Better be careful.\n";
     }
 
-    if(!run(config))    // TODO: remove backup?
-        exit(EXIT_FAILURE);
-
-    exit(EXIT_SUCCESS);
+    // The file in the environment is used with or without --stats.
+    const char *const stats_file = getenv(STATS_ENV);
+    if(stats_file && *stats_file)
+        config.stats_output = stats_file;
+    if(!config.stats_output.empty())
+        pw_store::stats::enable();
+    const auto start = std::chrono::steady_clock::now();
+    const bool ok = run(config);    // TODO: remove backup?
+    if(!config.stats_output.empty())
+        write_stats(config, ok,
+                    std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count());
+
+    exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
 }
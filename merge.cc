@@ -0,0 +1,77 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include "merge.hh"
+
+#include <algorithm>
+#include <utility>
+
+void pw_store::sort_for_merge(std::vector<data_type> &records)
+{
+    std::sort(std::begin(records), std::end(records),
+              data_type_cmp_enhanced());
+}
+
+void pw_store::merge_sorted(const std::vector<std::vector<data_type>> &inputs,
+                            std::vector<merged_record> &merged)
+{
+    // Min heap of the next record of every input, as (input, position).
+    // Equal records are taken from the lower input first.
+    using cursor = std::pair<std::size_t, std::size_t>;
+    const data_type_cmp_enhanced less;
+    const auto later = [&inputs, &less](const cursor &a, const cursor &b) {
+        const auto &x = inputs[a.first][a.second];
+        const auto &y = inputs[b.first][b.second];
+        return less(y, x) || (!less(x, y) && a.first > b.first);
+    };
+
+    std::vector<cursor> heap;
+    std::size_t total = 0;
+    for(std::size_t i = 0; i < inputs.size(); i++) {
+        if(!inputs[i].empty())
+            heap.emplace_back(i, 0);
+        total += inputs[i].size();
+    }
+    std::make_heap(std::begin(heap), std::end(heap), later);
+    merged.reserve(merged.size() + total);
+
+    const auto first = merged.size();
+    while(!heap.empty()) {
+        std::pop_heap(std::begin(heap), std::end(heap), later);
+        auto &next = heap.back();
+        const auto &date = inputs[next.first][next.second];
+        if(merged.size() == first || less(merged.back().date, date))
+            merged.push_back({date, std::vector<bool>(inputs.size()), false});
+        merged.back().inputs[next.first] = true;
+
+        if(++next.second < inputs[next.first].size())
+            std::push_heap(std::begin(heap), std::end(heap), later);
+        else
+            heap.pop_back();
+    }
+
+    // Versions of one url and username are adjacent now.
+    const data_type_cmp key_less;
+    for(auto i = first + 1; i < merged.size(); i++) {
+        if(!key_less(merged[i - 1].date, merged[i].date)) {
+            merged[i - 1].conflict = true;
+            merged[i].conflict = true;
+        }
+    }
+}
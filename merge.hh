@@ -0,0 +1,52 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef _MERGE_HH_
+#define _MERGE_HH_
+
+#include <vector>
+
+#include "pwstore.hh"
+
+namespace pw_store
+{
+
+// One distinct record of a merge and the inputs containing it.
+struct merged_record
+{
+    data_type date;
+    // inputs[i] is true if input i contains date
+    std::vector<bool> inputs;
+    // Another merged record has the same url and username but a different
+    // password.
+    bool conflict;
+};
+
+// Sort the records of one input for merge_sorted(), by url, username and
+// password.
+void sort_for_merge(std::vector<data_type> &records);
+
+// k-way merge of inputs sorted with sort_for_merge(), in O(n log k) for n
+// records in k inputs. Every distinct record is appended to merged once, in
+// sorted order, no matter how often it occurs within and across the inputs.
+void merge_sorted(const std::vector<std::vector<data_type>> &inputs,
+                  std::vector<merged_record> &merged);
+}
+
+#endif
@@ -0,0 +1,424 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "page_file.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "secure_arena.hh"
+#include "stats.hh"
+#include "thread_pool.hh"
+
+namespace
+{
+const std::string MAGIC = "PWSPAGE2";
+// random per write, authenticated with every segment
+const std::size_t WRITE_ID_SIZE = 16;
+const std::size_t HEADER_SIZE = 8 + pw_store::SALT_SIZE + 4 + WRITE_ID_SIZE;
+// the table is authenticated like a page with this number
+const std::uint64_t TABLE_INDEX = UINT64_MAX;
+// below this number of pages a thread pool does not pay off
+const std::size_t PARALLEL_PAGES = 64;
+
+// Pages decrypted by a thread_pool, waited for in order by the parser.
+class page_progress
+{
+public:
+    explicit page_progress(std::size_t pages)
+        : state(pages, pending), stopped(false)
+    {
+    }
+
+    void done(std::size_t page, bool ok)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        state[page] = ok ? decrypted : failed;
+        changed.notify_all();
+    }
+    // false if page failed authentication
+    bool wait(std::size_t page)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&]() { return state[page] != pending; });
+        return state[page] == decrypted;
+    }
+    // the remaining pages are skipped
+    void cancel() { stopped = true; }
+    bool cancelled() const { return stopped; }
+
+private:
+    enum : char { pending, decrypted, failed };
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<char> state;
+    std::atomic<bool> stopped;
+};
+
+std::string segment_aad(const std::string &header, std::uint64_t index)
+{
+    std::string aad(header);
+    pw_store::put_u64(aad, index);
+    return aad;
+}
+
+void put_varint(std::string &s, std::uint64_t v)
+{
+    while(v >= 0x80) {
+        s.push_back(static_cast<char>((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    s.push_back(static_cast<char>(v));
+}
+
+bool get_varint(const char *&p, const char *end, std::uint64_t &v)
+{
+    v = 0;
+    for(int shift = 0; shift < 64 && p < end; shift += 7) {
+        const unsigned char b = *p++;
+        v |= static_cast<std::uint64_t>(b & 0x7f) << shift;
+        if(!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// Id of the database line [begin, end) without newline, 0 if it has none.
+// URL DELIM USERNAME DELIM PASSWORD DELIM ID DELIM
+pw_store::data_type::id_type line_id(const char *begin, const char *end)
+{
+    if(std::count(begin, end, '\t') != 4)
+        return 0;
+    const char *const last = end - 1;
+    if(*last != '\t')
+        return 0;
+    const char *first = last;
+    while(first[-1] != '\t')
+        first--;
+    pw_store::data_type::id_type id = 0;
+    for(const char *p = first; p < last; p++) {
+        if(*p < '0' || *p > '9' || id > (UINT64_MAX - 9) / 10)
+            return 0;
+        id = id * 10 + (*p - '0');
+    }
+    return id;
+}
+}
+
+pw_store::page_file::format pw_store::page_file::detect(const std::string &file)
+{
+    FILE *f = std::fopen(file.c_str(), "rb");
+    if(!f)
+        return errno == ENOENT ? format::missing : format::other;
+    char magic[8];
+    const bool pages =
+        std::fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+        std::equal(std::begin(MAGIC), std::end(MAGIC), magic);
+    std::fclose(f);
+    return pages ? format::pages : format::other;
+}
+
+pw_store::page_file::page_file(const std::string &file)
+    : path(file), pages_begin(0), total_size(0), written(0)
+{
+    wipe(reinterpret_cast<char *>(key), sizeof(key));
+}
+
+bool pw_store::page_file::open(const std::string &password)
+{
+    close();
+    bool exists;
+    if(!view.open(path, exists) || !exists || view.size() < HEADER_SIZE ||
+       !std::equal(std::begin(MAGIC), std::end(MAGIC), view.begin())) {
+        std::cerr << "Error: reading \"" << path << "\" failed.\n";
+        close();
+        return false;
+    }
+    header.assign(view.begin(), HEADER_SIZE);
+    const char *const salt = header.data() + MAGIC.size();
+    if(!derive_key(password, salt, get_u32(salt + SALT_SIZE), key) ||
+       !read_table()) {
+        close();
+        return false;
+    }
+    if(!password.empty())
+        cache_key(salt, get_u32(salt + SALT_SIZE), key);
+    return true;
+}
+
+// Fails on a wrong password, the table is the first segment decrypted.
+bool pw_store::page_file::read_table()
+{
+    const char *p = view.begin() + header.size();
+    std::size_t size;
+    if(!segment_size(p, view.end() - p, size))
+        return false;
+    std::string table(size, 0);
+    if(!size || !unseal_segment(key, segment_aad(header, TABLE_INDEX), p,
+                                &table[0]))
+        return false;
+    pages_begin = header.size() + SEGMENT_OVERHEAD + size;
+
+    // written by write(), but check the bounds anyway
+    p = table.data();
+    const char *const end = p + table.size();
+    if(end - p < 12)
+        return false;
+    written = static_cast<std::time_t>(get_u64(p));
+    const std::uint32_t generation_size = get_u32(p + 8);
+    p += 12;
+    if(static_cast<std::size_t>(end - p) < generation_size + 4)
+        return false;
+    generation.assign(p, generation_size);
+    p += generation_size;
+    const std::uint32_t count = get_u32(p);
+    p += 4;
+
+    const std::size_t pages_size = view.size() - pages_begin;
+    for(std::uint32_t i = 0; i < count; i++) {
+        if(end - p < 16)
+            return false;
+        const page pg = {get_u64(p), get_u32(p + 8)};
+        const std::uint32_t id_count = get_u32(p + 12);
+        p += 16;
+        if(pg.offset > pages_size ||
+           pages_size - pg.offset < SEGMENT_OVERHEAD + pg.size)
+            return false;
+        pages.push_back(pg);
+        total_size += pg.size;
+
+        data_type::id_type id = 0;
+        for(std::uint32_t j = 0; j < id_count; j++) {
+            std::uint64_t delta;
+            if(!get_varint(p, end, delta))
+                return false;
+            id += delta;
+            ids.emplace_back(id, i);
+        }
+    }
+    std::sort(std::begin(ids), std::end(ids));
+    return true;
+}
+
+bool pw_store::page_file::decrypt_page(std::size_t index, char *out) const
+{
+    const char *const p = view.begin() + pages_begin + pages[index].offset;
+    std::size_t size;
+    return segment_size(p, view.end() - p, size) &&
+           size == pages[index].size &&
+           unseal_segment(key, segment_aad(header, index), p, out);
+}
+
+bool pw_store::page_file::read(secure_buffer &buffer,
+                               const page_function &parse) const
+{
+    // wall time including parse, the decrypt phases of parallel pages add up
+    const stats::phase timing("read pages", total_size);
+    char *const plaintext = buffer.allocate(total_size);
+    std::vector<std::size_t> offsets;
+    offsets.reserve(pages.size() + 1);
+    std::size_t offset = 0;
+    for(const auto &pg : pages) {
+        offsets.push_back(offset);
+        offset += pg.size;
+    }
+    offsets.push_back(offset);
+
+    // pages are independent, decrypt them straight into buffer
+    bool decrypted = true;
+    bool parsed = true;
+    if(pages.size() < PARALLEL_PAGES || thread_pool::default_size() < 2) {
+        for(std::size_t i = 0; decrypted && parsed && i < pages.size(); i++) {
+            decrypted = decrypt_page(i, plaintext + offsets[i]);
+            parsed = decrypted && parse(plaintext + offsets[i],
+                                        plaintext + offsets[i + 1]);
+        }
+    } else {
+        // The pool decrypts, this thread parses the pages in order.
+        page_progress progress(pages.size());
+        std::thread decrypting([&]() {
+            thread_pool pool(thread_pool::default_size() - 1);
+            pool.run(pages.size(), [&](std::size_t i) {
+                if(!progress.cancelled())
+                    progress.done(i, decrypt_page(i, plaintext + offsets[i]));
+            });
+        });
+        try {
+            for(std::size_t i = 0; decrypted && parsed && i < pages.size();
+                i++) {
+                decrypted = progress.wait(i);
+                parsed = decrypted && parse(plaintext + offsets[i],
+                                            plaintext + offsets[i + 1]);
+            }
+        } catch(...) {
+            progress.cancel();
+            decrypting.join();
+            throw;
+        }
+        progress.cancel();
+        decrypting.join();
+    }
+
+    if(!decrypted)
+        std::cerr << "Error: a page of \"" << path
+                  << "\" failed authentication.\n";
+    if(!decrypted || !parsed)
+        buffer.clear();
+    return decrypted && parsed;
+}
+
+bool pw_store::page_file::read_page(data_type::id_type id,
+                                    secure_buffer &buffer, bool &found) const
+{
+    const auto it =
+        std::lower_bound(std::begin(ids), std::end(ids),
+                         std::make_pair(id, static_cast<std::uint32_t>(0)));
+    found = it != std::end(ids) && it->first == id;
+    if(!found)
+        return true;
+    if(decrypt_page(it->second, buffer.allocate(pages[it->second].size)))
+        return true;
+    buffer.clear();
+    std::cerr << "Error: a page of \"" << path
+              << "\" failed authentication.\n";
+    return false;
+}
+
+bool pw_store::page_file::write(const std::string &password,
+                                const secure_buffer &buffer,
+                                const std::string &generation)
+{
+    // Without a password the key of the opened file is used again, it can
+    // only come from the key cache.
+    std::string id = password.empty() ? key_id() : std::string();
+    close();
+    if(id.empty()) {
+        char salt[SALT_SIZE];
+        if(!random_bytes(salt, sizeof(salt)))
+            return false;
+        id.assign(salt, sizeof(salt));
+        put_u32(id, PBKDF2_ITERATIONS);
+    }
+    // A page sealed by an earlier write with the same key does not
+    // authenticate in this one.
+    char write_id[WRITE_ID_SIZE];
+    if(!random_bytes(write_id, sizeof(write_id)))
+        return false;
+    header = MAGIC + id + std::string(write_id, sizeof(write_id));
+    if(!derive_key(password, id.data(), get_u32(id.data() + SALT_SIZE), key)) {
+        close();
+        return false;
+    }
+
+    const std::time_t now = std::time(nullptr);
+    std::string table;
+    put_u64(table, static_cast<std::uint64_t>(now));
+    put_u32(table, generation.size());
+    table.append(generation);
+    const std::size_t count_offset = table.size();
+    put_u32(table, 0);
+
+    // Cut at line boundaries first, the table precedes the pages.
+    std::vector<std::pair<const char *, std::size_t>> cuts;
+    std::uint64_t sealed_size = 0;
+    std::vector<data_type::id_type> page_ids;
+    const char *const end = buffer.data() + buffer.size();
+    for(const char *p = buffer.data(); p < end;) {
+        page_ids.clear();
+        const char *page_end = p;
+        while(page_end < end &&
+              static_cast<std::size_t>(page_end - p) < page_size) {
+            const char *eol = static_cast<const char *>(
+                std::memchr(page_end, '\n', end - page_end));
+            if(!eol)
+                eol = end;
+            const auto id = line_id(page_end, eol);
+            if(id)
+                page_ids.push_back(id);
+            page_end = eol == end ? end : eol + 1;
+        }
+
+        put_u64(table, sealed_size);
+        put_u32(table, page_end - p);
+        put_u32(table, page_ids.size());
+        std::sort(std::begin(page_ids), std::end(page_ids));
+        data_type::id_type previous = 0;
+        for(const auto id : page_ids) {
+            put_varint(table, id - previous);
+            previous = id;
+        }
+        cuts.emplace_back(p, page_end - p);
+        sealed_size += SEGMENT_OVERHEAD + (page_end - p);
+        p = page_end;
+    }
+    std::string count_field;
+    put_u32(count_field, cuts.size());
+    table.replace(count_offset, 4, count_field);
+
+    // Every segment is sealed straight into the file.
+    std::string file;
+    file.reserve(header.size() + SEGMENT_OVERHEAD + table.size() +
+                 sealed_size);
+    file.append(header);
+    bool sealed = seal_segment(key, segment_aad(header, TABLE_INDEX),
+                               table.data(), table.size(), file);
+    for(std::size_t i = 0; sealed && i < cuts.size(); i++)
+        sealed = seal_segment(key, segment_aad(header, i), cuts[i].first,
+                              cuts[i].second, file);
+    if(!sealed) {
+        close();
+        return false;
+    }
+    if(!replace_file(path, file)) {
+        std::cerr << "Error: writing \"" << path << "\" failed.\n";
+        close();
+        return false;
+    }
+
+    // The key stays until close(), the journal shares it.
+    if(!password.empty())
+        cache_key(id.data(), get_u32(id.data() + SALT_SIZE), key);
+    written = now;
+    this->generation = generation;
+    return true;
+}
+
+std::string pw_store::page_file::key_id() const
+{
+    if(header.size() < HEADER_SIZE)
+        return std::string();
+    return header.substr(MAGIC.size(), SALT_SIZE + 4);
+}
+
+void pw_store::page_file::close()
+{
+    wipe(reinterpret_cast<char *>(key), sizeof(key));
+    header.clear();
+    view.unmap();
+    pages.clear();
+    ids.clear();
+    pages_begin = 0;
+    total_size = 0;
+}
@@ -0,0 +1,125 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _PAGE_FILE_HH_
+#define _PAGE_FILE_HH_
+
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "crypto_segment.hh"
+#include "pwstore.hh"
+#include "secure_arena.hh"
+
+namespace pw_store
+{
+
+// Encrypted database file made of independently encrypted pages, so single
+// records can be read without decrypting the whole file.
+// format is:
+//   header = MAGIC SALT ITERATIONS WRITE_ID
+//   table = segment
+//   page = segment
+//   file = header table page*
+// Pages hold consecutive lines of a database buffer (see pwstore.hh), cut
+// at line boundaries after about page_size bytes. The table holds the time
+// of writing, the journal generation and per page its offset after the
+// table, its size and the sorted ids of its records:
+//   table = TIME SIZE GENERATION COUNT (OFFSET SIZE COUNT ID_DELTA*)*
+// with ID_DELTA as varint. The header and the page number are
+// authenticated with every segment, see crypto_segment.hh. WRITE_ID is
+// random per write, so a page of an older version of the file does not
+// authenticate in a newer one even though both share salt and key. Files
+// of the first version have no WRITE_ID, they are read but not written.
+class page_file
+{
+public:
+    static const std::size_t page_size = 4096;
+
+    enum class format { missing, pages, other };
+    // missing, a page file or something else, e.g. a database written
+    // with libaan::crypto::file by older versions.
+    static format detect(const std::string &file);
+
+    explicit page_file(const std::string &file);
+    ~page_file() { close(); }
+    page_file(const page_file &) = delete;
+    page_file &operator=(const page_file &) = delete;
+
+    // Derive the key and read the table. Fails on a wrong password.
+    bool open(const std::string &password);
+    using page_function = std::function<bool(const char *, const char *)>;
+    // Decrypt all pages of the opened file into buffer. Each page is passed
+    // to parse in file order as soon as it is decrypted, while later pages
+    // are still being decrypted. Fails if parse does.
+    bool read(secure_buffer &buffer, const page_function &parse) const;
+    // Decrypt only the page holding the record with id into buffer. found
+    // is false if no page has id.
+    bool read_page(data_type::id_type id, secure_buffer &buffer,
+                   bool &found) const;
+    // Replace the file with the database buffer, encrypted with a new salt.
+    // An empty password keeps salt and key of the opened file.
+    bool write(const std::string &password, const secure_buffer &buffer,
+               const std::string &generation);
+    // Forget the key and unmap the file.
+    void close();
+
+    // SALT ITERATIONS of the key of the file opened or written last, empty
+    // if there is none. See key_cache.
+    std::string key_id() const;
+    // That key, for a journal sharing it. nullptr after close().
+    const unsigned char *file_key() const
+    {
+        return header.empty() ? nullptr : key;
+    }
+    std::time_t time_of_last_write() const { return written; }
+    const std::string &journal_generation() const { return generation; }
+    // bytes of plaintext in all pages
+    std::size_t plaintext_size() const { return total_size; }
+    // records with an id in all pages
+    std::size_t record_count() const { return ids.size(); }
+
+private:
+    struct page
+    {
+        std::uint64_t offset;
+        std::uint32_t size;
+    };
+    bool read_table();
+    bool decrypt_page(std::size_t index, char *out) const;
+
+    std::string path;
+    std::string header;
+    unsigned char key[KEY_SIZE];
+    file_view view;
+    // start of the first page in view
+    std::size_t pages_begin;
+    std::vector<page> pages;
+    // (id, page) sorted by id
+    std::vector<std::pair<data_type::id_type, std::uint32_t>> ids;
+    std::size_t total_size;
+    std::time_t written;
+    std::string generation;
+};
+}
+
+#endif
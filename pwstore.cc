@@ -18,107 +18,867 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #include "pwstore.hh"
 
+#include <cstring>
 #include <iostream>
-#include <tuple>
 
-#include "libaan/string_util.hh"
+#include "fuzzy_match.hh"
+#include "key_column.hh"
+#include "query.hh"
+#include "suffix_index.hh"
+#include "thread_pool.hh"
+#include "trigram_index.hh"
+
+pw_store::record::record(const data_type &date, secure_arena &arena,
+                         data_type::id_type id)
+    : id(id)
+{
+    char *p = arena.allocate(date.url_string.size() + date.username.size() +
+                             date.password.size());
+    url_string = field_ref(p, date.url_string.size());
+    p = std::copy(std::begin(date.url_string), std::end(date.url_string), p);
+    username = field_ref(p, date.username.size());
+    p = std::copy(std::begin(date.username), std::end(date.username), p);
+    password = field_ref(p, date.password.size());
+    std::copy(std::begin(date.password), std::end(date.password), p);
+}
+
+pw_store::record::record(const record &r, secure_arena &arena) : id(r.id)
+{
+    char *p = arena.allocate(r.url_string.size + r.username.size +
+                             r.password.size);
+    url_string = field_ref(p, r.url_string.size);
+    p = std::copy(r.url_string.data, r.url_string.data + r.url_string.size, p);
+    username = field_ref(p, r.username.size);
+    p = std::copy(r.username.data, r.username.data + r.username.size, p);
+    password = field_ref(p, r.password.size);
+    std::copy(r.password.data, r.password.data + r.password.size, p);
+}
+
+void pw_store::record::rebind(const char *p, std::size_t delim_size)
+{
+    url_string.data = p;
+    p += url_string.size + delim_size;
+    username.data = p;
+    p += username.size + delim_size;
+    password.data = p;
+}
+
+void pw_store::record::wipe()
+{
+    // fields are never part of a const object: either the database buffer
+    // or the arena.
+    pw_store::wipe(const_cast<char *>(url_string.data), url_string.size);
+    pw_store::wipe(const_cast<char *>(username.data), username.size);
+    pw_store::wipe(const_cast<char *>(password.data), password.size);
+}
+
+pw_store::database::database(secure_buffer &buffer)
+    : dirty(false), stale(false), serialized(false), string_buffer(buffer),
+      line_count(0),
+      next_id(1), column(new key_column), trigrams(new trigram_index),
+      suffixes(new suffix_index), index_type(lookup_index::trigrams),
+      lookup_count(0), parallel_records(default_parallel_threshold),
+      fuzzy_results(default_fuzzy_limit), last_mode(match_mode::exact),
+      last_valid(false)
+{
+}
+
+pw_store::database::~database() { clear_all_buffers(); }
+
+void pw_store::database::modified()
+{
+    dirty = true;
+    stale = true;
+    drop_lookup_state();
+}
+
+void pw_store::database::drop_lookup_state()
+{
+    suffixes->clear();
+    column->clear();
+    if(!last_key.empty())
+        wipe(&last_key[0], last_key.size());
+    last_key.clear();
+    last_slots.clear();
+    last_valid = false;
+}
+
+namespace
+{
+// decimal id > 0
+bool parse_id(const char *begin, const char *end,
+              pw_store::data_type::id_type &id)
+{
+    if(begin == end)
+        return false;
+    id = 0;
+    for(const char *p = begin; p < end; p++) {
+        if(*p < '0' || *p > '9')
+            return false;
+        const pw_store::data_type::id_type digit = *p - '0';
+        if(id > (UINT64_MAX - digit) / 10)
+            return false;
+        id = id * 10 + digit;
+    }
+    return id != 0;
+}
+
+// Position of the first four delimiters in [begin, end) in delims.
+// Returns the number of delimiters in the line.
+std::size_t split_line(const char *begin, const char *end, char delim,
+                       const char *delims[4])
+{
+    std::size_t delim_count = 0;
+    for(const char *q = begin; q < end; q++) {
+        if(*q != delim)
+            continue;
+        if(delim_count < 4)
+            delims[delim_count] = q;
+        delim_count++;
+    }
+    return delim_count;
+}
+
+bool is_key(const char *begin, const char *end, const std::string &key)
+{
+    return static_cast<std::size_t>(end - begin) == key.size() &&
+           std::equal(begin, end, std::begin(key));
+}
+
+const std::string NEXT_ID_HEADER = "next_id";
+const std::string JOURNAL_HEADER = "journal";
+const std::string REMOVE_CHANGE = "remove";
+
+std::size_t decimal_digits(pw_store::data_type::id_type id)
+{
+    std::size_t digits = 1;
+    for(; id >= 10; id /= 10)
+        digits++;
+    return digits;
+}
+
+// write id with digits decimal digits to p, returns the end
+char *write_decimal(char *p, std::size_t digits,
+                    pw_store::data_type::id_type id)
+{
+    for(std::size_t i = digits; i--; id /= 10)
+        p[i] = '0' + id % 10;
+    return p + digits;
+}
+
+char *write_field(char *p, const char *data, std::size_t size)
+{
+    std::memcpy(p, data, size);
+    return p + size;
+}
+
+// URL DELIM USER DELIM PW DELIM ID DELIM newline
+std::size_t line_size(const pw_store::record &r, std::size_t delim)
+{
+    return r.url_string.size + r.username.size + r.password.size +
+           decimal_digits(r.id) + 4 * delim + 1;
+}
+
+char *write_line(char *p, const pw_store::record &r, const std::string &delim)
+{
+    p = write_field(p, r.url_string.data, r.url_string.size);
+    p = write_field(p, delim.data(), delim.size());
+    p = write_field(p, r.username.data, r.username.size);
+    p = write_field(p, delim.data(), delim.size());
+    p = write_field(p, r.password.data, r.password.size);
+    p = write_field(p, delim.data(), delim.size());
+    p = write_decimal(p, decimal_digits(r.id), r.id);
+    p = write_field(p, delim.data(), delim.size());
+    *p++ = '\n';
+    return p;
+}
+}
 
 bool pw_store::database::parse()
+{
+    const char *const begin = string_buffer.data();
+    const char *const end = begin + string_buffer.size();
+    begin_parse(std::count(begin, end, '\n'));
+    if(!parse_lines(begin, end))
+        return false;
+    end_parse();
+    return true;
+}
+
+void pw_store::database::begin_parse(std::size_t records)
 {
     urluserpw.clear();
+    slots.clear();
+    drop_lookup_state();
+    trigrams->clear();
+    lookup_count = 0;
+    next_id = 1;
+    generation.clear();
+    inserted_ids.clear();
+    removed_ids.clear();
+    unnumbered.clear();
     line_count = 0;
-    if(!string_buffer.size())
-        return true;
-
-    const auto lines = libaan::util::split2(string_buffer, "\n");
+    serialized = false;
+    slots.reserve(records);
+}
 
-    for(const auto &line_buff : lines) {
-        if(!line_buff.second)
+bool pw_store::database::parse_lines(const char *begin, const char *end)
+{
+    // Records reference the fields in string_buffer directly. The only
+    // allocations are the growth of urluserpw and slots.
+    const char *p = begin;
+    while(p < end) {
+        const char *eol =
+            static_cast<const char *>(std::memchr(p, '\n', end - p));
+        if(!eol)
+            eol = end;
+        if(eol == p) {
+            p++;
             continue;
-        const auto line = std::string(line_buff.first, line_buff.second);
-        const auto fields = libaan::util::split2(line, "\t");
-        if(fields.size() != 4) {
+        }
+
+        // URL DELIM USER DELIM PW DELIM [ID DELIM]
+        const char *delims[4];
+        const std::size_t delim_count = split_line(p, eol, DELIM[0], delims);
+
+        data_type::id_type id = 0;
+        bool valid = delim_count == 3 || delim_count == 4;
+        if(delim_count == 1 && urluserpw.empty()) {
+            // headers precede all entries
+            if(is_key(p, delims[0], NEXT_ID_HEADER))
+                valid = parse_id(delims[0] + 1, eol, next_id);
+            else if(is_key(p, delims[0], JOURNAL_HEADER)) {
+                generation.assign(delims[0] + 1, eol);
+                valid = !generation.empty();
+            }
+        } else if(delim_count == 4)
+            valid = parse_id(delims[2] + 1, delims[3], id);
+        if(!valid) {
             std::cerr << "Error: corrupt database file.\n";
-            std::cerr << "\tfields.size() = " << fields.size() << "\n";
-            std::cerr << "\tline = \"" << line << "\"\n";
+            std::cerr << "\tfields.size() = " << delim_count + 1 << "\n";
+            std::cerr << "\tline = \"" << std::string(p, eol) << "\"\n";
             return false;
         }
-
-        data_type date(std::string(fields[0].first, fields[0].second),
-                       std::string(fields[1].first, fields[1].second),
-                       std::string(fields[2].first, fields[2].second));
-        insert(date);
+        const char *const line = p;
         ++line_count;
+        p = eol + 1;
+        if(delim_count == 1)
+            continue;
+
+        if(!id)
+            unnumbered.push_back(urluserpw.size());
+        else if(!slots.emplace(id, urluserpw.size()).second) {
+            std::cerr << "Error: corrupt database file.\n";
+            std::cerr << "\tduplicate record id " << id << "\n";
+            return false;
+        }
+        urluserpw.emplace_back(
+            field_ref(line, delims[0] - line),
+            field_ref(delims[0] + 1, delims[1] - delims[0] - 1),
+            field_ref(delims[1] + 1, delims[2] - delims[1] - 1), id);
     }
+    return true;
+}
 
+void pw_store::database::end_parse()
+{
+    for(const auto &slot : slots)
+        next_id = std::max(next_id, slot.first + 1);
+    for(const auto slot : unnumbered) {
+        urluserpw[slot].id = next_id++;
+        slots.emplace(urluserpw[slot].id, slot);
+    }
+    unnumbered.clear();
+    unnumbered.shrink_to_fit();
     dirty = false;
+    stale = false;
+}
+
+bool pw_store::database::insert(const data_type &date)
+{
+    inserted(next_id);
+    append(record(date, arena, next_id++));
+    modified();
 
     return true;
 }
 
-bool pw_store::database::insert(const data_type &date)
+bool pw_store::database::insert(const std::list<data_type> &dates)
 {
-    urluserpw.push_back(date);
-    data_type_cmp_enhanced cmp;
-    std::sort(urluserpw.begin(), urluserpw.end(), cmp);
-    dirty = true;
+    if(dates.empty())
+        return true;
+
+    urluserpw.reserve(urluserpw.size() + dates.size());
+    slots.reserve(urluserpw.size() + dates.size());
+    for(const auto &date : dates) {
+        inserted(next_id);
+        append(record(date, arena, next_id++));
+    }
+    modified();
 
     return true;
 }
 
-void pw_store::database::lookup(
-    const std::string &key,
-    std::list<std::tuple<data_type::id_type, data_type>> &matches)
+void pw_store::database::append(const record &r)
 {
-    // Just do a linear search for now. The number of keys won't be that large.
-    const auto &fail = std::string::npos;
-    data_type::id_type idx = 0;
-    for(const auto &k : urluserpw) {
-        const bool url_match = k.url_string.find(key) != fail;
-        const bool user_match = k.username.find(key) != fail;
+    slots[r.id] = urluserpw.size();
+    urluserpw.push_back(r);
+    trigrams->insert(r);
+}
+
+bool pw_store::database::remove(const std::vector<data_type::id_type> &ids)
+{
+    if(!ids.size())
+        return true;
+
+    std::vector<std::size_t> victims;
+    victims.reserve(ids.size());
+    for(const auto id : ids) {
+        const auto slot = slots.find(id);
+        if(slot == slots.end())
+            return false;
+        victims.push_back(slot->second);
+    }
+    std::sort(std::begin(victims), std::end(victims));
+    victims.erase(std::unique(std::begin(victims), std::end(victims)),
+                  std::end(victims));
+    for(const auto slot : victims)
+        removed(urluserpw[slot].id);
+    remove_slots(victims);
+    modified();
+
+    return true;
+}
+
+void pw_store::database::remove_slots(const std::vector<std::size_t> &victims)
+{
+    if(victims.empty())
+        return;
+
+    // Like std::remove_if: wipe the victims and move the remaining records
+    // forward, starting at the first victim.
+    auto victim = std::begin(victims);
+    std::size_t out = victims.front();
+    for(std::size_t slot = out; slot < urluserpw.size(); slot++) {
+        if(victim != std::end(victims) && *victim == slot) {
+            trigrams->remove(urluserpw[slot].id);
+            urluserpw[slot].wipe();
+            slots.erase(urluserpw[slot].id);
+            ++victim;
+            continue;
+        }
+        urluserpw[out] = urluserpw[slot];
+        slots[urluserpw[out].id] = out;
+        out++;
+    }
+    urluserpw.resize(out);
+}
+
+void pw_store::database::find_slots(const std::string &key, match_mode mode,
+                                    std::vector<std::size_t> &found)
+{
+    if(!parallel() && index_type == lookup_index::suffix_array) {
+        if(mode == match_mode::exact && suffix_find_slots(key, found))
+            return;
+    } else if(!parallel() && key.size() >= trigram_index::gram_size) {
+        // A single lookup is cheaper as a scan than building the index first.
+        if(++lookup_count > 1 && !trigrams->built())
+            trigrams->build(urluserpw);
+        if(trigram_find_slots(key, mode, found))
+            return;
+    }
+
+    if(!column->built())
+        column->build(urluserpw);
+    if(mode == match_mode::ignore_case)
+        column->fold();
+    if(parallel()) {
+        parallel_find_slots(key, mode, found);
+        return;
+    }
+    if(!column->scan(key, found, mode == match_mode::ignore_case))
+        scan_records(key, mode, found, 0, urluserpw.size());
+}
+
+// Candidates contain all trigrams of key, only they are compared to key.
+bool pw_store::database::trigram_find_slots(const std::string &key,
+                                            match_mode mode,
+                                            std::vector<std::size_t> &found)
+{
+    std::vector<data_type::id_type> ids;
+    if(!trigrams->find(key, ids))
+        return false;
+
+    const bool exact = mode == match_mode::exact;
+    const std::string folded = exact ? std::string() : fold_case(key);
+    const std::size_t first = found.size();
+    for(const auto id : ids) {
+        const auto slot = slots.find(id)->second;
+        const auto &k = urluserpw[slot];
+        const bool match =
+            exact ? k.url_string.contains(key) || k.username.contains(key)
+                  : k.url_string.contains_folded(folded) ||
+                        k.username.contains_folded(folded);
+        if(match)
+            found.push_back(slot);
+    }
+    // storage order
+    std::sort(std::begin(found) + first, std::end(found));
+    return true;
+}
+
+// The suffix array lives as long as the column it indexes.
+bool pw_store::database::suffix_find_slots(const std::string &key,
+                                           std::vector<std::size_t> &found)
+{
+    if(!column->built())
+        column->build(urluserpw);
+    // A single lookup is cheaper as a scan than building the index first.
+    if(++lookup_count > 1 && !suffixes->built())
+        suffixes->build(*column);
+    return suffixes->find(key, found);
+}
+
+void pw_store::database::index(lookup_index type)
+{
+    if(type == index_type)
+        return;
+    index_type = type;
+    suffixes->clear();
+    trigrams->clear();
+    lookup_count = 0;
+}
+
+bool pw_store::database::parallel() const
+{
+    return parallel_records && urluserpw.size() >= parallel_records &&
+           thread_pool::default_size() > 1;
+}
+
+// For very large databases building the trigram index takes a second and
+// tens of megabytes, while a scan split over all cores takes milliseconds.
+void pw_store::database::parallel_find_slots(const std::string &key,
+                                             match_mode mode,
+                                             std::vector<std::size_t> &found)
+{
+    if(!pool)
+        pool.reset(new thread_pool(thread_pool::default_size()));
+
+    // More chunks than threads to even out chunks with many matches.
+    const std::size_t chunk_count = 4 * pool->size();
+    const std::size_t chunk_size =
+        (urluserpw.size() + chunk_count - 1) / chunk_count;
+    std::vector<std::vector<std::size_t>> chunk_slots(chunk_count);
+    pool->run(chunk_count, [&](std::size_t chunk) {
+        const std::size_t first =
+            std::min(chunk * chunk_size, urluserpw.size());
+        const std::size_t last =
+            std::min(first + chunk_size, urluserpw.size());
+        if(!column->scan(key, chunk_slots[chunk], first, last,
+                         mode == match_mode::ignore_case))
+            scan_records(key, mode, chunk_slots[chunk], first, last);
+    });
+
+    // chunks are in storage order
+    std::size_t total = found.size();
+    for(const auto &c : chunk_slots)
+        total += c.size();
+    found.reserve(total);
+    for(const auto &c : chunk_slots)
+        found.insert(std::end(found), std::begin(c), std::end(c));
+}
+
+void pw_store::database::scan_records(const std::string &key,
+                                      match_mode mode,
+                                      std::vector<std::size_t> &found,
+                                      std::size_t first,
+                                      std::size_t last) const
+{
+    if(mode == match_mode::ignore_case) {
+        const std::string folded = fold_case(key);
+        for(auto slot = first; slot < last; slot++) {
+            const auto &k = urluserpw[slot];
+            if(k.url_string.contains_folded(folded) ||
+               k.username.contains_folded(folded))
+                found.push_back(slot);
+        }
+        return;
+    }
+
+    for(auto slot = first; slot < last; slot++) {
+        const auto &k = urluserpw[slot];
+        if(k.url_string.contains(key) || k.username.contains(key))
+            found.push_back(slot);
+    }
+}
+
+// Every keystroke searches all records again: only the k best hits are
+// kept, so there is nothing useful to narrow.
+void pw_store::database::fuzzy_lookup(const std::string &key,
+                                      result_type &matches)
+{
+    if(!column->built())
+        column->build(urluserpw);
+    // smart case, see fuzzy_top_k
+    if(std::none_of(std::begin(key), std::end(key),
+                    [](char c) { return c >= 'A' && c <= 'Z'; }))
+        column->fold();
+    if(!column->built()) {
+        // more than 4 GiB of keys
+        std::vector<std::size_t> found;
+        scan_records(key, match_mode::ignore_case, found, 0,
+                     urluserpw.size());
+        for(const auto slot : found)
+            matches.emplace_back(urluserpw[slot]);
+        return;
+    }
+
+    std::vector<fuzzy_hit> hits;
+    if(parallel()) {
+        if(!pool)
+            pool.reset(new thread_pool(thread_pool::default_size()));
+        const std::size_t chunk_count = pool->size();
+        const std::size_t chunk_size =
+            (urluserpw.size() + chunk_count - 1) / chunk_count;
+        std::vector<std::vector<fuzzy_hit>> chunk_hits(chunk_count);
+        pool->run(chunk_count, [&](std::size_t chunk) {
+            const std::size_t first =
+                std::min(chunk * chunk_size, urluserpw.size());
+            const std::size_t last =
+                std::min(first + chunk_size, urluserpw.size());
+            fuzzy_top_k(*column, key, fuzzy_results, first, last,
+                        chunk_hits[chunk]);
+        });
+        for(const auto &c : chunk_hits)
+            hits.insert(std::end(hits), std::begin(c), std::end(c));
+        std::sort(std::begin(hits), std::end(hits), fuzzy_better);
+        if(hits.size() > fuzzy_results)
+            hits.resize(fuzzy_results);
+    } else
+        fuzzy_top_k(*column, key, fuzzy_results, 0, urluserpw.size(), hits);
+
+    matches.reserve(matches.size() + hits.size());
+    for(const auto &hit : hits)
+        matches.emplace_back(urluserpw[hit.slot], hit.score);
+}
+
+void pw_store::database::lookup(const std::string &key, result_type &matches,
+                                match_mode mode)
+{
+    if(mode != match_mode::fuzzy && query::is_query(key)) {
+        // Invalid queries, e.g. while one is typed, are plain keys.
+        query q;
+        std::string error;
+        if(q.compile(key, mode != match_mode::exact, error)) {
+            lookup(q, matches);
+            return;
+        }
+    }
+    if(mode == match_mode::fuzzy) {
+        fuzzy_lookup(key, matches);
+        return;
+    }
+
+    // ignore_case narrowing compares folded keys
+    const bool exact = mode == match_mode::exact;
+    const std::string folded = exact ? std::string() : fold_case(key);
+    const bool narrow =
+        last_valid && mode == last_mode &&
+        (exact ? key.find(last_key)
+               : folded.find(fold_case(last_key))) != std::string::npos;
+
+    std::vector<std::size_t> found;
+    if(narrow) {
+        // Every match of key contains last_key in the same field, so the
+        // result is a subset of the previous one.
+        for(const auto slot : last_slots) {
+            const auto &k = urluserpw[slot];
+            const bool match =
+                exact ? k.url_string.contains(key) || k.username.contains(key)
+                      : k.url_string.contains_folded(folded) ||
+                            k.username.contains_folded(folded);
+            if(match)
+                found.push_back(slot);
+        }
+    } else
+        find_slots(key, mode, found);
+
+    matches.reserve(matches.size() + found.size());
+    for(const auto slot : found)
+        matches.emplace_back(urluserpw[slot]);
 
-        if(url_match || user_match)
-            matches.push_back(std::make_tuple(idx, k));
-        idx++;
+    last_key = key;
+    last_slots.swap(found);
+    last_mode = mode;
+    last_valid = true;
+}
+
+void pw_store::database::lookup(const query &q, result_type &matches)
+{
+    // Only records containing the anchor can match, find them with the
+    // column or index like a plain key. Alternatives and negations have to
+    // look at every record.
+    std::vector<std::size_t> candidates;
+    if(!q.anchor().empty())
+        find_slots(q.anchor(),
+                   q.ignores_case() ? match_mode::ignore_case
+                                    : match_mode::exact,
+                   candidates);
+    else {
+        candidates.resize(urluserpw.size());
+        for(std::size_t slot = 0; slot < candidates.size(); slot++)
+            candidates[slot] = slot;
     }
+
+    for(const auto slot : candidates)
+        if(q.matches(urluserpw[slot]))
+            matches.emplace_back(urluserpw[slot]);
+    // the next key can not narrow these matches
+    last_valid = false;
 }
 
 void pw_store::database::synchronize_buffer()
 {
-    if(!dirty)
+    if(!stale)
         return;
 
-    // std::fill(string_buffer.begin(), string_buffer.end(), 0);
-    string_buffer.resize(0);
+    // Inserted records are appended, restore the sorted storage order.
+    // Equal records are ordered by id. Bulk inserts of sorted records, e.g.
+    // from merge, need no sort.
+    const auto storage_order = [](const record &a, const record &b) {
+        const record_cmp cmp;
+        return cmp(a, b) || (!cmp(b, a) && a.id < b.id);
+    };
+    if(!std::is_sorted(std::begin(urluserpw), std::end(urluserpw),
+                       storage_order))
+        std::sort(std::begin(urluserpw), std::end(urluserpw), storage_order);
+    for(std::size_t slot = 0; slot < urluserpw.size(); slot++)
+        slots[urluserpw[slot].id] = slot;
+    drop_lookup_state();
+
+    // Serialize into a new buffer, since records still point into the old
+    // one. It is allocated once with the exact size: growing it would leave
+    // copies of passwords in freed memory.
+    const std::size_t delim = DELIM.size();
+    const auto next_digits = decimal_digits(next_id);
+    std::size_t size = NEXT_ID_HEADER.size() + delim + next_digits + 1;
+    if(!generation.empty())
+        size += JOURNAL_HEADER.size() + delim + generation.size() + 1;
+    std::vector<std::size_t> offsets;
+    offsets.reserve(urluserpw.size() + 1);
     for(const auto &k : urluserpw) {
-        string_buffer.append(k.url_string);
-        string_buffer.append(DELIM);
-        string_buffer.append(k.username);
-        string_buffer.append(DELIM);
-        string_buffer.append(k.password);
-        string_buffer.append(DELIM);
-        string_buffer.append("\n");
+        offsets.push_back(size);
+        size += line_size(k, delim);
     }
+    offsets.push_back(size);
 
+    secure_buffer buffer;
+    char *p = buffer.allocate(size);
+    p = write_field(p, NEXT_ID_HEADER.data(), NEXT_ID_HEADER.size());
+    p = write_field(p, DELIM.data(), delim);
+    p = write_decimal(p, next_digits, next_id);
+    *p++ = '\n';
+    if(!generation.empty()) {
+        p = write_field(p, JOURNAL_HEADER.data(), JOURNAL_HEADER.size());
+        p = write_field(p, DELIM.data(), delim);
+        p = write_field(p, generation.data(), generation.size());
+        *p++ = '\n';
+    }
+
+    // Lines of records unchanged since the last call are still in
+    // string_buffer, in this format. Runs of them that are adjacent there
+    // are copied at once, only inserted records are formatted.
+    const char *const old_begin = string_buffer.data();
+    const char *const old_end = old_begin + string_buffer.size();
+    const char *run = nullptr;
+    const char *run_end = nullptr;
+    const auto copy_run = [&p, &run, &run_end]() {
+        if(run)
+            p = write_field(p, run, run_end - run);
+        run = run_end = nullptr;
+    };
+    for(std::size_t slot = 0; slot < urluserpw.size(); slot++) {
+        const auto &k = urluserpw[slot];
+        const char *const line = k.url_string.data;
+        const char *const line_end = line + offsets[slot + 1] - offsets[slot];
+        if(serialized && line >= old_begin && line_end <= old_end) {
+            if(line != run_end) {
+                copy_run();
+                run = line;
+            }
+            run_end = line_end;
+            continue;
+        }
+        copy_run();
+        p = write_line(p, k, DELIM);
+    }
+    copy_run();
+    string_buffer.swap(buffer);
+
+    // Point all records into the new buffer, then wipe the old one and the
+    // copies of inserted records.
+    for(std::size_t slot = 0; slot < urluserpw.size(); slot++)
+        urluserpw[slot].rebind(string_buffer.data() + offsets[slot],
+                               DELIM.size());
+    buffer.clear();
+    arena.reset();
+
+    inserted_ids.clear();
+    removed_ids.clear();
     dirty = false;
+    stale = false;
+    serialized = true;
 }
 
-void pw_store::database::clear_all_buffers()
+void pw_store::database::take_changes(secure_buffer &changes)
+{
+    changes.clear();
+    if(!dirty)
+        return;
+
+    // ascending ids, i.e. in the order of insertion
+    std::vector<data_type::id_type> ids(std::begin(inserted_ids),
+                                        std::end(inserted_ids));
+    std::sort(std::begin(ids), std::end(ids));
+
+    // Allocated once with the exact size, like the buffer of
+    // synchronize_buffer().
+    const std::size_t delim = DELIM.size();
+    const auto next_digits = decimal_digits(next_id);
+    std::size_t size = NEXT_ID_HEADER.size() + delim + next_digits + 1;
+    for(const auto id : removed_ids)
+        size += REMOVE_CHANGE.size() + delim + decimal_digits(id) + 1;
+    for(const auto id : ids)
+        size += line_size(urluserpw[slots[id]], delim);
+
+    char *p = changes.allocate(size);
+    p = write_field(p, NEXT_ID_HEADER.data(), NEXT_ID_HEADER.size());
+    p = write_field(p, DELIM.data(), delim);
+    p = write_decimal(p, next_digits, next_id);
+    *p++ = '\n';
+    for(const auto id : removed_ids) {
+        p = write_field(p, REMOVE_CHANGE.data(), REMOVE_CHANGE.size());
+        p = write_field(p, DELIM.data(), delim);
+        p = write_decimal(p, decimal_digits(id), id);
+        *p++ = '\n';
+    }
+    for(const auto id : ids)
+        p = write_line(p, urluserpw[slots[id]], DELIM);
+
+    inserted_ids.clear();
+    removed_ids.clear();
+    dirty = false;
+}
+
+bool pw_store::database::apply_changes(const char *begin, const char *end)
 {
-    for(auto &k : urluserpw) {
-        std::fill(k.url_string.begin(), k.url_string.end(), 0);
-        std::fill(k.username.begin(), k.username.end(), 0);
-        std::fill(k.password.begin(), k.password.end(), 0);
+    drop_lookup_state();
+    stale = true;
+
+    // Removals are applied together at the end, in one pass keeping the
+    // order of the other records. Ids are never reused, so no line of the
+    // same changes refers to a removed record again.
+    std::vector<std::size_t> victims;
+    for(const char *p = begin; p < end;) {
+        const char *eol =
+            static_cast<const char *>(std::memchr(p, '\n', end - p));
+        if(!eol)
+            eol = end;
+        const char *delims[4];
+        const std::size_t delim_count = split_line(p, eol, DELIM[0], delims);
+
+        data_type::id_type id = 0;
+        bool valid = false;
+        if(delim_count == 1 && is_key(p, delims[0], NEXT_ID_HEADER)) {
+            valid = parse_id(delims[0] + 1, eol, id);
+            next_id = std::max(next_id, id);
+        } else if(delim_count == 1 && is_key(p, delims[0], REMOVE_CHANGE)) {
+            valid = parse_id(delims[0] + 1, eol, id);
+            const auto slot = slots.find(id);
+            valid = valid && slot != slots.end();
+            if(valid)
+                victims.push_back(slot->second);
+        } else if(delim_count == 4) {
+            valid = parse_id(delims[2] + 1, delims[3], id) && !slots.count(id);
+            if(valid) {
+                // the changes are wiped by the caller
+                const record r(
+                    field_ref(p, delims[0] - p),
+                    field_ref(delims[0] + 1, delims[1] - delims[0] - 1),
+                    field_ref(delims[1] + 1, delims[2] - delims[1] - 1), id);
+                append(record(r, arena));
+                next_id = std::max(next_id, id + 1);
+            }
+        }
+        if(!valid) {
+            std::cerr << "Error: corrupt journal.\n";
+            std::cerr << "\tfields.size() = " << delim_count + 1 << "\n";
+            return false;
+        }
+        p = eol + 1;
     }
-    urluserpw.resize(0);
+
+    std::sort(std::begin(victims), std::end(victims));
+    if(std::adjacent_find(std::begin(victims), std::end(victims)) !=
+       std::end(victims)) {
+        std::cerr << "Error: corrupt journal.\n";
+        std::cerr << "\trecord removed twice\n";
+        return false;
+    }
+    remove_slots(victims);
+    return true;
 }
 
-void pw_store::database::dump_db(
-    std::list<std::tuple<data_type::id_type, data_type>> &content) const
+bool pw_store::database::find_serialized(const char *begin, const char *end,
+                                         const data_type::id_type &id,
+                                         data_type &date, bool &exists)
 {
-    data_type::id_type idx = 0;
-    for(const auto &key : urluserpw) {
-        content.push_back(std::make_tuple(idx, key));
-        idx++;
+    bool found = false;
+    for(const char *p = begin; p < end;) {
+        const char *eol =
+            static_cast<const char *>(std::memchr(p, '\n', end - p));
+        if(!eol)
+            eol = end;
+        // DELIM is a member, but the same for all databases
+        const char *delims[4];
+        const std::size_t delim_count = split_line(p, eol, '\t', delims);
+
+        data_type::id_type line_id = 0;
+        if(delim_count == 1 && is_key(p, delims[0], REMOVE_CHANGE) &&
+           parse_id(delims[0] + 1, eol, line_id) && line_id == id) {
+            found = true;
+            exists = false;
+        } else if(delim_count == 4 &&
+                  parse_id(delims[2] + 1, delims[3], line_id) &&
+                  line_id == id) {
+            found = true;
+            exists = true;
+            date = data_type(std::string(p, delims[0]),
+                             std::string(delims[0] + 1, delims[1]),
+                             std::string(delims[1] + 1, delims[2]));
+        }
+        p = eol + 1;
     }
+    return found;
+}
+
+void pw_store::database::clear_all_buffers()
+{
+    // Inserted fields are wiped with the arena, one call for all of them.
+    // Fields parsed from string_buffer are wiped by its owner.
+    arena.release();
+    urluserpw.clear();
+    slots.clear();
+    inserted_ids.clear();
+    removed_ids.clear();
+    drop_lookup_state();
+    trigrams->clear();
+    lookup_count = 0;
+}
+
+void pw_store::database::dump_db(result_type &content) const
+{
+    content.reserve(content.size() + urluserpw.size());
+    for(const auto &key : urluserpw)
+        content.emplace_back(key);
 }
@@ -20,10 +20,18 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #define _PWSTORE_HH_
 
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <list>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "secure_arena.hh"
 
 namespace pw_store
 {
@@ -31,16 +39,25 @@ namespace pw_store
 // stores key value tuples in a string
 // - where keys are url-strings and usernames. values are usernames and
 // passwords.
-// - per entry 3 delim characters must exist
+// - per entry 4 delim characters must exist, 3 in files written before
+//   record ids were stored.
 // format is:
-//   entry = URL DELIM USERNAME DELIM PASSWORD DELIM
-//   file = entry*
+//   header = ("next_id" DELIM ID | "journal" DELIM GENERATION) NEWLINE
+//   entry = URL DELIM USERNAME DELIM PASSWORD DELIM [ID DELIM] NEWLINE
+//   file = header* entry*
 //   URL/USERNAME/PASSWORD can be any readable string or EMPTY
+//   ID is the decimal record id, unique and never reused. The header keeps
+//   the next id to hand out, so ids of removed records are not reused.
+//   GENERATION names the journal holding later changes, see journal.hh.
 //   - a line consists at least of: DELIM DELIM DELIM NEWLINE
+// Changes in the journal use the same lines:
+//   change = ("next_id" DELIM ID | "remove" DELIM ID) NEWLINE | entry
+// where every entry has an ID.
 
 struct data_type
 {
-    using id_type = std::size_t;
+    // persistent record id, see database
+    using id_type = std::uint64_t;
     data_type() : data_type("", "", "") {}
     data_type(const std::string &url, const std::string &user,
               const std::string &pass)
@@ -57,7 +74,10 @@ struct data_type
 };
 
 struct data_type_cmp_enhanced {
-    // returns true if a < b
+    // returns true if a < b. Compares url, username and password in that
+    // order. This has to be a strict weak ordering, sort_for_merge and
+    // merge_sorted rely on it. database::synchronize_buffer sorts the
+    // records by url and username like record_cmp.
     bool operator()(const data_type &a, const data_type &b) const
     {
         // true if a.url < b.url
@@ -65,18 +85,26 @@ struct data_type_cmp_enhanced {
                std::begin(a.url_string), std::end(a.url_string),
                std::begin(b.url_string), std::end(b.url_string)))
             return true;
-        if(a.url_string == b.url_string
-           && std::lexicographical_compare(
+        // true if a.url > b.url
+        if(std::lexicographical_compare(
+               std::begin(b.url_string), std::end(b.url_string),
+               std::begin(a.url_string), std::end(a.url_string)))
+            return false;
+
+        // post condition: a.url = b.url
+        if(std::lexicographical_compare(
                std::begin(a.username), std::end(a.username),
                std::begin(b.username), std::end(b.username)))
             return true;
+        if(std::lexicographical_compare(
+               std::begin(b.username), std::end(b.username),
+               std::begin(a.username), std::end(a.username)))
+            return false;
 
-        if(a.username == b.username
-           && std::lexicographical_compare(
-               std::begin(a.password), std::end(a.password),
-               std::begin(b.password), std::end(b.password)))
-            return true;
-        return false;
+        // post condition: a.user = b.user
+        return std::lexicographical_compare(
+            std::begin(a.password), std::end(a.password),
+            std::begin(b.password), std::end(b.password));
     }
 };
 
@@ -120,81 +148,389 @@ inline std::ostream &operator<<(std::ostream &os, const data_type &date)
     return os << date.to_string();
 }
 
+// Position of the first occurrence of key in [begin, end) or end.
+// memchr for the first character, then compare the rest.
+inline const char *find_substring(const char *begin, const char *end,
+                                  const char *key, std::size_t key_size)
+{
+    if(!key_size)
+        return begin;
+    while(static_cast<std::size_t>(end - begin) >= key_size) {
+        const char *p = static_cast<const char *>(
+            std::memchr(begin, key[0], end - begin - key_size + 1));
+        if(!p)
+            return end;
+        if(!std::memcmp(p + 1, key + 1, key_size - 1))
+            return p;
+        begin = p + 1;
+    }
+    return end;
+}
+
+// ASCII case folding, other bytes (e.g. UTF-8 sequences) are unchanged.
+inline char fold_case(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+inline std::string fold_case(std::string s)
+{
+    for(auto &c : s)
+        c = fold_case(c);
+    return s;
+}
+
+// Non-owning reference to one field of a record.
+struct field_ref
+{
+    field_ref() : data(nullptr), size(0) {}
+    field_ref(const char *data, std::size_t size) : data(data), size(size) {}
+
+    std::string str() const { return std::string(data, size); }
+    // same semantics as std::string::find(key) != npos
+    bool contains(const std::string &key) const
+    {
+        if(key.empty())
+            return true;
+        return find_substring(data, data + size, key.data(), key.size()) !=
+               data + size;
+    }
+    // same for a key passed through fold_case, ignoring the case of the
+    // field.
+    bool contains_folded(const std::string &key) const
+    {
+        if(key.empty())
+            return true;
+        return std::search(data, data + size, std::begin(key), std::end(key),
+                           [](char a, char b) { return fold_case(a) == b; }) !=
+               data + size;
+    }
+
+    const char *data;
+    std::size_t size;
+};
+
+inline bool operator<(const field_ref &a, const field_ref &b)
+{
+    return std::lexicographical_compare(a.data, a.data + a.size, b.data,
+                                        b.data + b.size);
+}
+
+// Storage of one database entry. Records parsed from the decrypted buffer
+// only point into it. Inserted records point to a copy in the secure_arena
+// of the database until the next database::synchronize_buffer().
+struct record
+{
+    record() : id(0) {}
+    record(field_ref url, field_ref user, field_ref pass,
+           data_type::id_type id = 0)
+        : url_string(url), username(user), password(pass), id(id)
+    {
+    }
+    // copies the fields of date into arena.
+    record(const data_type &date, secure_arena &arena, data_type::id_type id);
+    // copies the fields of r into arena.
+    record(const record &r, secure_arena &arena);
+
+    data_type to_data_type() const
+    {
+        return data_type(url_string.str(), username.str(), password.str());
+    }
+    // point fields to a serialized copy of this record starting at p.
+    void rebind(const char *p, std::size_t delim_size);
+    // overwrite the referenced fields with zeros.
+    void wipe();
+
+    field_ref url_string;
+    field_ref username;
+    field_ref password;
+    data_type::id_type id;
+};
+
+// same order as data_type_cmp_enhanced
+struct record_cmp {
+    bool operator()(const record &a, const record &b) const
+    {
+        if(a.url_string < b.url_string)
+            return true;
+        if(b.url_string < a.url_string)
+            return false;
+        if(a.username < b.username)
+            return true;
+        if(b.username < a.username)
+            return false;
+        return a.password < b.password;
+    }
+};
+
+// Query result: id plus references to the keys of a record. The password
+// is not part of it, use database::get. The references are only valid until
+// the next modification or synchronize_buffer() of the database, the id
+// stays valid.
+struct match_type
+{
+    match_type(const record &r, int score = 0)
+        : id(r.id), url_string(r.url_string), username(r.username),
+          score(score)
+    {
+    }
+
+    std::string to_string() const
+    {
+        return std::string("(\"") + url_string.str() + std::string("\", \"") +
+               username.str() + std::string("\", \"...\")");
+    }
+
+    data_type::id_type id;
+    field_ref url_string;
+    field_ref username;
+    // rank of fuzzy matches, higher is better. 0 for other lookups.
+    int score;
+};
+
+inline std::ostream &operator<<(std::ostream &os, const match_type &match)
+{
+    return os << match.to_string();
+}
+
+using result_type = std::vector<match_type>;
+
+// How database::lookup compares the key with url and username.
+enum class match_mode {
+    // case-sensitive substring
+    exact,
+    // substring, ignoring ASCII case
+    ignore_case,
+    // the key characters in order but not necessarily adjacent, ranked like
+    // fzf. Case is ignored unless the key contains upper case characters.
+    fuzzy
+};
+
+// Index answering repeated lookups, see database::lookup.
+enum class lookup_index {
+    // trigram_index, updated by insert and remove
+    trigrams,
+    // suffix_index over the key_column, rebuilt after every modification.
+    // Answers only exact lookups, but any key length. A library option for
+    // callers of database::index() and pwstore_bench, pwstore_api always
+    // uses trigrams.
+    suffix_array
+};
+
+class key_column;
+class query;
+class suffix_index;
+class thread_pool;
+class trigram_index;
+
 class database
 {
 public:
     const std::string DELIM = {'\t'};
 
 public:
-    // Create database object from string buffer. No copying involved.
-    explicit database(std::string &buffer) : dirty(false), string_buffer(buffer)
-    {
-    }
-
-    ~database() { clear_all_buffers(); }
-    // Parse the provided buffer.
+    // Create database object from the plaintext in buffer. No copying
+    // involved, parsed records point into buffer. buffer must outlive the
+    // database.
+    explicit database(secure_buffer &buffer);
+    ~database();
+    // Parse the provided buffer. Records of files without ids are numbered
+    // in file order, which gives the same ids until the file is written.
     bool parse();
+    // parse() in steps, e.g. while the rest of the buffer is still being
+    // decrypted: begin_parse(), parse_lines() for consecutive whole lines of
+    // the buffer in order, then end_parse(). records reserves the id map.
+    void begin_parse(std::size_t records = 0);
+    bool parse_lines(const char *begin, const char *end);
+    void end_parse();
+    // Insert date with a new id, appended to the records.
     bool insert(const data_type &date);
-    // lookup performs an iterative search over all keys and returns matches
-    // together with an unique id. This id is invalidated after add or delete
-    // operations.
-    void lookup(const std::string &key,
-                std::list<std::tuple<data_type::id_type, data_type>> &matches);
+    // Insert many dates at once. Cheaper than calling insert() per date for
+    // large imports.
+    bool insert(const std::list<data_type> &dates);
+    // lookup performs a substring search over all keys and returns matches
+    // together with the id of the record. Ids are stored in the database
+    // file and stay valid across add, remove and sessions.
+    // Matches come in storage order: sorted by url and username as written by
+    // the last synchronize_buffer(), followed by inserted records.
+    // The first lookup scans a packed key_column, which is dropped on any
+    // modification. Repeated lookups of keys with at least three characters
+    // intersect the postings of a trigram_index instead. It is built on the
+    // second lookup and updated by insert and remove, only its candidates
+    // are compared to the key. Shorter keys match too many records to
+    // benefit from an index and always scan the column.
+    // With lookup_index::suffix_array, which only index() selects, repeated
+    // exact lookups of any length search a suffix array over the key_column
+    // instead. Like the trigram_index it is built on the second lookup, not
+    // the first, and it is dropped with the column. Other modes scan the
+    // column.
+    // If key contains the key of the previous lookup (e.g. one more character
+    // was typed), only the previous matches are filtered.
+    // Databases with at least parallel_threshold() records are scanned in
+    // chunks on a thread pool instead and get no index.
+    // ignore_case lookups scan a case folded copy of the key_column, made by
+    // the first of them. The trigram_index ignores case anyway. fuzzy
+    // lookups return only the fuzzy_limit() best matches, best first.
+    // Keys with field qualifiers or operators are queries, see query.hh.
+    // Those ignore case unless mode is exact. Keys that look like a query
+    // but do not compile are searched as plain text. fuzzy lookups never
+    // treat keys as queries, "-foo" or "url:x" are fuzzy patterns there.
+    void lookup(const std::string &key, result_type &matches,
+                match_mode mode = match_mode::exact);
+    // Same for a compiled query. Matches come in storage order.
+    void lookup(const query &q, result_type &matches);
+    // append the record with id to matches, if it exists.
+    bool lookup_id(const data_type::id_type &id, result_type &matches) const
+    {
+        const auto slot = slots.find(id);
+        if(slot == slots.end())
+            return false;
+        matches.emplace_back(urluserpw[slot->second]);
+        return true;
+    }
+    // Serialize all records into the buffer, sorted by url and username.
     void synchronize_buffer();
     void clear_all_buffers();
 
-    bool get(const data_type::id_type &id, data_type &date)
+    // Changes since the last synchronize_buffer() or take_changes(), in the
+    // journal format. Marks the database as clean, but the buffer still
+    // lacks the changes until the next synchronize_buffer().
+    void take_changes(secure_buffer &changes);
+    // Apply changes read from a journal.
+    bool apply_changes(const char *begin, const char *end);
+    // Find the record with id in serialized lines, e.g. one page of a
+    // database file or changes from a journal, without parsing them into a
+    // database. Returns true if a line mentions id. exists tells whether
+    // the record exists after the last of these lines, date holds it then.
+    static bool find_serialized(const char *begin, const char *end,
+                                const data_type::id_type &id,
+                                data_type &date, bool &exists);
+    // Journal generation stored in the buffer. Setting it takes effect with
+    // the next synchronize_buffer().
+    const std::string &journal_generation() const { return generation; }
+    void journal_generation(const std::string &g)
     {
-        if(id >= urluserpw.size())
-            return false;
-        date = urluserpw[id];
-        return true;
+        generation = g;
+        stale = true;
     }
 
-    bool remove(std::vector<data_type::id_type> &ids)
+    bool get(const data_type::id_type &id, data_type &date)
     {
-        if(!ids.size())
-            return true;
-        if(!urluserpw.size())
-            return false;
-        std::sort(std::begin(ids), std::end(ids));
-        if(ids.back() >= urluserpw.size())
+        const auto slot = slots.find(id);
+        if(slot == slots.end())
             return false;
-
-        // delete multiple elements, starting with highest index,
-        // so the iterators stay valid.
-        for(std::size_t i = ids.size() - 1;;) {
-            urluserpw.erase(std::begin(urluserpw) + ids[i]);
-            if(i == 0)
-                break;
-            i--;
-        }
-        dirty = true;
+        date = urluserpw[slot->second].to_data_type();
         return true;
     }
 
+    // Remove many records in one pass over the records, keeping the order
+    // of the others. Nothing is removed if one of the ids does not exist.
+    bool remove(const std::vector<data_type::id_type> &ids);
+
     bool remove(const data_type::id_type &id)
     {
-        if(id >= urluserpw.size())
+        const auto slot = slots.find(id);
+        if(slot == slots.end())
             return false;
-        urluserpw.erase(std::begin(urluserpw) + id);
-        dirty = true;
+        removed(id);
+        remove_slots({slot->second});
+        modified();
         return true;
     }
 
-    void dump_db(
-        std::list<std::tuple<data_type::id_type, data_type>> &content) const;
+    void dump_db(result_type &content) const;
 
     bool is_dirty() const { return dirty; }
 
+    static const std::size_t default_fuzzy_limit = 50;
+    std::size_t fuzzy_limit() const { return fuzzy_results; }
+    void fuzzy_limit(std::size_t results) { fuzzy_results = results; }
+
+    static const std::size_t default_parallel_threshold = 500000;
+    std::size_t parallel_threshold() const { return parallel_records; }
+    // Minimum number of records for parallel lookups, 0 disables them.
+    void parallel_threshold(std::size_t records)
+    {
+        parallel_records = records;
+    }
+
+    // The trigram_index is the default.
+    lookup_index index() const { return index_type; }
+    void index(lookup_index type);
+
+private:
+    // mark database as dirty and drop the lookup state, except for the
+    // trigram_index.
+    void modified();
+    void drop_lookup_state();
+    // track a change for take_changes()
+    void inserted(data_type::id_type id) { inserted_ids.insert(id); }
+    void removed(data_type::id_type id)
+    {
+        if(!inserted_ids.erase(id))
+            removed_ids.push_back(id);
+    }
+    void append(const record &r);
+    // wipe the records in the ascending victims and move the others
+    // forward, keeping their order.
+    void remove_slots(const std::vector<std::size_t> &victims);
+    void find_slots(const std::string &key, match_mode mode,
+                    std::vector<std::size_t> &found);
+    // false if the trigram_index can not answer key
+    bool trigram_find_slots(const std::string &key, match_mode mode,
+                            std::vector<std::size_t> &found);
+    // false if the suffix_index can not answer key
+    bool suffix_find_slots(const std::string &key,
+                           std::vector<std::size_t> &found);
+    bool parallel() const;
+    void parallel_find_slots(const std::string &key, match_mode mode,
+                             std::vector<std::size_t> &found);
+    void scan_records(const std::string &key, match_mode mode,
+                      std::vector<std::size_t> &found, std::size_t first,
+                      std::size_t last) const;
+    void fuzzy_lookup(const std::string &key, result_type &matches);
+
 private:
+    // changes not written to disk
     bool dirty;
-    std::string &string_buffer;
+    // records not serialized into string_buffer
+    bool stale;
+    // string_buffer was written by synchronize_buffer(), not parsed
+    bool serialized;
+    secure_buffer &string_buffer;
     size_t line_count;
 
-    // use dc3 suffix-array from libaan for readonly databases in case of
-    // interactive lookup
-    std::vector<data_type> urluserpw;
+    std::vector<record> urluserpw;
+    // records of files written before ids were stored, during parsing
+    std::vector<std::size_t> unnumbered;
+    // id -> index in urluserpw
+    std::unordered_map<data_type::id_type, std::size_t> slots;
+    data_type::id_type next_id;
+    // fields of records inserted since the last synchronize_buffer()
+    secure_arena arena;
+    std::string generation;
+    // changes since the last synchronize_buffer() or take_changes()
+    std::unordered_set<data_type::id_type> inserted_ids;
+    std::vector<data_type::id_type> removed_ids;
+
+    // search layouts, built on demand
+    std::unique_ptr<key_column> column;
+    // kept up to date by append() and remove, unlike the others
+    std::unique_ptr<trigram_index> trigrams;
+    // over column, dropped with it
+    std::unique_ptr<suffix_index> suffixes;
+    lookup_index index_type;
+    // lookups since parse(), the index is built by the second
+    std::size_t lookup_count;
+    // created with the first parallel lookup
+    std::unique_ptr<thread_pool> pool;
+    std::size_t parallel_records;
+    std::size_t fuzzy_results;
+    // key and matches of the previous lookup
+    std::string last_key;
+    std::vector<std::size_t> last_slots;
+    match_mode last_mode;
+    bool last_valid;
 };
 }
 
@@ -18,76 +18,313 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #include "pwstore_api_cxx.hh"
 
-bool pw_store_api_cxx::encrypted_pwstore::sync_and_write_db()
+#include <algorithm>
+#include <ctime>
+
+#include "stats.hh"
+
+const std::size_t pw_store_api_cxx::encrypted_pwstore::compaction_ratio;
+const std::size_t pw_store_api_cxx::encrypted_pwstore::min_compaction_size;
+
+namespace
 {
-    if(!db || !crypto_file)
-        return false;
-    using namespace libaan::crypto::file;
-    db->synchronize_buffer();
-    const auto err = crypto_file->write(password);
-    if(err != crypto_file::NO_ERROR) {
-        std::cerr << "Writing database to disk failed. Error: "
-                  << crypto_file::error_string(err) << "\n";
-        return false;
+void wipe_string(std::string &s)
+{
+    if(!s.empty())
+        pw_store::wipe(&s[0], s.size());
+    s.clear();
+}
+
+// database::parse and synchronize_buffer of the buffer
+bool parse(pw_store::database &db, const pw_store::secure_buffer &buffer)
+{
+    const pw_store::stats::phase timing("parse", buffer.size());
+    return db.parse();
+}
+
+void serialize(pw_store::database &db, const pw_store::secure_buffer &buffer)
+{
+    pw_store::stats::phase timing("serialize");
+    db.synchronize_buffer();
+    timing.add_bytes(buffer.size());
+}
+
+std::string format_time(std::time_t t)
+{
+    char buffer[64];
+    std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S",
+                  std::localtime(&t));
+    return buffer;
+}
+}
+
+bool pw_store_api_cxx::encrypted_pwstore::open_db()
+{
+    close_db();
+
+    using pw_store::page_file;
+    switch(page_file::detect(file)) {
+    case page_file::format::missing:
+        exists = false;
+        db.reset(new pw_store::database(buffer));
+        rewrite = true;
+        break;
+    case page_file::format::other:
+        exists = true;
+        if(!open_crypto_file())
+            return false;
+        // converted to a page file by the next sync
+        rewrite = true;
+        break;
+    case page_file::format::pages:
+        exists = true;
+        if(!pages->open(password)) {
+            // An empty password only asks the key cache.
+            if(!password.empty())
+                std::cerr << "Error deciphering database. Wrong key?\n";
+            return false;
+        }
+        // Keep the changes for load() and get_by_id().
+        if(!pages->journal_generation().empty()) {
+            const auto keep = [this](const char *begin, const char *end) {
+                char *p = changes_arena.allocate(end - begin);
+                std::copy(begin, end, p);
+                changes.emplace_back(p, end - begin);
+                return true;
+            };
+            // The journal shares the key of the file, unless a full
+            // write was interrupted.
+            if(!journal->open(password, pages->journal_generation(), keep,
+                              pages->key_id(), pages->file_key())) {
+                std::cerr << "Error: corrupt database journal.\n";
+                close_db();
+                return false;
+            }
+        }
+        rewrite = !journal->usable();
+        break;
     }
 
+    locked = false;
     return true;
 }
 
-std::unique_ptr<pw_store::database>
-pw_store_api_cxx::encrypted_pwstore::load_db()
+bool pw_store_api_cxx::encrypted_pwstore::open_crypto_file()
 {
-    if(!crypto_file)
-        return nullptr;
-
     using namespace libaan::crypto::file;
 
     // Read encrypted database with provided password.
-    auto err = crypto_file->read(password);
+    auto err = [this]() {
+        const pw_store::stats::phase timing("crypto_file read");
+        return crypto_file->read(password);
+    }();
     if(err != crypto_file::NO_ERROR) {
         std::cerr << "Error deciphering database. Wrong key? ("
                   << crypto_file::error_string(err) << ")\n";
-        return nullptr;
+        return false;
     }
+    // moved into locked memory, the copy of crypto_file is wiped
+    auto &decrypted = crypto_file->get_decrypted_buffer();
+    buffer.assign(decrypted.data(), decrypted.size());
+    wipe_string(decrypted);
+    crypto_file->clear_buffers();
 
-    // The only reason for not using an automatic variable for db per function
-    // is to avoid duplicate code..
-    // Better to be replaced with a class.
-    std::unique_ptr<pw_store::database> db(
-        new pw_store::database(crypto_file->get_decrypted_buffer()));
-    if(!db->parse()) {
+    db.reset(new pw_store::database(buffer));
+    if(!parse(*db, buffer)) {
         std::cerr << "Error: corrupt database file.\n";
-        return nullptr;
+        close_db();
+        return false;
     }
+    return true;
+}
 
-    locked = false;
-    return db;
+void pw_store_api_cxx::encrypted_pwstore::close_db()
+{
+    db.reset(nullptr);
+    buffer.clear();
+    changes.clear();
+    changes_arena.release();
+    pages->close();
+    journal->close();
+    crypto_file->clear_buffers();
+    opened = false;
+}
+
+bool pw_store_api_cxx::encrypted_pwstore::load() const
+{
+    if(db)
+        return true;
+    if(!opened)
+        return false;
+
+    std::unique_ptr<pw_store::database> loaded(
+        new pw_store::database(buffer));
+    // pages are parsed while the next ones are decrypted
+    auto &database = *loaded;
+    const auto parse_page = [&database](const char *begin, const char *end) {
+        const pw_store::stats::phase timing("parse", end - begin);
+        return database.parse_lines(begin, end);
+    };
+    loaded->begin_parse(pages->record_count());
+    if(!pages->read(buffer, parse_page)) {
+        std::cerr << "Error: corrupt database file.\n";
+        loaded.reset(nullptr);
+        buffer.clear();
+        return false;
+    }
+    loaded->end_parse();
+    for(const auto &c : changes) {
+        const pw_store::stats::phase timing("apply journal", c.second);
+        if(!loaded->apply_changes(c.first, c.first + c.second)) {
+            std::cerr << "Error: corrupt database journal.\n";
+            loaded.reset(nullptr);
+            buffer.clear();
+            return false;
+        }
+    }
+    // sorted in memory like a database read without journal
+    if(!changes.empty())
+        serialize(*loaded, buffer);
+    changes.clear();
+    changes_arena.release();
+
+    db.swap(loaded);
+    return true;
+}
+
+bool pw_store_api_cxx::encrypted_pwstore::get_by_id(
+    const pw_store::data_type::id_type &id, pw_store::data_type &date) const
+{
+    if(db)
+        return db->get(id, date);
+    if(!opened)
+        return false;
+
+    // The last change of the record wins.
+    bool changed = false;
+    bool found = false;
+    for(const auto &c : changes) {
+        bool exists_after;
+        if(pw_store::database::find_serialized(
+               c.first, c.first + c.second, id, date, exists_after)) {
+            changed = true;
+            found = exists_after;
+        }
+    }
+    if(changed)
+        return found;
+
+    pw_store::secure_buffer page;
+    if(!pages->read_page(id, page, found) || !found)
+        return false;
+    bool exists_after = false;
+    found = pw_store::database::find_serialized(
+                page.data(), page.data() + page.size(), id, date,
+                exists_after) &&
+            exists_after;
+    return found;
+}
+
+bool pw_store_api_cxx::encrypted_pwstore::sync_and_write_db()
+{
+    if(!opened)
+        return false;
+    // nothing loaded, nothing changed
+    if(!db && !rewrite)
+        return true;
+
+    const bool compact =
+        journal->size() >
+        std::max(min_compaction_size, buffer.size() / compaction_ratio);
+    if(rewrite || compact || !journal->usable())
+        return write_db();
+    if(!db->is_dirty())
+        return true;
+
+    pw_store::secure_buffer changes;
+    {
+        pw_store::stats::phase timing("serialize");
+        db->take_changes(changes);
+        timing.add_bytes(changes.size());
+    }
+    const bool appended = journal->append(changes);
+    changes.clear();
+    // The changes are still in the records, a full write includes them.
+    return appended || write_db();
+}
+
+bool pw_store_api_cxx::encrypted_pwstore::write_db()
+{
+    if(!load())
+        return false;
+
+    // A crash before the new journal is created leaves the old one, which
+    // is ignored because of the new generation.
+    const auto generation = pw_store::journal::new_generation();
+    if(generation.empty()) {
+        std::cerr << "Error creating a journal id from random data.\n";
+        return false;
+    }
+    db->journal_generation(generation);
+    serialize(*db, buffer);
+    if(!pages->write(password, buffer, generation)) {
+        std::cerr << "Writing database to disk failed.\n";
+        rewrite = true;
+        return false;
+    }
+    exists = true;
+
+    // Without a journal the next sync writes the whole database again.
+    // Sharing the key of the database file saves deriving another one.
+    rewrite = !journal->create(password, generation, pages->key_id(),
+                               pages->file_key());
+    return true;
 }
 
 void pw_store_api_cxx::encrypted_pwstore::lock()
 {
     std::fill(std::begin(password), std::end(password), 0);
-    db.reset(nullptr);
-    crypto_file->clear_buffers();
+    close_db();
     locked = true;
 }
 
+std::string pw_store_api_cxx::encrypted_pwstore::time_of_last_write() const
+{
+    const std::time_t appended = journal->time_of_last_append();
+    if(appended)
+        return format_time(appended) + " (journal)";
+    if(pages->time_of_last_write())
+        return format_time(pages->time_of_last_write());
+    return crypto_file->time_of_last_write();
+}
+
 bool pw_store_api_cxx::encrypted_pwstore::unlock(const std::string &passwd)
 {
     password.assign(passwd);
-    db = load_db();
-    if(db == nullptr)
+    opened = open_db();
+    return opened;
+}
+
+bool pw_store_api_cxx::pwstore_api::add(const pw_store::data_type &date)
+{
+    if(!state || !db.load())
+        return false;
+
+    if(!db.get().insert(date)) {
+        std::cerr << "Error: inserting in database failed.\n";
         return false;
+    }
 
     return true;
 }
 
-bool pw_store_api_cxx::pwstore_api::add(const pw_store::data_type &date)
+bool pw_store_api_cxx::pwstore_api::add(
+    const std::list<pw_store::data_type> &dates)
 {
-    if(!state)
+    if(!state || !db.load())
         return false;
 
-    if(!db.get().insert(date)) {
+    if(!db.get().insert(dates)) {
         std::cerr << "Error: inserting in database failed.\n";
         return false;
     }
@@ -96,22 +333,19 @@ bool pw_store_api_cxx::pwstore_api::add(const pw_store::data_type &date)
 }
 
 bool pw_store_api_cxx::pwstore_api::lookup(
-    std::list<std::tuple<pw_store::data_type::id_type, pw_store::data_type>> &
-        matches,
-    const std::string &lookup_key,
-    const std::vector<pw_store::data_type::id_type> &uids)
+    pw_store::result_type &matches, const std::string &lookup_key,
+    const std::vector<pw_store::data_type::id_type> &uids,
+    pw_store::match_mode mode)
 {
-    if(!state)
+    if(!state || !db.load())
         return false;
 
+    const pw_store::stats::phase timing("lookup");
     if(lookup_key.length())
-        db.get().lookup(lookup_key, matches);
+        db.get().lookup(lookup_key, matches, mode);
 
-    for(const auto &id : uids) {
-        pw_store::data_type data;
-        if(db.get().get(id, data))
-            matches.push_back(std::make_tuple(id, data));
-    }
+    for(const auto &id : uids)
+        db.get().lookup_id(id, matches);
 
     return true;
 }
@@ -122,25 +356,20 @@ bool pw_store_api_cxx::pwstore_api::get(const pw_store::data_type::id_type &uid,
     if(!state)
         return false;
 
-    return db.get().get(uid, date);
+    return db.get_by_id(uid, date);
 }
 
 bool pw_store_api_cxx::pwstore_api::remove(
-    std::vector<pw_store::data_type::id_type> &uids)
+    const std::vector<pw_store::data_type::id_type> &uids)
 {
-    if(!state)
+    if(!state || !db.load())
         return false;
 
-    if(uids.size() == 1) {
-        if(!db.get().remove(uids.front()))
-            return false;
-    } else if(uids.size() > 1) {
-        if(!db.get().remove(uids))
-            return false;
-    } else
+    // as before, nothing to remove is an error
+    if(uids.empty())
         return false;
 
-    return true;
+    return db.get().remove(uids);
 }
 
 bool
@@ -195,7 +424,7 @@ bool pw_store_api_cxx::pwstore_api::gen_passwd(const std::string &username,
     pw_store::data_type date;
     date.username = username;
     date.url_string = url_string;
-    if(!generate_pw(date.password, ascii_set))
+    if(!generate_pw(date.password, ascii_set) || !db.load())
         return false;
 
     if(!db.get().insert(date)) {
@@ -208,11 +437,9 @@ bool pw_store_api_cxx::pwstore_api::gen_passwd(const std::string &username,
     return true;
 }
 
-bool pw_store_api_cxx::pwstore_api::dump(
-    std::list<std::tuple<pw_store::data_type::id_type, pw_store::data_type>> &
-        content) const
+bool pw_store_api_cxx::pwstore_api::dump(pw_store::result_type &content) const
 {
-    if(!state)
+    if(!state || !db.load())
         return false;
 
     db.get().dump_db(content);
@@ -20,39 +20,71 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #define _PWSTORE_API_CXX_
 
 #include "libaan/crypto_file.hh"
+#include "journal.hh"
+#include "page_file.hh"
 #include "pwstore.hh"
 #include <memory>
+#include <utility>
+#include <vector>
 
 namespace pw_store_api_cxx
 {
+// Databases are stored as pw_store::page_file. Files written by older
+// versions with libaan::crypto::file are still read and converted by the
+// next sync.
+// Opening a page file decrypts only its page table and the journal, the
+// records are decrypted by the first load(). Until then get_by_id()
+// decrypts the one page holding the record.
+// Only ids are indexed per page, there is no (url, user) to page index:
+// lookups match substrings, fuzzy keys and queries on any column, which an
+// index of whole keys cannot narrow down to pages. Every lookup calls
+// load() and decrypts all pages.
+// The database file is only rewritten as a whole if there is no journal yet,
+// after a password change and once the journal grew too large. Other syncs
+// append the changes to the journal db_file + ".journal", see
+// pw_store::journal.
 class encrypted_pwstore
 {
 public:
     // open/create database in file db_file.
     encrypted_pwstore(const std::string &db_file, const std::string &password)
-        : crypto_file(new libaan::crypto::file::crypto_file(db_file)),
-          password(password)
+        : file(db_file),
+          crypto_file(new libaan::crypto::file::crypto_file(db_file)),
+          pages(new pw_store::page_file(db_file)),
+          journal(new pw_store::journal(db_file + ".journal")),
+          password(password), rewrite(true), opened(false), exists(false)
     {
         locked = true;
-        db = load_db();
+        opened = open_db();
     }
 
     ~encrypted_pwstore()
     {
         std::fill(std::begin(password), std::end(password), 0);
+        close_db();
     }
 
     // better check this before using get() method
-    operator bool() const { return db != 0; }
+    operator bool() const { return opened; }
 
     // next call to sync will reencrypt the database with the new password
-    void change_password(const std::string &pw) { password.assign(pw); }
+    void change_password(const std::string &pw)
+    {
+        password.assign(pw);
+        rewrite = true;
+    }
 
     bool sync() { return sync_and_write_db(); }
 
-    // better don't call these
+    // Decrypt and parse all records, if that did not happen yet. Returns
+    // false on a corrupt file.
+    bool load() const;
+    // better don't call these, and only after load()
     pw_store::database &get() { return *db; }
     const pw_store::database &get() const { return *db; }
+    // Same as get().get(id, date), without load().
+    bool get_by_id(const pw_store::data_type::id_type &id,
+                   pw_store::data_type &date) const;
 
     // All changes will be discarded. If state of database was modified
     // sync() should be called before.
@@ -65,24 +97,44 @@ public:
             return false;
         return db->is_dirty();
     }
-    std::string
-    time_of_last_write() const
-    {
-        if(!crypto_file)
-            return "";
-        return crypto_file->time_of_last_write();
-    }
-    bool empty() const { return crypto_file->get_decrypted_buffer().length() == 0; }
+    // includes appends to the journal
+    std::string time_of_last_write() const;
+    // true for a new database
+    bool empty() const { return !exists; }
+
+    // The whole database is written again, once the journal is larger
+    // than this fraction of the database.
+    static const std::size_t compaction_ratio = 2;
+    static const std::size_t min_compaction_size = 64 * 1024;
 
 private:
+    // check the password, read the journal
+    bool open_db();
+    void close_db();
+    // database file written with libaan::crypto::file
+    bool open_crypto_file();
     bool sync_and_write_db();
-    std::unique_ptr<pw_store::database> load_db();
+    // write the whole database and start a new journal
+    bool write_db();
 
 private:
+    std::string file;
     std::unique_ptr<libaan::crypto::file::crypto_file> crypto_file;
-    std::unique_ptr<pw_store::database> db;
+    std::unique_ptr<pw_store::page_file> pages;
+    std::unique_ptr<pw_store::journal> journal;
+    // plaintext the records point into
+    mutable pw_store::secure_buffer buffer;
+    mutable std::unique_ptr<pw_store::database> db;
+    // segments of the journal read by open_db() until load()
+    mutable pw_store::secure_arena changes_arena;
+    mutable std::vector<std::pair<const char *, std::size_t>> changes;
     std::string password;
     bool locked;
+    // next sync has to write the whole database
+    bool rewrite;
+    bool opened;
+    // the database file existed
+    bool exists;
 };
 
 class pwstore_api
@@ -95,15 +147,24 @@ public:
     }
 
     bool add(const pw_store::data_type &date);
+    // bulk insert, e.g. for imports from an input file.
+    bool add(const std::list<pw_store::data_type> &dates);
     // lookup all entries matching lookup_key or an uid from uids. either of
-    // them may be empty.
-    bool lookup(std::list<std::tuple<pw_store::data_type::id_type,
-                                     pw_store::data_type>> &matches,
-                const std::string &lookup_key,
-                const std::vector<pw_store::data_type::id_type> &uids);
+    // them may be empty. Unless mode is fuzzy lookup_key may be a query like
+    // "url:x -user:y", see pw_store::database::lookup.
+    // Call this again with the extended key on every key press: results of
+    // the previous key are narrowed instead of searching the whole database.
+    // Results reference the database, see pw_store::match_type.
+    // Fuzzy lookups are ranked, best match first.
+    bool lookup(pw_store::result_type &matches, const std::string &lookup_key,
+                const std::vector<pw_store::data_type::id_type> &uids,
+                pw_store::match_mode mode = pw_store::match_mode::exact);
     bool get(const pw_store::data_type::id_type &uid,
              pw_store::data_type &date);
-    bool remove(std::vector<pw_store::data_type::id_type> &uids);
+    // All uids are removed in one pass, see pw_store::database::remove.
+    // Returns false without removing anything if uids is empty or one of
+    // them does not exist.
+    bool remove(const std::vector<pw_store::data_type::id_type> &uids);
 
     bool change_password(const std::string &new_password);
 
@@ -117,8 +178,7 @@ public:
     bool gen_passwd(const std::string &username, const std::string &url_string,
                     std::string &password, bool insert_generated = true,
                     const std::string &ascii_set = "");
-    bool dump(std::list<std::tuple<pw_store::data_type::id_type,
-                                   pw_store::data_type>> &content) const;
+    bool dump(pw_store::result_type &content) const;
 
     bool sync();
     void lock();
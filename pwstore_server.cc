@@ -0,0 +1,445 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include "pwstore_server.hh"
+
+#include <cstring>
+#include <iostream>
+
+#include "crypto_segment.hh"
+#include "local_socket.hh"
+#include "secure_arena.hh"
+
+namespace
+{
+const char LOOKUP = 'l';
+const char GET = 'g';
+const char ADD = 'a';
+const char REMOVE = 'r';
+const char UNLOCK = 'u';
+const char OK = '+';
+const char FAILED = '-';
+const char LOCKED = 'L';
+const std::size_t HEADER_SIZE = 5;
+// no request comes close to this
+const std::uint32_t MAX_PAYLOAD_SIZE = 1 << 20;
+// The first request after unlocking decrypts the whole database.
+const int RESPONSE_TIMEOUT_MS = 60 * 1000;
+
+void wipe_string(std::string &s)
+{
+    if(!s.empty())
+        pw_store::wipe(&s[0], s.size());
+    s.clear();
+}
+
+void put_string(std::string &out, const char *data, std::size_t size)
+{
+    pw_store::put_u32(out, size);
+    out.append(data, size);
+}
+
+void put_string(std::string &out, const std::string &s)
+{
+    put_string(out, s.data(), s.size());
+}
+
+void put_ids(std::string &out,
+             const std::vector<pw_store::data_type::id_type> &ids)
+{
+    pw_store::put_u32(out, ids.size());
+    for(const auto id : ids)
+        pw_store::put_u64(out, id);
+}
+
+// Reads the fields of a payload. Reading past its end fails.
+class payload_reader
+{
+public:
+    explicit payload_reader(const std::string &payload)
+        : p(payload.data()), end(payload.data() + payload.size())
+    {
+    }
+
+    bool u8(unsigned char &v)
+    {
+        if(end - p < 1)
+            return false;
+        v = static_cast<unsigned char>(*p++);
+        return true;
+    }
+    bool u32(std::uint32_t &v)
+    {
+        if(end - p < 4)
+            return false;
+        v = pw_store::get_u32(p);
+        p += 4;
+        return true;
+    }
+    bool u64(std::uint64_t &v)
+    {
+        if(end - p < 8)
+            return false;
+        v = pw_store::get_u64(p);
+        p += 8;
+        return true;
+    }
+    bool string(std::string &s)
+    {
+        std::uint32_t size;
+        if(!u32(size) || static_cast<std::size_t>(end - p) < size)
+            return false;
+        s.assign(p, size);
+        p += size;
+        return true;
+    }
+    bool ids(std::vector<pw_store::data_type::id_type> &ids)
+    {
+        std::uint32_t count;
+        if(!u32(count) || static_cast<std::size_t>(end - p) / 8 < count)
+            return false;
+        ids.resize(count);
+        for(auto &id : ids)
+            u64(id);
+        return true;
+    }
+    bool done() const { return p == end; }
+
+private:
+    const char *p;
+    const char *end;
+};
+
+bool send_message(int fd, char type, const std::string &payload)
+{
+    std::string header(1, type);
+    pw_store::put_u32(header, payload.size());
+    return pw_store::send_all(fd, header.data(), header.size()) &&
+           pw_store::send_all(fd, payload.data(), payload.size());
+}
+
+bool receive_message(int fd, char &type, std::string &payload,
+                     int timeout_ms = 1000)
+{
+    char header[HEADER_SIZE];
+    if(!pw_store::receive_all(fd, header, sizeof(header), timeout_ms))
+        return false;
+    const auto size = pw_store::get_u32(header + 1);
+    if(size > MAX_PAYLOAD_SIZE)
+        return false;
+    type = header[0];
+    payload.resize(size);
+    return !size || pw_store::receive_all(fd, &payload[0], size);
+}
+}
+
+pw_store_api_cxx::pwstore_server::pwstore_server(
+    pwstore_api &db, const std::string &socket_path, std::time_t lock_timeout)
+    : db(db), path(socket_path), lock_timeout(lock_timeout),
+      last_request(std::time(nullptr)), listener(-1)
+{
+}
+
+pw_store_api_cxx::pwstore_server::~pwstore_server()
+{
+    for(auto &c : connections)
+        close_connection(c);
+    if(listener < 0)
+        return;
+    pw_store::close_socket(listener);
+    pw_store::remove_socket(path);
+}
+
+bool pw_store_api_cxx::pwstore_server::listen()
+{
+    listener = pw_store::listen_socket(path);
+    return listener >= 0;
+}
+
+bool pw_store_api_cxx::pwstore_server::run()
+{
+    if(listener < 0 && !listen())
+        return false;
+
+    pw_store::catch_stop_signals();
+    last_request = std::time(nullptr);
+    std::vector<int> fds;
+    std::vector<bool> ready;
+    while(!pw_store::stop_signal_caught()) {
+        // the listener last, the connections keep their index
+        fds.clear();
+        for(const auto &c : connections)
+            fds.push_back(c.fd);
+        if(connections.size() < max_connections)
+            fds.push_back(listener);
+        pw_store::wait_readable(fds, 1000, ready);
+
+        const std::time_t now = std::time(nullptr);
+        std::size_t kept = 0;
+        for(std::size_t i = 0; i < connections.size(); i++) {
+            auto &c = connections[i];
+            if(ready[i] ? !serve(c) : now - c.last_request > idle_timeout) {
+                close_connection(c);
+                continue;
+            }
+            if(kept != i)
+                connections[kept] = std::move(c);
+            kept++;
+        }
+        const bool new_connection = fds.size() > connections.size() &&
+                                    ready[connections.size()];
+        connections.resize(kept);
+        if(new_connection) {
+            const int fd = pw_store::accept_connection(listener, 0);
+            if(fd >= 0)
+                connections.push_back({fd, std::string(), now});
+        }
+
+        // lock db after a fixed time
+        if(!db.locked() && std::time(nullptr) - last_request > lock_timeout) {
+            db.lock();
+            std::cerr << "Database locked after " << lock_timeout
+                      << " seconds of inactivity.\n";
+        }
+    }
+    return true;
+}
+
+bool pw_store_api_cxx::pwstore_server::serve(connection &c)
+{
+    if(!pw_store::receive_available(c.fd, c.received))
+        return false;
+
+    std::size_t used = 0;
+    std::string request;
+    std::string response;
+    bool open = true;
+    while(open && c.received.size() - used >= HEADER_SIZE) {
+        const char *const header = c.received.data() + used;
+        const auto size = pw_store::get_u32(header + 1);
+        if(size > MAX_PAYLOAD_SIZE) {
+            open = false;
+            break;
+        }
+        if(c.received.size() - used - HEADER_SIZE < size)
+            break;
+        const char op = header[0];
+        request.assign(header + HEADER_SIZE, size);
+        used += HEADER_SIZE + size;
+
+        last_request = c.last_request = std::time(nullptr);
+        response.clear();
+        const char status = db.locked() && op != UNLOCK
+                                ? LOCKED
+                                : answer(op, request, response);
+        if(status != OK)
+            response.clear();
+        open = send_message(c.fd, status, response);
+        wipe_string(request);
+        wipe_string(response);
+    }
+
+    // Requests may carry passwords, keep no copy of the answered ones.
+    if(used) {
+        const std::size_t left = c.received.size() - used;
+        std::memmove(&c.received[0], &c.received[used], left);
+        pw_store::wipe(&c.received[left], used);
+        c.received.resize(left);
+    }
+    return open;
+}
+
+void pw_store_api_cxx::pwstore_server::close_connection(connection &c)
+{
+    wipe_string(c.received);
+    pw_store::close_socket(c.fd);
+    c.fd = -1;
+}
+
+char pw_store_api_cxx::pwstore_server::answer(char op,
+                                              const std::string &request,
+                                              std::string &response)
+{
+    payload_reader in(request);
+    switch(op) {
+    case LOOKUP: {
+        unsigned char mode;
+        std::string key;
+        std::vector<pw_store::data_type::id_type> ids;
+        if(!in.u8(mode) ||
+           mode > static_cast<unsigned char>(pw_store::match_mode::fuzzy) ||
+           !in.string(key) || !in.ids(ids) || !in.done())
+            return FAILED;
+        pw_store::result_type matches;
+        if(!db.lookup(matches, key, ids,
+                      static_cast<pw_store::match_mode>(mode)))
+            return FAILED;
+        pw_store::put_u32(response, matches.size());
+        for(const auto &m : matches) {
+            pw_store::put_u64(response, m.id);
+            put_string(response, m.url_string.data, m.url_string.size);
+            put_string(response, m.username.data, m.username.size);
+        }
+        return OK;
+    }
+    case GET: {
+        pw_store::data_type::id_type id;
+        pw_store::data_type date;
+        if(!in.u64(id) || !in.done() || !db.get(id, date))
+            return FAILED;
+        put_string(response, date.url_string);
+        put_string(response, date.username);
+        put_string(response, date.password);
+        wipe_string(date.password);
+        return OK;
+    }
+    case ADD: {
+        pw_store::data_type date;
+        const bool added = in.string(date.url_string) &&
+                           in.string(date.username) &&
+                           in.string(date.password) && in.done() &&
+                           db.add(date) && db.sync();
+        wipe_string(date.password);
+        return added ? OK : FAILED;
+    }
+    case REMOVE: {
+        std::vector<pw_store::data_type::id_type> ids;
+        return in.ids(ids) && in.done() && db.remove(ids) && db.sync()
+                   ? OK
+                   : FAILED;
+    }
+    case UNLOCK: {
+        std::string password;
+        const bool unlocked = in.string(password) && in.done() &&
+                              (!db.locked() || db.unlock(password));
+        wipe_string(password);
+        return unlocked ? OK : FAILED;
+    }
+    default:
+        return FAILED;
+    }
+}
+
+pw_store_api_cxx::pwstore_client::~pwstore_client()
+{
+    pw_store::close_socket(fd);
+}
+
+pw_store_api_cxx::pwstore_client::status
+pw_store_api_cxx::pwstore_client::request(char op, const std::string &payload,
+                                          std::string &response)
+{
+    // The server closes idle connections.
+    if(fd >= 0 && pw_store::peer_closed(fd)) {
+        pw_store::close_socket(fd);
+        fd = -1;
+    }
+    if(fd < 0 && (fd = pw_store::connect_socket(path)) < 0)
+        return status::unreachable;
+    char type;
+    if(!send_message(fd, op, payload) ||
+       !receive_message(fd, type, response, RESPONSE_TIMEOUT_MS)) {
+        pw_store::close_socket(fd);
+        fd = -1;
+        return status::unreachable;
+    }
+    if(type == LOCKED)
+        return status::locked;
+    return type == OK ? status::ok : status::failed;
+}
+
+pw_store_api_cxx::pwstore_client::status
+pw_store_api_cxx::pwstore_client::lookup(
+    const std::string &lookup_key,
+    const std::vector<pw_store::data_type::id_type> &uids,
+    pw_store::match_mode mode, std::vector<match> &matches)
+{
+    std::string payload(1, static_cast<char>(mode));
+    put_string(payload, lookup_key);
+    put_ids(payload, uids);
+    std::string response;
+    const auto s = request(LOOKUP, payload, response);
+    if(s != status::ok)
+        return s;
+
+    payload_reader in(response);
+    std::uint32_t count;
+    if(!in.u32(count))
+        return status::failed;
+    for(std::uint32_t i = 0; i < count; i++) {
+        match m;
+        if(!in.u64(m.first) || !in.string(m.second.url_string) ||
+           !in.string(m.second.username))
+            return status::failed;
+        matches.push_back(m);
+    }
+    return status::ok;
+}
+
+pw_store_api_cxx::pwstore_client::status
+pw_store_api_cxx::pwstore_client::get(const pw_store::data_type::id_type &uid,
+                                      pw_store::data_type &date)
+{
+    std::string payload;
+    pw_store::put_u64(payload, uid);
+    std::string response;
+    auto s = request(GET, payload, response);
+    if(s == status::ok) {
+        payload_reader in(response);
+        if(!in.string(date.url_string) || !in.string(date.username) ||
+           !in.string(date.password))
+            s = status::failed;
+    }
+    wipe_string(response);
+    return s;
+}
+
+pw_store_api_cxx::pwstore_client::status
+pw_store_api_cxx::pwstore_client::add(const pw_store::data_type &date)
+{
+    std::string payload;
+    put_string(payload, date.url_string);
+    put_string(payload, date.username);
+    put_string(payload, date.password);
+    std::string response;
+    const auto s = request(ADD, payload, response);
+    wipe_string(payload);
+    return s;
+}
+
+pw_store_api_cxx::pwstore_client::status
+pw_store_api_cxx::pwstore_client::remove(
+    const std::vector<pw_store::data_type::id_type> &uids)
+{
+    std::string payload;
+    put_ids(payload, uids);
+    std::string response;
+    return request(REMOVE, payload, response);
+}
+
+pw_store_api_cxx::pwstore_client::status
+pw_store_api_cxx::pwstore_client::unlock(const std::string &password)
+{
+    std::string payload;
+    put_string(payload, password);
+    std::string response;
+    const auto s = request(UNLOCK, payload, response);
+    wipe_string(payload);
+    return s;
+}
@@ -0,0 +1,131 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef _PWSTORE_SERVER_HH_
+#define _PWSTORE_SERVER_HH_
+
+#include <ctime>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "pwstore_api_cxx.hh"
+
+namespace pw_store_api_cxx
+{
+
+// Serves an opened pwstore_api to other processes of the user over a local
+// socket (see local_socket.hh), so they skip password, decryption and
+// parsing: records and search index stay in memory between requests.
+// A connection carries any number of requests, answered in order:
+//   request = OP SIZE PAYLOAD
+//   response = STATUS SIZE PAYLOAD
+// with SIZE the 32 bit size of the payload. Integers are little endian,
+// strings are stored as 32 bit SIZE followed by the bytes.
+//   OP   payload                   response payload
+//   'l'  MODE KEY COUNT ID*        COUNT (ID URL USER)*
+//   'g'  ID                        URL USER PASSWORD
+//   'a'  URL USER PASSWORD
+//   'r'  COUNT ID*
+//   'u'  PASSWORD
+// MODE is a pw_store::match_mode, ids are 64 bit. STATUS is '+' for
+// success and '-' for failure. Like in interactive mode the database is
+// locked after lock_timeout seconds without requests, then every request
+// but 'u' is answered with 'L'. An empty password unlocks with the key
+// agent, see key_agent.hh.
+// Changes are synced before they are acknowledged.
+// All connections are polled together with the listening socket and
+// requests are answered once they are complete, so an idle or slow client
+// does not hold up the others. Connections without requests for
+// idle_timeout seconds are closed.
+class pwstore_server
+{
+public:
+    pwstore_server(pwstore_api &db, const std::string &socket_path,
+                   std::time_t lock_timeout);
+    ~pwstore_server();
+    pwstore_server(const pwstore_server &) = delete;
+    pwstore_server &operator=(const pwstore_server &) = delete;
+
+    bool listen();
+    // Serve requests until SIGTERM or SIGINT.
+    bool run();
+
+    static const std::time_t idle_timeout = 60;
+    // more connections wait until others are closed
+    static const std::size_t max_connections = 64;
+
+private:
+    struct connection
+    {
+        int fd;
+        // bytes of requests not answered yet
+        std::string received;
+        std::time_t last_request;
+    };
+    // Read what c sent and answer its complete requests. false if c has to
+    // be closed.
+    bool serve(connection &c);
+    char answer(char op, const std::string &request, std::string &response);
+    void close_connection(connection &c);
+
+    pwstore_api &db;
+    std::string path;
+    std::time_t lock_timeout;
+    std::time_t last_request;
+    int listener;
+    std::vector<connection> connections;
+};
+
+// Client of pwstore_server. The connection is kept for following requests.
+class pwstore_client
+{
+public:
+    enum class status { ok, failed, locked, unreachable };
+    // a record without password
+    using match = std::pair<pw_store::data_type::id_type, pw_store::data_type>;
+
+    explicit pwstore_client(const std::string &socket_path)
+        : path(socket_path), fd(-1)
+    {
+    }
+    ~pwstore_client();
+    pwstore_client(const pwstore_client &) = delete;
+    pwstore_client &operator=(const pwstore_client &) = delete;
+
+    // see pwstore_api
+    status lookup(const std::string &lookup_key,
+                  const std::vector<pw_store::data_type::id_type> &uids,
+                  pw_store::match_mode mode, std::vector<match> &matches);
+    status get(const pw_store::data_type::id_type &uid,
+               pw_store::data_type &date);
+    status add(const pw_store::data_type &date);
+    status remove(const std::vector<pw_store::data_type::id_type> &uids);
+    status unlock(const std::string &password);
+
+private:
+    status request(char op, const std::string &payload,
+                   std::string &response);
+
+    std::string path;
+    int fd;
+};
+}
+
+#endif
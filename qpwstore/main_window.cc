@@ -67,6 +67,7 @@ main_window::main_window(QWidget *parent, const std::string &default_db)
     list->setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
 
     line_edit = new QLineEdit();
+    line_edit->setPlaceholderText("filter, e.g. mail or url:mail -user:test");
     create_button = new QPushButton("&create");
     open_button = new QPushButton("&open");
     exit_button = new QPushButton("&exit");
@@ -108,6 +109,15 @@ main_window::main_window(QWidget *parent, const std::string &default_db)
     layout->addWidget(show_all, 0, 3, 1, 1);
     show_all->hide();
 
+    fuzzy = new QCheckBox("fu&zzy");
+    connect(fuzzy, &QCheckBox::stateChanged, [&](int state) {
+        fuzzy_checked = state == Qt::Checked;
+        update_list_from_db();
+    });
+    fuzzy->setCheckState(fuzzy_checked ? Qt::Checked : Qt::Unchecked);
+    layout->addWidget(fuzzy, 1, 3, 1, 1);
+    fuzzy->hide();
+
     // edit mode stuff
     edit_mode = new QPushButton("&edit..");
     add_entry = new QPushButton("&Add Entry");
@@ -236,6 +246,7 @@ void main_window::open_db(const std::string &db_file)
         lock_button->show();
         sync_button->show();
         show_all->show();
+        fuzzy->show();
         create_button->hide();
 
         line_edit->show();
@@ -298,15 +309,12 @@ void main_window::exit_pressed()
 }
 namespace
 {
-void add_all_to_list(
-    const std::list<
-        std::tuple<pw_store::data_type::id_type, pw_store::data_type>> &content,
-    QListWidget *list)
+void add_all_to_list(const pw_store::result_type &content, QListWidget *list)
 {
     for(const auto &c : content) {
-        list_entry *item = new list_entry(list, std::get<0>(c));
-        item->setText(QString::fromStdString(std::to_string(std::get<0>(c)) +
-                                             std::get<1>(c).to_string()));
+        list_entry *item = new list_entry(list, c.id);
+        item->setText(
+            QString::fromStdString(std::to_string(c.id) + c.to_string()));
         list->addItem(item);
     }
 }
@@ -329,17 +337,17 @@ void main_window::update_list_from_db()
     if(filter_string.empty()) {
         // No filter input from user. Show all by default?
         if(show_all_checked) {
-            std::list<std::tuple<pw_store::data_type::id_type,
-                                 pw_store::data_type>> content;
+            pw_store::result_type content;
             db->dump(content);
             add_all_to_list(content, list);
         }
         return;
     }
 
-    std::list<std::tuple<pw_store::data_type::id_type, pw_store::data_type>>
-    matches;
-    db->lookup(matches, filter_string, {});
+    pw_store::result_type matches;
+    db->lookup(matches, filter_string, {},
+               fuzzy_checked ? pw_store::match_mode::fuzzy
+                             : pw_store::match_mode::exact);
     add_all_to_list(matches, list);
 }
 
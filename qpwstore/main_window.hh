@@ -71,6 +71,9 @@ private:
 
     QCheckBox *show_all;
     bool show_all_checked = false;
+    // ranked fuzzy matching instead of substrings
+    QCheckBox *fuzzy;
+    bool fuzzy_checked = false;
 
     // edit mode stuff
     QPushButton *edit_mode;
@@ -11,11 +11,11 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 TARGET = qpwstore
 TEMPLATE = app
 
-HEADERS += key_handler.hh list_entry.hh main_window.hh ../pwstore.hh ../pwstore_api_cxx.hh
-SOURCES += key_handler.cc list_entry.cc main.cc main_window.cc ../pwstore.cc ../pwstore_api_cxx.cc
+HEADERS += key_handler.hh list_entry.hh main_window.hh ../pwstore.hh ../pwstore_api_cxx.hh ../key_column.hh ../secure_arena.hh ../simd_find.hh ../suffix_index.hh ../trigram_index.hh ../thread_pool.hh ../fuzzy_match.hh ../query.hh ../crypto_segment.hh ../journal.hh ../page_file.hh ../stats.hh
+SOURCES += key_handler.cc list_entry.cc main.cc main_window.cc ../pwstore.cc ../pwstore_api_cxx.cc ../key_column.cc ../secure_arena.cc ../simd_find.cc ../suffix_index.cc ../trigram_index.cc ../thread_pool.cc ../fuzzy_match.cc ../query.cc ../crypto_segment.cc ../journal.cc ../page_file.cc ../stats.cc
 
 CONFIG += c++11
-LIBS += -lssl -lcrypto
+LIBS += -lssl -lcrypto -pthread
 
 win32 {
 LIBS += -lgdi32 -lws2_32
@@ -0,0 +1,337 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include "query.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+
+struct pw_store::query::token
+{
+    enum { word, open, close, minus, op_and, op_or, op_not } type;
+    field where;
+    std::string text;
+};
+
+namespace
+{
+const std::string URL_PREFIX = "url:";
+const std::string USER_PREFIX = "user:";
+
+bool is_space(char c) { return std::isspace(static_cast<unsigned char>(c)); }
+
+bool starts_with(const std::string &s, std::size_t pos,
+                 const std::string &prefix)
+{
+    return !s.compare(pos, prefix.size(), prefix);
+}
+}
+
+bool pw_store::query::is_query(const std::string &key)
+{
+    // Look at the start of every word only: "a-b" or "mailto:x" stay plain.
+    for(std::size_t i = 0; i < key.size(); i++) {
+        if(i && !is_space(key[i - 1]))
+            continue;
+        if(key[i] == '(' ||
+           (key[i] == '-' && i + 1 < key.size() && !is_space(key[i + 1])) ||
+           starts_with(key, i, URL_PREFIX) || starts_with(key, i, USER_PREFIX))
+            return true;
+        for(const std::string op : {"AND", "OR", "NOT"})
+            if(starts_with(key, i, op) &&
+               (i + op.size() == key.size() || is_space(key[i + op.size()])))
+                return true;
+    }
+    return false;
+}
+
+bool pw_store::query::compile(const std::string &text, bool ignore_case,
+                              std::string &error)
+{
+    nodes.clear();
+    anchor_term.clear();
+    folded = ignore_case;
+
+    std::vector<token> tokens;
+    std::size_t i = 0;
+    while(i < text.size()) {
+        if(is_space(text[i])) {
+            i++;
+            continue;
+        }
+        if(text[i] == '(' || text[i] == ')') {
+            tokens.push_back(
+                {text[i] == '(' ? token::open : token::close, field::either,
+                 std::string()});
+            i++;
+            continue;
+        }
+        if(text[i] == '-' && i + 1 < text.size() && !is_space(text[i + 1])) {
+            tokens.push_back({token::minus, field::either, std::string()});
+            i++;
+            continue;
+        }
+
+        token t{token::word, field::either, std::string()};
+        if(starts_with(text, i, URL_PREFIX)) {
+            t.where = field::url;
+            i += URL_PREFIX.size();
+        } else if(starts_with(text, i, USER_PREFIX)) {
+            t.where = field::user;
+            i += USER_PREFIX.size();
+        }
+        if(i < text.size() && text[i] == '"') {
+            const auto end = text.find('"', i + 1);
+            if(end == std::string::npos) {
+                error = "missing closing quote";
+                return false;
+            }
+            t.text = text.substr(i + 1, end - i - 1);
+            i = end + 1;
+        } else {
+            const auto begin = i;
+            while(i < text.size() && !is_space(text[i]) && text[i] != ')')
+                i++;
+            t.text = text.substr(begin, i - begin);
+            if(t.where == field::either) {
+                if(t.text == "AND")
+                    t.type = token::op_and;
+                else if(t.text == "OR")
+                    t.type = token::op_or;
+                else if(t.text == "NOT")
+                    t.type = token::op_not;
+            }
+        }
+        if(t.type == token::word && t.text.empty()) {
+            error = "empty term";
+            return false;
+        }
+        if(ignore_case)
+            t.text = fold_case(t.text);
+        tokens.push_back(t);
+    }
+
+    std::size_t pos = 0;
+    if(tokens.empty()) {
+        error = "empty query";
+        return false;
+    }
+    if(!parse_or(tokens, pos, root, error))
+        return false;
+    if(pos != tokens.size()) {
+        error = "unexpected ')'";
+        return false;
+    }
+
+    order(root);
+    const auto &r = nodes[root];
+    if(r.type == node::term)
+        anchor_term = r.text;
+    else if(r.type == node::all) {
+        // ordered, the first term is the most selective
+        for(const auto child : r.children)
+            if(nodes[child].type == node::term) {
+                anchor_term = nodes[child].text;
+                break;
+            }
+    }
+    return true;
+}
+
+std::size_t pw_store::query::add(const node &n)
+{
+    nodes.push_back(n);
+    return nodes.size() - 1;
+}
+
+// or = and ("OR" and)*
+bool pw_store::query::parse_or(const std::vector<token> &tokens,
+                               std::size_t &pos, std::size_t &result,
+                               std::string &error)
+{
+    std::size_t first;
+    if(!parse_and(tokens, pos, first, error))
+        return false;
+    if(pos == tokens.size() || tokens[pos].type != token::op_or) {
+        result = first;
+        return true;
+    }
+
+    node any{node::any, field::either, std::string(), {first}};
+    while(pos < tokens.size() && tokens[pos].type == token::op_or) {
+        std::size_t next;
+        if(!parse_and(tokens, ++pos, next, error))
+            return false;
+        any.children.push_back(next);
+    }
+    result = add(any);
+    return true;
+}
+
+// and = unary (["AND"] unary)*
+bool pw_store::query::parse_and(const std::vector<token> &tokens,
+                                std::size_t &pos, std::size_t &result,
+                                std::string &error)
+{
+    node all{node::all, field::either, std::string(), {}};
+    while(true) {
+        std::size_t next;
+        if(!parse_unary(tokens, pos, next, error))
+            return false;
+        // (a b) c is a b c
+        if(nodes[next].type == node::all)
+            all.children.insert(std::end(all.children),
+                                std::begin(nodes[next].children),
+                                std::end(nodes[next].children));
+        else
+            all.children.push_back(next);
+
+        if(pos == tokens.size() || tokens[pos].type == token::close ||
+           tokens[pos].type == token::op_or)
+            break;
+        if(tokens[pos].type == token::op_and)
+            pos++;
+    }
+    result = all.children.size() == 1 ? all.children.front() : add(all);
+    return true;
+}
+
+// unary = ("NOT" | "-") unary | "(" or ")" | term
+bool pw_store::query::parse_unary(const std::vector<token> &tokens,
+                                  std::size_t &pos, std::size_t &result,
+                                  std::string &error)
+{
+    if(pos == tokens.size()) {
+        error = "missing term at the end";
+        return false;
+    }
+    const auto &t = tokens[pos++];
+    switch(t.type) {
+    case token::word:
+        result = add({node::term, t.where, t.text, {}});
+        return true;
+    case token::minus:
+    case token::op_not: {
+        std::size_t negated;
+        if(!parse_unary(tokens, pos, negated, error))
+            return false;
+        result = add({node::negate, field::either, std::string(), {negated}});
+        return true;
+    }
+    case token::open:
+        if(!parse_or(tokens, pos, result, error))
+            return false;
+        if(pos == tokens.size() || tokens[pos].type != token::close) {
+            error = "missing ')'";
+            return false;
+        }
+        pos++;
+        return true;
+    case token::close:
+        error = "unexpected ')'";
+        return false;
+    case token::op_and:
+    case token::op_or:
+        break;
+    }
+    error = "missing term before " + t.text;
+    return false;
+}
+
+double pw_store::query::selectivity(std::size_t index) const
+{
+    const auto &n = nodes[index];
+    switch(n.type) {
+    case node::term: {
+        // Every character makes a match less likely, a term for one field
+        // matches about half as often as one for both.
+        const double share =
+            std::pow(0.5, std::min<std::size_t>(n.text.size(), 16));
+        return std::min(1.0, n.where == field::either ? 2 * share : share);
+    }
+    case node::all: {
+        double share = 1;
+        for(const auto child : n.children)
+            share *= selectivity(child);
+        return share;
+    }
+    case node::any: {
+        double share = 0;
+        for(const auto child : n.children)
+            share += selectivity(child);
+        return std::min(1.0, share);
+    }
+    case node::negate:
+        return 1 - selectivity(n.children.front());
+    }
+    return 1;
+}
+
+void pw_store::query::order(std::size_t index)
+{
+    auto &children = nodes[index].children;
+    for(const auto child : children)
+        order(child);
+
+    // AND stops at the first operand failing, OR at the first passing.
+    const bool all = nodes[index].type == node::all;
+    if(!all && nodes[index].type != node::any)
+        return;
+    std::vector<std::pair<double, std::size_t>> ranked;
+    for(const auto child : children)
+        ranked.emplace_back(all ? selectivity(child) : -selectivity(child),
+                            child);
+    std::stable_sort(std::begin(ranked), std::end(ranked),
+                     [](const std::pair<double, std::size_t> &a,
+                        const std::pair<double, std::size_t> &b) {
+                         return a.first < b.first;
+                     });
+    for(std::size_t i = 0; i < ranked.size(); i++)
+        children[i] = ranked[i].second;
+}
+
+bool pw_store::query::contains(const field_ref &f,
+                               const std::string &text) const
+{
+    return folded ? f.contains_folded(text) : f.contains(text);
+}
+
+bool pw_store::query::evaluate(std::size_t index, const record &r) const
+{
+    const auto &n = nodes[index];
+    switch(n.type) {
+    case node::term:
+        return (n.where != field::user && contains(r.url_string, n.text)) ||
+               (n.where != field::url && contains(r.username, n.text));
+    case node::all:
+        for(const auto child : n.children)
+            if(!evaluate(child, r))
+                return false;
+        return true;
+    case node::any:
+        for(const auto child : n.children)
+            if(evaluate(child, r))
+                return true;
+        return false;
+    case node::negate:
+        return !evaluate(n.children.front(), r);
+    }
+    return false;
+}
@@ -0,0 +1,94 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef _QUERY_HH_
+#define _QUERY_HH_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "pwstore.hh"
+
+namespace pw_store
+{
+
+// Field qualified lookups, e.g.
+//   url:example user:admin -url:staging
+//   (url:mail OR url:imap) AND NOT user:test
+// A term is a substring of the url (url:), the username (user:) or of
+// either without a prefix. Terms with spaces are quoted: url:"my bank".
+// Adjacent terms are ANDed, OR binds weaker than AND. NOT and a leading '-'
+// negate the following term or group.
+// The query is compiled once into a plan, which is evaluated per record
+// and field with short-circuiting. The operands of every AND are ordered
+// to run the most selective first: long terms before short ones, negations
+// and alternatives last.
+class query
+{
+public:
+    query() : root(0), folded(false) {}
+
+    // Keys without query syntax keep their meaning as a plain substring.
+    static bool is_query(const std::string &key);
+
+    // Returns false and describes the problem in error if text is no valid
+    // query. With ignore_case terms match regardless of ASCII case.
+    bool compile(const std::string &text, bool ignore_case,
+                 std::string &error);
+
+    bool matches(const record &r) const { return evaluate(root, r); }
+    bool ignores_case() const { return folded; }
+    // The most selective term every match contains in url or username,
+    // empty if there is none. Lookups search it first and evaluate the
+    // whole query only for the records containing it.
+    const std::string &anchor() const { return anchor_term; }
+
+private:
+    enum class field { url, user, either };
+    struct token;
+    struct node
+    {
+        enum { term, all, any, negate } type;
+        field where;
+        std::string text;
+        std::vector<std::size_t> children;
+    };
+
+    bool parse_or(const std::vector<token> &tokens, std::size_t &pos,
+                  std::size_t &result, std::string &error);
+    bool parse_and(const std::vector<token> &tokens, std::size_t &pos,
+                   std::size_t &result, std::string &error);
+    bool parse_unary(const std::vector<token> &tokens, std::size_t &pos,
+                     std::size_t &result, std::string &error);
+    std::size_t add(const node &n);
+    // estimated share of records passing node, lower runs first
+    double selectivity(std::size_t index) const;
+    void order(std::size_t index);
+    bool evaluate(std::size_t index, const record &r) const;
+    bool contains(const field_ref &f, const std::string &text) const;
+
+    std::vector<node> nodes;
+    std::size_t root;
+    bool folded;
+    std::string anchor_term;
+};
+}
+
+#endif
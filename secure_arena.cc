@@ -0,0 +1,153 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "secure_arena.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <new>
+#ifndef NO_GOOD
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+// one warning per process, not per arena
+std::atomic<bool> lock_warned(false);
+}
+
+void pw_store::wipe(char *p, std::size_t size)
+{
+    if(!size)
+        return;
+#ifndef NO_GOOD
+    explicit_bzero(p, size);
+#else
+    volatile char *v = p;
+    while(size--)
+        *v++ = 0;
+#endif
+}
+
+char *pw_store::secure_arena::allocate(std::size_t size)
+{
+    if(!chunks.empty() && chunks.back().size - used >= size) {
+        char *p = chunks.back().data + used;
+        used += size;
+        return p;
+    }
+
+    // records larger than a chunk get a chunk of their own
+    chunk c;
+    c.size = std::max(chunk_size, size);
+    c.locked = false;
+#ifndef NO_GOOD
+    void *p = mmap(nullptr, c.size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED)
+        throw std::bad_alloc();
+    c.data = static_cast<char *>(p);
+    c.locked = !mlock(c.data, c.size);
+    if(!c.locked && !lock_warned.exchange(true))
+        std::cerr << "Warning: could not lock memory, plaintext may be "
+                     "swapped to disk.\n";
+#ifdef MADV_DONTDUMP
+    madvise(c.data, c.size, MADV_DONTDUMP);
+#endif
+#else
+    c.data = new char[c.size]();
+#endif
+
+    chunks.push_back(c);
+    used = size;
+    return c.data;
+}
+
+void pw_store::secure_arena::reset()
+{
+    if(chunks.empty())
+        return;
+    // keep the first chunk for reuse
+    for(std::size_t i = chunks.size() - 1; i > 0; i--) {
+        unmap(chunks.back(), chunks.back().size);
+        chunks.pop_back();
+    }
+    wipe(chunks.front().data, chunks.front().size);
+    used = 0;
+}
+
+void pw_store::secure_arena::release()
+{
+    for(std::size_t i = 0; i < chunks.size(); i++)
+        unmap(chunks[i], i + 1 < chunks.size() ? chunks[i].size : used);
+    chunks.clear();
+    used = 0;
+}
+
+void pw_store::secure_arena::unmap(chunk &c, std::size_t wipe_size)
+{
+    wipe(c.data, wipe_size);
+#ifndef NO_GOOD
+    if(c.locked)
+        munlock(c.data, c.size);
+    munmap(c.data, c.size);
+#else
+    delete[] c.data;
+#endif
+}
+
+std::size_t pw_store::secure_arena::size() const
+{
+    std::size_t s = used;
+    for(std::size_t i = 0; i + 1 < chunks.size(); i++)
+        s += chunks[i].size;
+    return s;
+}
+
+void pw_store::secure_arena::swap(secure_arena &other)
+{
+    std::swap(chunk_size, other.chunk_size);
+    chunks.swap(other.chunks);
+    std::swap(used, other.used);
+}
+
+char *pw_store::secure_buffer::allocate(std::size_t size)
+{
+    // fresh chunks are zero
+    arena.release();
+    bytes = size ? arena.allocate(size) : nullptr;
+    length = size;
+    return bytes;
+}
+
+void pw_store::secure_buffer::assign(const char *p, std::size_t size)
+{
+    if(size)
+        std::memcpy(allocate(size), p, size);
+    else
+        clear();
+}
+
+void pw_store::secure_buffer::swap(secure_buffer &other)
+{
+    arena.swap(other.arena);
+    std::swap(bytes, other.bytes);
+    std::swap(length, other.length);
+}
@@ -0,0 +1,101 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _SECURE_ARENA_HH_
+#define _SECURE_ARENA_HH_
+
+#include <cstddef>
+#include <vector>
+
+namespace pw_store
+{
+
+// Overwrite size bytes at p with zeros. Unlike std::fill this is not
+// optimized away on memory that is freed afterwards.
+void wipe(char *p, std::size_t size);
+
+// Bump pointer allocator for plaintext. Memory is taken in chunks from
+// mmap, locked with mlock and excluded from core dumps where supported.
+// There is no per-allocation free: reset() and release() wipe everything at
+// once.
+class secure_arena
+{
+public:
+    explicit secure_arena(std::size_t chunk_size = 64 * 1024)
+        : chunk_size(chunk_size), used(0)
+    {
+    }
+    ~secure_arena() { release(); }
+    secure_arena(const secure_arena &) = delete;
+    secure_arena &operator=(const secure_arena &) = delete;
+
+    // Throws std::bad_alloc if no memory could be mapped.
+    char *allocate(std::size_t size);
+    // Wipe all allocations but keep the chunks for reuse.
+    void reset();
+    // Wipe all allocations and unmap the chunks.
+    void release();
+    // bytes handed out since the last reset()/release()
+    std::size_t size() const;
+    void swap(secure_arena &other);
+
+private:
+    struct chunk
+    {
+        char *data;
+        std::size_t size;
+        bool locked;
+    };
+    // wipe the first wipe_size bytes and give the chunk back
+    void unmap(chunk &c, std::size_t wipe_size);
+
+    std::size_t chunk_size;
+    std::vector<chunk> chunks;
+    // bytes used in chunks.back(). All other chunks count as full.
+    std::size_t used;
+};
+
+// Contiguous plaintext of a known size, e.g. the decrypted database, in
+// memory locked like a secure_arena. Wiped when replaced or destroyed.
+class secure_buffer
+{
+public:
+    secure_buffer() : arena(0), bytes(nullptr), length(0) {}
+    secure_buffer(const secure_buffer &) = delete;
+    secure_buffer &operator=(const secure_buffer &) = delete;
+
+    // Wipe the contents and make room for size zero bytes.
+    char *allocate(std::size_t size);
+    // Wipe the contents and copy size bytes from p.
+    void assign(const char *p, std::size_t size);
+    void clear() { allocate(0); }
+    void swap(secure_buffer &other);
+
+    char *data() { return bytes; }
+    const char *data() const { return bytes; }
+    std::size_t size() const { return length; }
+    bool empty() const { return !length; }
+
+private:
+    secure_arena arena;
+    char *bytes;
+    std::size_t length;
+};
+}
+
+#endif
@@ -0,0 +1,125 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "simd_find.hh"
+
+#include <cstring>
+
+#include "pwstore.hh"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define PWSTORE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+const char *find_scalar(const char *begin, const char *end, const char *key,
+                        std::size_t key_size)
+{
+    return pw_store::find_substring(begin, end, key, key_size);
+}
+
+#ifdef PWSTORE_X86_SIMD
+// For one character keys memchr is already vectorized.
+__attribute__((target("sse2"))) const char *
+find_sse2(const char *begin, const char *end, const char *key,
+          std::size_t key_size)
+{
+    if(key_size < 2)
+        return find_scalar(begin, end, key, key_size);
+
+    const std::size_t n = end - begin;
+    const __m128i first = _mm_set1_epi8(key[0]);
+    const __m128i last = _mm_set1_epi8(key[key_size - 1]);
+    std::size_t i = 0;
+    for(; i + key_size - 1 + 16 <= n; i += 16) {
+        const __m128i block_first = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(begin + i));
+        const __m128i block_last = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(begin + i + key_size - 1));
+        unsigned mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                          _mm_cmpeq_epi8(last, block_last)));
+        while(mask) {
+            const unsigned bit = __builtin_ctz(mask);
+            if(!std::memcmp(begin + i + bit + 1, key + 1, key_size - 2))
+                return begin + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return find_scalar(begin + i, end, key, key_size);
+}
+
+__attribute__((target("avx2"))) const char *
+find_avx2(const char *begin, const char *end, const char *key,
+          std::size_t key_size)
+{
+    if(key_size < 2)
+        return find_scalar(begin, end, key, key_size);
+
+    const std::size_t n = end - begin;
+    const __m256i first = _mm256_set1_epi8(key[0]);
+    const __m256i last = _mm256_set1_epi8(key[key_size - 1]);
+    std::size_t i = 0;
+    for(; i + key_size - 1 + 32 <= n; i += 32) {
+        const __m256i block_first = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(begin + i));
+        const __m256i block_last = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(begin + i + key_size - 1));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                             _mm256_cmpeq_epi8(last, block_last))));
+        while(mask) {
+            const unsigned bit = __builtin_ctz(mask);
+            if(!std::memcmp(begin + i + bit + 1, key + 1, key_size - 2))
+                return begin + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return find_sse2(begin + i, end, key, key_size);
+}
+#endif
+
+std::vector<pw_store::find_kernel> supported_kernels()
+{
+    std::vector<pw_store::find_kernel> kernels;
+#ifdef PWSTORE_X86_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        kernels.push_back({"avx2", find_avx2});
+    if(__builtin_cpu_supports("sse2"))
+        kernels.push_back({"sse2", find_sse2});
+#endif
+    kernels.push_back({"scalar", find_scalar});
+    return kernels;
+}
+}
+
+const char *pw_store::simd_find(const char *begin, const char *end,
+                                const char *key, std::size_t key_size)
+{
+    static const find_function best = supported_kernels().front().find;
+    return best(begin, end, key, key_size);
+}
+
+std::vector<pw_store::find_kernel> pw_store::find_kernels()
+{
+    return supported_kernels();
+}
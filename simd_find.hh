@@ -0,0 +1,50 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _SIMD_FIND_HH_
+#define _SIMD_FIND_HH_
+
+#include <cstddef>
+#include <vector>
+
+namespace pw_store
+{
+
+// Position of the first occurrence of key in [begin, end) or end.
+using find_function = const char *(*)(const char *begin, const char *end,
+                                      const char *key, std::size_t key_size);
+
+// Substring search over large buffers like the key_column. Compares the
+// first and the last character of key against 16 (SSE2) or 32 (AVX2)
+// positions at once and verifies candidates with memcmp. The kernel is
+// selected once at runtime for the cpu. Falls back to memchr + memcmp on
+// other architectures.
+const char *simd_find(const char *begin, const char *end, const char *key,
+                      std::size_t key_size);
+
+struct find_kernel
+{
+    const char *name;
+    find_function find;
+};
+
+// All kernels the cpu supports, the one used by simd_find first.
+std::vector<find_kernel> find_kernels();
+}
+
+#endif
@@ -0,0 +1,116 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include "stats.hh"
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+struct phase_total
+{
+    const char *name;
+    std::size_t calls;
+    double ms;
+    std::size_t bytes;
+    std::size_t allocations;
+};
+
+std::atomic<bool> collecting(false);
+std::mutex totals_mutex;
+// in order of the first call, there are only a few phases
+std::vector<phase_total> totals;
+
+std::atomic<std::size_t> all_allocations(0);
+thread_local std::size_t own_allocations = 0;
+}
+
+void pw_store::stats::allocated()
+{
+    if(collecting.load(std::memory_order_relaxed)) {
+        all_allocations.fetch_add(1, std::memory_order_relaxed);
+        own_allocations++;
+    }
+}
+
+void pw_store::stats::enable() { collecting = true; }
+
+bool pw_store::stats::enabled() { return collecting; }
+
+std::size_t pw_store::stats::allocations()
+{
+    return all_allocations.load(std::memory_order_relaxed);
+}
+
+std::size_t pw_store::stats::thread_allocations() { return own_allocations; }
+
+pw_store::stats::phase::phase(const char *name, std::size_t bytes)
+    : name(name), active(enabled()), processed(bytes),
+      allocations_at_start(own_allocations)
+{
+    if(active)
+        start = std::chrono::steady_clock::now();
+}
+
+pw_store::stats::phase::~phase()
+{
+    if(!active)
+        return;
+    const double ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    const auto allocated = own_allocations - allocations_at_start;
+
+    std::lock_guard<std::mutex> lock(totals_mutex);
+    auto total = std::begin(totals);
+    while(total != std::end(totals) && std::strcmp(total->name, name))
+        ++total;
+    if(total == std::end(totals))
+        total = totals.insert(total, {name, 0, 0, 0, 0});
+    total->calls++;
+    total->ms += ms;
+    total->bytes += processed;
+    total->allocations += allocated;
+}
+
+std::string pw_store::stats::to_json(const std::string &command, bool ok,
+                                     double total_ms)
+{
+    // command and phase names are plain words
+    std::ostringstream json;
+    json.precision(12);
+    json << "{\"command\": \"" << command
+         << "\", \"ok\": " << (ok ? "true" : "false")
+         << ", \"total_ms\": " << total_ms
+         << ", \"allocations\": " << allocations() << ", \"phases\": [";
+    std::lock_guard<std::mutex> lock(totals_mutex);
+    for(std::size_t i = 0; i < totals.size(); i++) {
+        const auto &t = totals[i];
+        json << (i ? ", " : "") << "{\"name\": \"" << t.name
+             << "\", \"calls\": " << t.calls << ", \"ms\": " << t.ms
+             << ", \"bytes\": " << t.bytes
+             << ", \"allocations\": " << t.allocations << "}";
+    }
+    json << "]}";
+    return json.str();
+}
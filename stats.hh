@@ -0,0 +1,75 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef _STATS_HH_
+#define _STATS_HH_
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+namespace pw_store
+{
+
+// Time spent per phase of one pwstore call (key derivation, decryption,
+// parsing, ...), for the --stats flag. Collecting is off by default, an
+// unused phase costs a branch.
+namespace stats
+{
+void enable();
+bool enabled();
+
+// allocations done with operator new since enable(), by all threads or the
+// calling one. Only counted in programs linking count_allocations.cc, which
+// replaces operator new, 0 otherwise.
+std::size_t allocations();
+std::size_t thread_allocations();
+// Count one allocation, if enabled. Called by that operator new.
+void allocated();
+
+// Adds the time from construction to destruction, the bytes passed and the
+// allocations of the thread in between to the phase name, which has to be a
+// string literal. Phases running on several threads add up, nested phases
+// count in both.
+class phase
+{
+public:
+    explicit phase(const char *name, std::size_t bytes = 0);
+    ~phase();
+    phase(const phase &) = delete;
+    phase &operator=(const phase &) = delete;
+
+    void add_bytes(std::size_t bytes) { processed += bytes; }
+
+private:
+    const char *name;
+    bool active;
+    std::size_t processed;
+    std::size_t allocations_at_start;
+    std::chrono::steady_clock::time_point start;
+};
+
+// All phases as one line of JSON:
+// {"command": C, "ok": B, "total_ms": T, "allocations": A, "phases": [
+//   {"name": N, "calls": C, "ms": T, "bytes": B, "allocations": A}, ...]}
+std::string to_json(const std::string &command, bool ok, double total_ms);
+}
+}
+
+#endif
@@ -0,0 +1,221 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "suffix_index.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+
+const std::uint32_t EMPTY = std::numeric_limits<std::uint32_t>::max();
+
+// Input text plus the unique smallest sentinel SA-IS needs at the end.
+struct sentinel_text
+{
+    std::uint32_t operator[](std::size_t i) const
+    {
+        return i < size ? static_cast<unsigned char>(text[i]) + 1 : 0;
+    }
+    const char *text;
+    std::size_t size;
+};
+
+// Reduced problem of a recursion level, stored inside the suffix array.
+struct reduced_text
+{
+    std::uint32_t operator[](std::size_t i) const { return s[i]; }
+    const std::uint32_t *s;
+};
+
+template <typename S>
+void get_buckets(const S &s, std::size_t n, std::vector<std::uint32_t> &bkt,
+                 bool end)
+{
+    std::fill(bkt.begin(), bkt.end(), 0);
+    for(std::size_t i = 0; i < n; i++)
+        bkt[s[i]]++;
+    std::uint32_t sum = 0;
+    for(auto &b : bkt) {
+        sum += b;
+        b = end ? sum : sum - b;
+    }
+}
+
+template <typename S>
+void induce(const S &s, std::uint32_t *sa, std::size_t n,
+            const std::vector<bool> &stype, std::vector<std::uint32_t> &bkt)
+{
+    get_buckets(s, n, bkt, false);
+    for(std::size_t i = 0; i < n; i++)
+        if(sa[i] != EMPTY && sa[i] > 0 && !stype[sa[i] - 1]) {
+            const auto j = sa[i] - 1;
+            sa[bkt[s[j]]++] = j;
+        }
+    get_buckets(s, n, bkt, true);
+    for(std::size_t i = n; i-- > 0;)
+        if(sa[i] != EMPTY && sa[i] > 0 && stype[sa[i] - 1]) {
+            const auto j = sa[i] - 1;
+            sa[--bkt[s[j]]] = j;
+        }
+}
+
+// SA-IS (Nong, Zhang, Chan 2009). Linear time. s[n - 1] has to be the unique
+// smallest character, all characters are < k.
+template <typename S>
+void sais(const S &s, std::uint32_t *sa, std::size_t n, std::size_t k)
+{
+    std::vector<bool> stype(n);
+    stype[n - 1] = true;
+    for(std::size_t i = n - 1; i-- > 0;)
+        stype[i] = s[i] < s[i + 1] || (s[i] == s[i + 1] && stype[i + 1]);
+    const auto is_lms = [&](std::size_t i) {
+        return i > 0 && i != EMPTY && stype[i] && !stype[i - 1];
+    };
+
+    // sort LMS substrings
+    std::vector<std::uint32_t> bkt(k);
+    get_buckets(s, n, bkt, true);
+    std::fill(sa, sa + n, EMPTY);
+    for(std::size_t i = 1; i < n; i++)
+        if(is_lms(i))
+            sa[--bkt[s[i]]] = i;
+    induce(s, sa, n, stype, bkt);
+
+    // name the sorted LMS substrings
+    std::size_t n1 = 0;
+    for(std::size_t i = 0; i < n; i++)
+        if(is_lms(sa[i]))
+            sa[n1++] = sa[i];
+    std::fill(sa + n1, sa + n, EMPTY);
+    std::uint32_t name = 0;
+    std::size_t prev = EMPTY;
+    for(std::size_t i = 0; i < n1; i++) {
+        const std::size_t pos = sa[i];
+        bool diff = false;
+        for(std::size_t d = 0; d < n; d++) {
+            if(prev == EMPTY || s[pos + d] != s[prev + d]
+               || stype[pos + d] != stype[prev + d]) {
+                diff = true;
+                break;
+            } else if(d > 0 && (is_lms(pos + d) || is_lms(prev + d)))
+                break;
+        }
+        if(diff) {
+            name++;
+            prev = pos;
+        }
+        sa[n1 + pos / 2] = name - 1;
+    }
+    for(std::size_t i = n, j = n; i-- > n1;)
+        if(sa[i] != EMPTY)
+            sa[--j] = sa[i];
+
+    // sort the reduced problem, recursively if names are not unique yet
+    std::uint32_t *s1 = sa + n - n1;
+    if(name < n1)
+        sais(reduced_text{s1}, sa, n1, name);
+    else
+        for(std::size_t i = 0; i < n1; i++)
+            sa[s1[i]] = i;
+
+    // induce the suffix array from the sorted LMS suffixes
+    for(std::size_t i = 1, j = 0; i < n; i++)
+        if(is_lms(i))
+            s1[j++] = i;
+    for(std::size_t i = 0; i < n1; i++)
+        sa[i] = s1[sa[i]];
+    std::fill(sa + n1, sa + n, EMPTY);
+    get_buckets(s, n, bkt, true);
+    for(std::size_t i = n1; i-- > 0;) {
+        const auto j = sa[i];
+        sa[i] = EMPTY;
+        sa[--bkt[s[j]]] = j;
+    }
+    induce(s, sa, n, stype, bkt);
+}
+
+void build_suffix_array(const char *text, std::size_t size,
+                        std::vector<std::uint32_t> &sa)
+{
+    sa.clear();
+    if(!size)
+        return;
+
+    // sort text + sentinel, then drop the sentinel suffix which is first.
+    sa.resize(size + 1);
+    sais(sentinel_text{text, size}, sa.data(), sa.size(), 257);
+    sa.erase(sa.begin());
+}
+}
+
+void pw_store::suffix_index::build(const key_column &keys)
+{
+    clear();
+    // EMPTY is reserved
+    if(!keys.built() || keys.text().size() >= EMPTY - 1)
+        return;
+
+    build_suffix_array(keys.text().data(), keys.text().size(), suffixes);
+    column = &keys;
+}
+
+void pw_store::suffix_index::clear()
+{
+    suffixes.clear();
+    column = nullptr;
+}
+
+bool pw_store::suffix_index::find(const std::string &key,
+                                  std::vector<std::size_t> &slots) const
+{
+    if(!column || !key_column::searchable(key))
+        return false;
+
+    const char *const text = column->text().data();
+    const auto m = key.size();
+    const auto n = column->text().size();
+    // compare the first m characters of the suffix at pos with key, like
+    // std::string::compare
+    const auto prefix_cmp = [&](std::uint32_t pos) {
+        const auto length = std::min(m, n - pos);
+        const int c = std::memcmp(text + pos, key.data(), length);
+        return c ? c : length < m ? -1 : 0;
+    };
+    const auto first = std::lower_bound(
+        suffixes.begin(), suffixes.end(), key,
+        [&](std::uint32_t pos, const std::string &) {
+            return prefix_cmp(pos) < 0;
+        });
+    const auto last = std::upper_bound(
+        first, suffixes.end(), key,
+        [&](const std::string &, std::uint32_t pos) {
+            return prefix_cmp(pos) > 0;
+        });
+
+    const auto old_size = slots.size();
+    for(auto it = first; it != last; ++it)
+        slots.push_back(column->record_at(*it));
+    std::sort(slots.begin() + old_size, slots.end());
+    slots.erase(std::unique(slots.begin() + old_size, slots.end()),
+                slots.end());
+
+    return true;
+}
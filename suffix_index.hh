@@ -0,0 +1,63 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _SUFFIX_INDEX_HH_
+#define _SUFFIX_INDEX_HH_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "key_column.hh"
+#include "pwstore.hh"
+
+namespace pw_store
+{
+
+// Suffix array over the text of a key_column, i.e. over url and username of
+// all records. Passwords are not indexed. Substring queries take O(m log n)
+// plus the number of occurrences.
+class suffix_index
+{
+public:
+    suffix_index() : column(nullptr) {}
+
+    // column has to stay unchanged until clear() is called.
+    void build(const key_column &column);
+    void clear();
+    bool built() const { return column != nullptr; }
+    // bytes allocated by the index, the column not included
+    std::size_t memory() const
+    {
+        return suffixes.capacity() * sizeof(std::uint32_t);
+    }
+
+    // Store the slots of all records with url or username containing key in
+    // slots, in ascending order. Returns false if the key can not be answered
+    // by the index, in that case the caller has to fall back to a scan.
+    bool find(const std::string &key,
+              std::vector<std::size_t> &slots) const;
+
+private:
+    const key_column *column;
+    // suffixes of column->text() in lexicographic order
+    std::vector<std::uint32_t> suffixes;
+};
+}
+
+#endif
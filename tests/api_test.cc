@@ -0,0 +1,146 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "test.hh"
+
+#include <list>
+#include <vector>
+
+#include "pwstore_api_cxx.hh"
+
+namespace
+{
+using ids_type = std::vector<pw_store::data_type::id_type>;
+const std::string PASSWORD = "api test";
+
+ids_type ids_of(const pw_store::result_type &matches)
+{
+    ids_type ids;
+    for(const auto &match : matches)
+        ids.push_back(match.id);
+    return ids;
+}
+}
+
+TEST(api_results_hold_no_passwords)
+{
+    pw_store_api_cxx::pwstore_api db(pw_store_test::temp_path("results.db"),
+                                     PASSWORD);
+    CHECK(db);
+    CHECK(db.add(pw_store::data_type("https://mail.example.com", "ann",
+                                     "secret1")));
+    CHECK(db.add(pw_store::data_type("https://shop.example.org", "bob",
+                                     "secret2")));
+    CHECK(db.add(pw_store::data_type("https://bank.test", "carl",
+                                     "secret3")));
+
+    pw_store::result_type content;
+    CHECK(db.dump(content));
+    CHECK(content.size() == 3);
+    const auto carl = content.back().id;
+
+    // key matches first, then the uids, appended to what is there
+    pw_store::result_type matches;
+    matches.emplace_back(pw_store::record());
+    CHECK(db.lookup(matches, "example", {carl}));
+    CHECK(matches.size() == 4);
+    CHECK(matches[3].id == carl && matches[3].username.str() == "carl");
+    for(const auto &match : matches)
+        CHECK(match.to_string().find("secret") == std::string::npos);
+
+    // only get decrypts the password
+    pw_store::data_type date;
+    CHECK(db.get(carl, date));
+    CHECK(date.url_string == "https://bank.test" && date.password == "secret3");
+
+    // ids stay valid across sync, the references of the results do not
+    CHECK(db.sync());
+    matches.clear();
+    CHECK(db.lookup(matches, "example", {carl}));
+    CHECK(ids_of(matches) == ids_type({content[0].id, content[1].id, carl}));
+    CHECK(matches[1].url_string.str() == "https://shop.example.org");
+    CHECK(db.get(matches[1].id, date) && date.password == "secret2");
+}
+
+TEST(api_reopen_replays_the_journal)
+{
+    const auto file = pw_store_test::temp_path("replay.db");
+    pw_store::result_type expected;
+    std::vector<std::string> passwords;
+    {
+        pw_store_api_cxx::pwstore_api db(file, PASSWORD);
+        std::list<pw_store::data_type> dates;
+        for(int i = 0; i < 3000; i++)
+            dates.emplace_back("https://host" + std::to_string(i) + ".example",
+                               "user" + std::to_string(i),
+                               "secret" + std::to_string(i));
+        CHECK(db.add(dates));
+        // the whole database
+        CHECK(db.sync());
+        // then appends to the journal
+        for(int round = 0; round < 3; round++) {
+            CHECK(db.add(pw_store::data_type(
+                "https://new.example", "round" + std::to_string(round),
+                "pw")));
+            pw_store::result_type matches;
+            CHECK(db.lookup(matches, "host" + std::to_string(round + 1),
+                            {}));
+            CHECK(db.remove(ids_of(matches)));
+            CHECK(db.sync());
+        }
+        CHECK(db.dump(expected));
+        for(const auto &match : expected) {
+            pw_store::data_type date;
+            CHECK(db.get(match.id, date));
+            passwords.push_back(date.password);
+        }
+    }
+
+    // the 2333 removals went to the journal
+    CHECK(pw_store_test::read_file(file + ".journal").size() > 25000);
+
+    pw_store_api_cxx::pwstore_api db(file, PASSWORD);
+    CHECK(db);
+    pw_store::result_type content;
+    CHECK(db.dump(content));
+    CHECK(ids_of(content) == ids_of(expected));
+    for(std::size_t i = 0; i < content.size() && i < passwords.size(); i++) {
+        pw_store::data_type date;
+        CHECK(db.get(content[i].id, date) && date.password == passwords[i]);
+    }
+}
+
+TEST(api_remove)
+{
+    pw_store_api_cxx::pwstore_api db(pw_store_test::temp_path("remove.db"),
+                                     PASSWORD);
+    for(const std::string user : {"ann", "bob", "carl", "dan"})
+        CHECK(db.add(pw_store::data_type("https://" + user + ".example", user,
+                                         "secret")));
+    pw_store::result_type content;
+    CHECK(db.dump(content));
+    const auto ids = ids_of(content);
+
+    CHECK(!db.remove({}));
+    CHECK(!db.remove({ids[0], 42}));
+    CHECK(db.remove({ids[0]}));
+    CHECK(db.remove({ids[2], ids[1]}));
+    content.clear();
+    CHECK(db.dump(content));
+    CHECK(ids_of(content) == ids_type({ids[3]}));
+}
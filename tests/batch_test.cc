@@ -0,0 +1,167 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "test.hh"
+
+#include <csignal>
+#include <iostream>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "key_agent.hh"
+#include "local_socket.hh"
+#include "pwstore_api_cxx.hh"
+
+namespace
+{
+const std::string PASSWORD = "batch test";
+
+// A database with two records and an agent in a child process holding its
+// key, so ./pwstore opens it without asking for the password.
+class agent_database
+{
+public:
+    explicit agent_database(const std::string &name)
+        : db_file(pw_store_test::temp_path(name)),
+          socket(pw_store::new_socket_path("agent")), agent(socket, 60),
+          child(-1)
+    {
+        CHECK(agent.listen());
+        // the child would print the buffered results again
+        std::cout.flush();
+        child = fork();
+        if(!child) {
+            alarm(60);
+            _exit(agent.run() ? 0 : 1);
+        }
+        CHECK(child > 0);
+
+        pw_store::agent_key_cache cache(socket);
+        pw_store::set_key_cache(&cache);
+        {
+            pw_store_api_cxx::pwstore_api db(db_file, PASSWORD);
+            CHECK(db.add(pw_store::data_type("https://mail.example.com",
+                                             "ann", "secret1")));
+            CHECK(db.add(pw_store::data_type("https://shop.example.org",
+                                             "bob", "secret2")));
+            CHECK(db.sync());
+        }
+        pw_store::set_key_cache(nullptr);
+    }
+    ~agent_database()
+    {
+        kill(child, SIGTERM);
+        int exit_status = 0;
+        CHECK(waitpid(child, &exit_status, 0) == child &&
+              WIFEXITED(exit_status) && !WEXITSTATUS(exit_status));
+    }
+
+    // run_command of ./pwstore batch with commands on stdin, stdout in
+    // output and stderr in errors.
+    int batch(const std::string &commands, std::string &output,
+              std::string &errors) const
+    {
+        const auto input = pw_store_test::temp_path("batch.in");
+        const auto error_file = pw_store_test::temp_path("batch.err");
+        pw_store_test::write_file(input, commands);
+        const int exit_code = pw_store_test::run_command(
+            "PWSTORE_AGENT_SOCK='" + socket + "' ./pwstore -f '" + db_file +
+                "' batch <'" + input + "' 2>'" + error_file + "'",
+            output);
+        errors = pw_store_test::read_file(error_file);
+        return exit_code;
+    }
+
+    const std::string db_file;
+
+private:
+    const std::string socket;
+    pw_store::key_agent agent;
+    pid_t child;
+};
+
+std::string files_of(const std::string &db_file)
+{
+    return pw_store_test::read_file(db_file) +
+           pw_store_test::read_file(db_file + ".journal");
+}
+}
+
+TEST(batch_reads_without_writing)
+{
+    const agent_database db("read.db");
+    const auto before = files_of(db.db_file);
+    std::string output;
+    std::string errors;
+    CHECK(db.batch("lookup\texample\n"
+                   "# comment\n"
+                   "\n"
+                   "lookup\tSHOP\tignore-case\n"
+                   "get\t2\r\n",
+                   output, errors) == 0);
+    CHECK(output == "1\thttps://mail.example.com\tann\n"
+                    "2\thttps://shop.example.org\tbob\n"
+                    "ok\n"
+                    "2\thttps://shop.example.org\tbob\n"
+                    "ok\n"
+                    "2\thttps://shop.example.org\tbob\tsecret2\n"
+                    "ok\n");
+    // clean, no backup and no sync
+    CHECK(errors.find("Creating backup") == std::string::npos);
+    CHECK(files_of(db.db_file) == before);
+}
+
+TEST(batch_changes_are_backed_up_and_synced_once)
+{
+    const agent_database db("write.db");
+    const auto before = files_of(db.db_file);
+    std::string output;
+    std::string errors;
+    CHECK(db.batch("add\thttps://new.example\tcarl\tsecret3\n"
+                   "remove\t1\n"
+                   "remove\t1\n"
+                   "bogus\n"
+                   "lookup\texample\n",
+                   output, errors) == 1);
+    CHECK(output == "ok\n"
+                    "ok\n"
+                    "error\tno such id\n"
+                    "error\tinvalid command\n"
+                    "2\thttps://shop.example.org\tbob\n"
+                    "3\thttps://new.example\tcarl\n"
+                    "ok\n");
+    // one backup of the file before the changes
+    const auto backup = errors.find("Creating backup(\"");
+    CHECK(backup != std::string::npos &&
+          errors.find("Creating backup", backup + 1) == std::string::npos);
+    if(backup != std::string::npos) {
+        const auto name_begin = backup + 17;
+        const auto name = errors.substr(
+            name_begin, errors.find('"', name_begin) - name_begin);
+        CHECK(files_of(name) == before);
+    }
+
+    pw_store_api_cxx::pwstore_api reopened(db.db_file, PASSWORD);
+    pw_store::result_type content;
+    CHECK(reopened.dump(content));
+    CHECK(content.size() == 2);
+    pw_store::data_type date;
+    CHECK(reopened.get(3, date) && date.password == "secret3");
+    CHECK(!reopened.get(1, date));
+}
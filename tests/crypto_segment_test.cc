@@ -0,0 +1,78 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "test.hh"
+
+#include <string>
+
+#include "crypto_segment.hh"
+
+namespace
+{
+std::string contents(const pw_store::file_view &view)
+{
+    return std::string(view.begin(), view.end());
+}
+}
+
+TEST(file_view_reads_the_whole_file)
+{
+    const auto path = pw_store_test::temp_path("view");
+    std::string data(300000, '\0');
+    for(std::size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<char>(i * 7);
+    pw_store_test::write_file(path, data);
+
+    pw_store::file_view view;
+    bool exists = false;
+    CHECK(view.open(path, exists) && exists);
+    CHECK(view.size() == data.size() && contents(view) == data);
+
+    // a replaced file stays readable through the view
+    CHECK(pw_store::replace_file(path, "new"));
+    CHECK(contents(view) == data);
+    CHECK(view.open(path, exists) && exists);
+    CHECK(contents(view) == "new");
+
+    view.unmap();
+    CHECK(!view.size() && view.begin() == view.end());
+}
+
+TEST(file_view_of_missing_and_empty_files)
+{
+    pw_store::file_view view;
+    bool exists = true;
+    CHECK(view.open(pw_store_test::temp_path("missing"), exists) && !exists);
+    CHECK(!view.size());
+
+    const auto path = pw_store_test::temp_path("empty");
+    pw_store_test::write_file(path, "");
+    CHECK(view.open(path, exists) && exists);
+    CHECK(!view.size() && view.begin() == view.end());
+}
+
+TEST(truncate_file_keeps_the_prefix)
+{
+    const auto path = pw_store_test::temp_path("truncated");
+    pw_store_test::write_file(path, "0123456789");
+    CHECK(pw_store::truncate_file(path, 4));
+    CHECK(pw_store_test::read_file(path) == "0123");
+    CHECK(pw_store::truncate_file(path, 0));
+    CHECK(pw_store_test::read_file(path).empty());
+    CHECK(!pw_store::truncate_file(pw_store_test::temp_path("none"), 0));
+}
@@ -0,0 +1,291 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "test.hh"
+
+#include <vector>
+
+#include "pwstore.hh"
+
+namespace
+{
+// a database file without record ids, as written by older versions
+const std::string LEGACY = "https://b.example\tbob\tpw2\t\n"
+                           "https://a.example\tann\tpw1\t\n"
+                           "\n"
+                           "https://c.example\tcarl\tpw3\t\n";
+
+void assign(pw_store::secure_buffer &buffer, const std::string &text)
+{
+    buffer.assign(text.data(), text.size());
+}
+
+bool points_into(const pw_store::field_ref &field,
+                 const pw_store::secure_buffer &buffer)
+{
+    return field.data >= buffer.data() &&
+           field.data + field.size <= buffer.data() + buffer.size();
+}
+
+// all records in storage order
+std::vector<std::string> records(pw_store::database &db)
+{
+    pw_store::result_type content;
+    db.dump_db(content);
+    std::vector<std::string> result;
+    for(const auto &match : content) {
+        pw_store::data_type date;
+        CHECK(db.get(match.id, date));
+        result.push_back(std::to_string(match.id) + " " + date.url_string +
+                         " " + date.username + " " + date.password);
+    }
+    return result;
+}
+}
+
+TEST(database_parse_references_the_buffer)
+{
+    pw_store::secure_buffer buffer;
+    assign(buffer, LEGACY);
+    pw_store::database db(buffer);
+    CHECK(db.parse());
+    CHECK(!db.is_dirty());
+
+    // numbered in file order
+    CHECK(records(db) == std::vector<std::string>(
+                             {"1 https://b.example bob pw2",
+                              "2 https://a.example ann pw1",
+                              "3 https://c.example carl pw3"}));
+    pw_store::result_type content;
+    db.dump_db(content);
+    for(const auto &match : content)
+        CHECK(points_into(match.url_string, buffer) &&
+              points_into(match.username, buffer));
+
+    // inserted records live elsewhere until the buffer is written again
+    CHECK(db.insert(pw_store::data_type("https://d.example", "dan", "pw4")));
+    content.clear();
+    CHECK(db.lookup_id(4, content));
+    CHECK(!points_into(content.front().url_string, buffer));
+
+    db.synchronize_buffer();
+    content.clear();
+    db.dump_db(content);
+    CHECK(content.size() == 4);
+    for(const auto &match : content)
+        CHECK(points_into(match.url_string, buffer) &&
+              points_into(match.username, buffer));
+
+    // the written buffer parses to the same records with the same ids
+    pw_store::secure_buffer copy;
+    copy.assign(buffer.data(), buffer.size());
+    pw_store::database reread(copy);
+    CHECK(reread.parse());
+    CHECK(records(reread) == records(db));
+}
+
+TEST(database_parse_rejects_corrupt_lines)
+{
+    pw_store_test::capture_errors errors;
+    for(const std::string text :
+        {"https://a.example\tann\n", "a\tb\tc\td\te\tf\n",
+         "a\tb\tc\tx1\t\n", "a\tb\tc\t5\t\nd\te\tf\t5\t\n",
+         "a\tb\tc\t\nnext_id\t9\n"}) {
+        pw_store::secure_buffer buffer;
+        assign(buffer, text);
+        pw_store::database db(buffer);
+        CHECK(!db.parse());
+    }
+    CHECK(errors.contains("corrupt database file"));
+}
+
+TEST(database_ids_survive_changes_and_rewrites)
+{
+    const std::string text = "next_id\t10\n"
+                             "https://a.example\tann\tpw1\t3\t\n"
+                             "https://b.example\tbob\tpw2\t7\t\n";
+    pw_store::secure_buffer buffer;
+    assign(buffer, text);
+    pw_store::database db(buffer);
+    CHECK(db.parse());
+
+    // removed ids are not handed out again
+    CHECK(db.insert(pw_store::data_type("https://c.example", "carl", "pw3")));
+    CHECK(db.remove(10));
+    CHECK(db.insert(pw_store::data_type("https://d.example", "dan", "pw4")));
+    CHECK(db.remove(7));
+    CHECK(!db.remove(7));
+    pw_store::data_type date;
+    CHECK(!db.get(7, date) && !db.get(10, date));
+    CHECK(db.get(3, date) && date.username == "ann");
+    CHECK(db.get(11, date) && date.username == "dan");
+
+    // the same changes through a journal
+    pw_store::secure_buffer changes;
+    db.take_changes(changes);
+    CHECK(!db.is_dirty());
+    pw_store::secure_buffer other_buffer;
+    assign(other_buffer, text);
+    pw_store::database other(other_buffer);
+    CHECK(other.parse());
+    CHECK(other.apply_changes(changes.data(),
+                              changes.data() + changes.size()));
+    CHECK(records(other) == records(db));
+
+    // and after writing the database, also for the next insert
+    db.synchronize_buffer();
+    pw_store::secure_buffer copy;
+    copy.assign(buffer.data(), buffer.size());
+    pw_store::database reread(copy);
+    CHECK(reread.parse());
+    CHECK(records(reread) ==
+          std::vector<std::string>({"3 https://a.example ann pw1",
+                                    "11 https://d.example dan pw4"}));
+    CHECK(reread.remove(11));
+    CHECK(reread.insert(pw_store::data_type("https://e.example", "eve", "pw5")));
+    CHECK(reread.get(12, date) && date.username == "eve");
+}
+
+TEST(database_remove_keeps_the_storage_order)
+{
+    const std::string text = "https://a.example\tann\tpw1\t1\t\n"
+                             "https://b.example\tbob\tpw2\t2\t\n"
+                             "https://c.example\tcarl\tpw3\t3\t\n"
+                             "https://d.example\tdan\tpw4\t4\t\n";
+    pw_store::secure_buffer buffer;
+    assign(buffer, text);
+    pw_store::database db(buffer);
+    CHECK(db.parse());
+    CHECK(db.insert(pw_store::data_type("https://0.example", "eve", "pw5")));
+    CHECK(db.remove(1));
+    CHECK(db.remove(3));
+    const std::vector<std::string> expected = {
+        "2 https://b.example bob pw2", "4 https://d.example dan pw4",
+        "5 https://0.example eve pw5"};
+    CHECK(records(db) == expected);
+
+    // also when the removals come from a journal
+    pw_store::secure_buffer changes;
+    db.take_changes(changes);
+    pw_store::secure_buffer other_buffer;
+    assign(other_buffer, text);
+    pw_store::database other(other_buffer);
+    CHECK(other.parse());
+    CHECK(other.apply_changes(changes.data(),
+                              changes.data() + changes.size()));
+    CHECK(records(other) == expected);
+
+    // a record is removed only once
+    const std::string twice = "remove\t2\nremove\t2\n";
+    pw_store_test::capture_errors errors;
+    CHECK(!other.apply_changes(twice.data(), twice.data() + twice.size()));
+    CHECK(errors.contains("corrupt journal"));
+}
+
+TEST(database_remove_many_in_one_pass)
+{
+    std::string text;
+    for(int i = 1; i <= 10; i++)
+        text += "https://" + std::string(1, 'a' + i) + ".example\tuser" +
+                std::to_string(i) + "\tsecret" + std::to_string(i) + "\t" +
+                std::to_string(i) + "\t\n";
+    pw_store::secure_buffer buffer;
+    assign(buffer, text);
+    pw_store::database db(buffer);
+    CHECK(db.parse());
+    // the trigram index is updated too
+    pw_store::result_type matches;
+    db.lookup("example", matches);
+    db.lookup("example", matches);
+
+    // nothing is removed if one id is unknown
+    CHECK(!db.remove(std::vector<pw_store::data_type::id_type>({2, 42})));
+    CHECK(records(db).size() == 10);
+
+    // the others keep their order, duplicates do not matter
+    CHECK(db.remove(std::vector<pw_store::data_type::id_type>({9, 2, 5, 2, 10})));
+    std::vector<std::string> ids;
+    for(const auto &r : records(db))
+        ids.push_back(r.substr(0, r.find(' ')));
+    CHECK(ids == std::vector<std::string>({"1", "3", "4", "6", "7", "8"}));
+    matches.clear();
+    db.lookup("example", matches);
+    CHECK(matches.size() == 6);
+    pw_store::data_type date;
+    CHECK(db.get(8, date) && date.password == "secret8");
+
+    // the removed passwords are wiped from the buffer
+    const std::string after(buffer.data(), buffer.size());
+    CHECK(after.find("secret2\t") == std::string::npos);
+    CHECK(after.find("secret9") == std::string::npos);
+    CHECK(after.find("secret10") == std::string::npos);
+    CHECK(after.find("secret3\t") != std::string::npos);
+    CHECK(db.is_dirty());
+}
+
+TEST(database_synchronize_buffer_writes_exactly_the_records)
+{
+    pw_store::secure_buffer buffer;
+    assign(buffer, "next_id\t98\n"
+                   "https://b.example\tbob\tpw2\t10\t\n"
+                   "https://d.example\t\t\t97\t\n"
+                   "https://f.example\tfay\tpw6\t9\t\n");
+    pw_store::database db(buffer);
+    CHECK(db.parse());
+
+    // ids across a change of the number of digits, a removal between
+    // records copied from the old buffer and the journal header
+    CHECK(db.insert(pw_store::data_type("https://e.example", "eve", "pw5")));
+    CHECK(db.insert(pw_store::data_type("https://a.example", "", "pw1")));
+    CHECK(db.insert(pw_store::data_type("https://c.example", "carl", "")));
+    CHECK(db.remove(97));
+    db.journal_generation("0123456789abcdef0123456789abcdef");
+    pw_store::secure_buffer changes;
+    db.take_changes(changes);
+    CHECK(std::string(changes.data(), changes.size()) ==
+          "next_id\t101\n"
+          "remove\t97\n"
+          "https://e.example\teve\tpw5\t98\t\n"
+          "https://a.example\t\tpw1\t99\t\n"
+          "https://c.example\tcarl\t\t100\t\n");
+
+    db.synchronize_buffer();
+    const std::string expected =
+        "next_id\t101\n"
+        "journal\t0123456789abcdef0123456789abcdef\n"
+        "https://a.example\t\tpw1\t99\t\n"
+        "https://b.example\tbob\tpw2\t10\t\n"
+        "https://c.example\tcarl\t\t100\t\n"
+        "https://e.example\teve\tpw5\t98\t\n"
+        "https://f.example\tfay\tpw6\t9\t\n";
+    CHECK(std::string(buffer.data(), buffer.size()) == expected);
+
+    // copied from the buffer it wrote itself
+    CHECK(db.remove(99));
+    CHECK(db.insert(pw_store::data_type("https://g.example", "gus", "pw7")));
+    db.synchronize_buffer();
+    CHECK(std::string(buffer.data(), buffer.size()) ==
+          "next_id\t102\n"
+          "journal\t0123456789abcdef0123456789abcdef\n"
+          "https://b.example\tbob\tpw2\t10\t\n"
+          "https://c.example\tcarl\t\t100\t\n"
+          "https://e.example\teve\tpw5\t98\t\n"
+          "https://f.example\tfay\tpw6\t9\t\n"
+          "https://g.example\tgus\tpw7\t101\t\n");
+    CHECK(records(db).size() == 5);
+}
@@ -0,0 +1,148 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "test.hh"
+
+#include <vector>
+
+#include "fuzzy_match.hh"
+#include "pwstore.hh"
+
+namespace
+{
+// key is compared with the case folded text
+int score_of(const std::string &text, const std::string &key)
+{
+    const std::string folded = pw_store::fold_case(text);
+    int score = 0;
+    CHECK(pw_store::fuzzy_score(text.data(), folded.data(), text.size(), key,
+                                score));
+    return score;
+}
+
+pw_store::result_type lookup(pw_store::database &db, const std::string &key,
+                             pw_store::match_mode mode)
+{
+    pw_store::result_type result;
+    db.lookup(key, result, mode);
+    return result;
+}
+
+std::vector<std::string> urls_of(const pw_store::result_type &matches)
+{
+    std::vector<std::string> urls;
+    for(const auto &match : matches)
+        urls.push_back(match.url_string.str());
+    return urls;
+}
+}
+
+TEST(fuzzy_score_prefers_runs_and_word_starts)
+{
+    int score;
+    CHECK(!pw_store::fuzzy_score("abc", "abc", 3, "acb", score));
+    CHECK(!pw_store::fuzzy_score("abc", "abc", 3, "abcd", score));
+    CHECK(score_of("abc", "abc") > score_of("axbxc", "abc"));
+    CHECK(score_of("axbxc", "abc") > score_of("axxbxxc", "abc"));
+    CHECK(score_of("foo_bar", "b") > score_of("foodbar", "b"));
+    CHECK(score_of("fooBar", "b") > score_of("foobar", "b"));
+    // the window is shrunk to the last start before the end
+    CHECK(score_of("a...abc", "abc") == score_of("abc", "abc"));
+}
+
+TEST(fuzzy_lookup_ranks_best_first)
+{
+    pw_store::secure_buffer buffer;
+    pw_store::database db(buffer);
+    CHECK(db.parse());
+    for(const std::string url :
+        {"https://g.x.h.example", "https://github.com", "https://gh.io",
+         "https://GitHub.org", "https://ghost.example", "https://bank.test"})
+        CHECK(db.insert(pw_store::data_type(url, "user", "secret")));
+
+    const auto fuzzy = pw_store::match_mode::fuzzy;
+    auto matches = lookup(db, "gh", fuzzy);
+    CHECK(matches.size() == 5);
+    for(std::size_t i = 1; i < matches.size(); i++)
+        CHECK(matches[i - 1].score >= matches[i].score);
+    // consecutive at a word start, the shorter record first on a tie
+    CHECK(urls_of(matches)[0] == "https://gh.io");
+    CHECK(urls_of(matches)[1] == "https://ghost.example");
+    // a gap inside a word costs more than gaps between words
+    CHECK(urls_of(matches).back() == "https://github.com");
+
+    // upper case in the key makes it case-sensitive
+    CHECK(urls_of(lookup(db, "GH", fuzzy)) ==
+          std::vector<std::string>({"https://GitHub.org"}));
+
+    db.fuzzy_limit(2);
+    CHECK(urls_of(lookup(db, "gh", fuzzy)) ==
+          std::vector<std::string>({"https://gh.io", "https://ghost.example"}));
+}
+
+TEST(fuzzy_top_k_equals_the_best_of_all)
+{
+    pw_store::secure_buffer buffer;
+    pw_store::database db(buffer);
+    CHECK(db.parse());
+    unsigned state = 1;
+    const auto next = [&state]() {
+        state = state * 1103515245 + 12345;
+        return (state >> 16) % 26;
+    };
+    for(int i = 0; i < 3000; i++) {
+        std::string url = "https://";
+        for(int c = 0, size = 5 + next() % 20; c < size; c++)
+            url.push_back(next() < 3 ? '.' : static_cast<char>('a' + next()));
+        CHECK(db.insert(pw_store::data_type(url, "u" + std::to_string(i),
+                                            "secret")));
+    }
+
+    const auto fuzzy = pw_store::match_mode::fuzzy;
+    for(const std::string key : {"abc", "e.x", "zz", "qwe"}) {
+        db.fuzzy_limit(100000);
+        const auto all = lookup(db, key, fuzzy);
+        db.fuzzy_limit(10);
+        const auto best = lookup(db, key, fuzzy);
+        CHECK(all.size() > best.size() && best.size() == 10);
+        for(std::size_t i = 0; i < best.size(); i++)
+            CHECK(best[i].id == all[i].id && best[i].score == all[i].score);
+    }
+}
+
+TEST(ignore_case_lookup)
+{
+    pw_store::secure_buffer buffer;
+    pw_store::database db(buffer);
+    CHECK(db.parse());
+    for(const std::string url :
+        {"https://Example.com", "https://EXAMPLE.org", "https://example.net",
+         "https://\xc3\x9c" "ber.example", "https://bank.test"})
+        CHECK(db.insert(pw_store::data_type(url, "User", "secret")));
+
+    const auto exact = pw_store::match_mode::exact;
+    const auto icase = pw_store::match_mode::ignore_case;
+    CHECK(lookup(db, "Example", exact).size() == 1);
+    for(const std::string key : {"example", "EXAMPLE", "eXaMpLe"})
+        CHECK(lookup(db, key, icase).size() == 4);
+    CHECK(lookup(db, "user", exact).empty());
+    CHECK(lookup(db, "USER", icase).size() == 5);
+    // only ASCII is folded
+    CHECK(lookup(db, "\xc3\xbc" "ber", icase).empty());
+    CHECK(lookup(db, "\xc3\x9c" "BER", icase).size() == 1);
+}
@@ -0,0 +1,310 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "test.hh"
+
+#include <stdexcept>
+#include <vector>
+
+#include "journal.hh"
+
+namespace
+{
+const std::string PASSWORD = "journal test";
+
+bool append(pw_store::journal &j, const std::string &text)
+{
+    pw_store::secure_buffer plaintext;
+    plaintext.assign(text.data(), text.size());
+    return j.append(plaintext);
+}
+
+// Journal of generation with the segments "first" and "second". Returns the
+// size of its header.
+std::size_t write_journal(const std::string &path,
+                          const std::string &generation)
+{
+    pw_store::journal j(path);
+    CHECK(j.create(PASSWORD, generation));
+    const std::size_t header = j.size();
+    CHECK(append(j, "first"));
+    CHECK(append(j, "second"));
+    return header;
+}
+
+// result of open(), the segments applied and usable() after it
+struct read_result
+{
+    bool ok;
+    std::vector<std::string> segments;
+    bool usable;
+};
+
+read_result read_journal(const std::string &path,
+                         const std::string &generation)
+{
+    read_result result;
+    pw_store::journal j(path);
+    result.ok = j.open(PASSWORD, generation,
+                       [&result](const char *begin, const char *end) {
+                           result.segments.emplace_back(begin, end);
+                           return true;
+                       });
+    result.usable = j.usable();
+    return result;
+}
+}
+
+TEST(journal_round_trip)
+{
+    const auto path = pw_store_test::temp_path("round_trip.journal");
+    const auto generation = pw_store::journal::new_generation();
+    write_journal(path, generation);
+
+    const auto result = read_journal(path, generation);
+    CHECK(result.ok);
+    CHECK(result.usable);
+    CHECK(result.segments ==
+          std::vector<std::string>({"first", "second"}));
+}
+
+TEST(journal_torn_tail_is_cut_off_by_the_next_append)
+{
+    const auto path = pw_store_test::temp_path("torn.journal");
+    const auto generation = pw_store::journal::new_generation();
+    write_journal(path, generation);
+    auto data = pw_store_test::read_file(path);
+    data.resize(data.size() - 5);
+    pw_store_test::write_file(path, data);
+
+    pw_store_test::capture_errors errors;
+    const auto result = read_journal(path, generation);
+    CHECK(result.ok);
+    CHECK(result.usable);
+    CHECK(result.segments == std::vector<std::string>({"first"}));
+    CHECK(errors.contains("incomplete segment after segment 1"));
+    CHECK(pw_store_test::read_file(path) == data);
+
+    {
+        pw_store::journal j(path);
+        CHECK(j.open(PASSWORD, generation,
+                     [](const char *, const char *) { return true; }));
+        const std::size_t complete = j.size();
+        CHECK(append(j, "third"));
+        CHECK(pw_store_test::read_file(path + ".torn") ==
+              data.substr(complete));
+    }
+
+    const auto again = read_journal(path, generation);
+    CHECK(again.ok);
+    CHECK(again.usable);
+    CHECK(again.segments == std::vector<std::string>({"first", "third"}));
+}
+
+TEST(journal_invalid_size_is_corruption)
+{
+    const auto path = pw_store_test::temp_path("corrupt.journal");
+    const auto generation = pw_store::journal::new_generation();
+    const auto header = write_journal(path, generation);
+    auto data = pw_store_test::read_file(path);
+    // no segment is smaller than its timestamp
+    data.replace(header, 4, std::string(4, '\0'));
+    pw_store_test::write_file(path, data);
+
+    pw_store_test::capture_errors errors;
+    const auto result = read_journal(path, generation);
+    CHECK(!result.ok);
+    CHECK(result.segments.empty());
+    CHECK(errors.contains("segment 0 is corrupt"));
+    CHECK(pw_store_test::read_file(path) == data);
+}
+
+TEST(journal_size_past_the_end_saves_the_rest)
+{
+    // A corrupt size of the first segment, indistinguishable from a torn
+    // tail. The second segment must survive on disk.
+    const auto path = pw_store_test::temp_path("past_end.journal");
+    const auto generation = pw_store::journal::new_generation();
+    const auto header = write_journal(path, generation);
+    auto data = pw_store_test::read_file(path);
+    data[header + 2] = 0x7f;
+    pw_store_test::write_file(path, data);
+
+    pw_store_test::capture_errors errors;
+    const auto result = read_journal(path, generation);
+    CHECK(result.ok);
+    CHECK(result.usable);
+    CHECK(result.segments.empty());
+    CHECK(errors.contains("incomplete segment after segment 0"));
+    CHECK(pw_store_test::read_file(path) == data);
+
+    {
+        pw_store::journal j(path);
+        CHECK(j.open(PASSWORD, generation,
+                     [](const char *, const char *) { return true; }));
+        CHECK(append(j, "third"));
+    }
+    CHECK(pw_store_test::read_file(path + ".torn") == data.substr(header));
+
+    const auto again = read_journal(path, generation);
+    CHECK(again.ok);
+    CHECK(again.usable);
+    CHECK(again.segments == std::vector<std::string>({"third"}));
+}
+
+TEST(journal_modified_segment_fails_authentication)
+{
+    const auto path = pw_store_test::temp_path("modified.journal");
+    const auto generation = pw_store::journal::new_generation();
+    write_journal(path, generation);
+    auto data = pw_store_test::read_file(path);
+    data.back() ^= 1;
+    pw_store_test::write_file(path, data);
+
+    pw_store_test::capture_errors errors;
+    const auto result = read_journal(path, generation);
+    CHECK(!result.ok);
+    CHECK(errors.contains("segment 1 failed authentication"));
+}
+
+TEST(journal_of_another_generation_is_ignored_with_a_warning)
+{
+    const auto path = pw_store_test::temp_path("other.journal");
+    write_journal(path, pw_store::journal::new_generation());
+
+    pw_store_test::capture_errors errors;
+    const auto result =
+        read_journal(path, pw_store::journal::new_generation());
+    CHECK(result.ok);
+    CHECK(!result.usable);
+    CHECK(result.segments.empty());
+    CHECK(errors.contains("another version of the database"));
+}
+
+TEST(journal_missing_is_reported)
+{
+    pw_store_test::capture_errors errors;
+    const auto result = read_journal(pw_store_test::temp_path("missing"),
+                                     pw_store::journal::new_generation());
+    CHECK(result.ok);
+    CHECK(!result.usable);
+    CHECK(errors.contains("is missing"));
+}
+
+TEST(journal_replays_many_segments_in_order)
+{
+    const auto path = pw_store_test::temp_path("many.journal");
+    const auto generation = pw_store::journal::new_generation();
+    std::vector<std::string> written;
+    {
+        pw_store::journal j(path);
+        CHECK(j.create(PASSWORD, generation));
+        // more segments than wait between decryption and apply, of sizes
+        // from empty to large
+        for(std::size_t i = 0; i < 40; i++) {
+            const std::size_t size = i % 4 == 3 ? 100000 + i : i * i;
+            std::string text(size, static_cast<char>('a' + i % 26));
+            if(size)
+                text[size / 2] = static_cast<char>(i);
+            written.push_back(text);
+            CHECK(append(j, text));
+        }
+        CHECK(j.size() == pw_store_test::read_file(path).size());
+    }
+
+    pw_store::journal j(path);
+    std::vector<std::string> replayed;
+    CHECK(j.open(PASSWORD, generation,
+                 [&replayed](const char *begin, const char *end) {
+                     replayed.emplace_back(begin, end);
+                     return true;
+                 }));
+    CHECK(replayed == written);
+    CHECK(j.segments() == written.size());
+    CHECK(j.size() == pw_store_test::read_file(path).size());
+    CHECK(j.usable());
+}
+
+TEST(journal_failing_apply_stops_the_replay)
+{
+    const auto path = pw_store_test::temp_path("failing.journal");
+    const auto generation = pw_store::journal::new_generation();
+    {
+        pw_store::journal j(path);
+        CHECK(j.create(PASSWORD, generation));
+        for(int i = 0; i < 20; i++)
+            CHECK(append(j, std::string(1000, 'x')));
+    }
+
+    pw_store::journal j(path);
+    int applied = 0;
+    CHECK(!j.open(PASSWORD, generation,
+                  [&applied](const char *, const char *) {
+                      return ++applied < 3;
+                  }));
+    CHECK(applied == 3);
+    CHECK(!j.usable());
+
+    applied = 0;
+    bool thrown = false;
+    try {
+        j.open(PASSWORD, generation, [&applied](const char *, const char *) {
+            if(++applied == 5)
+                throw std::runtime_error("apply");
+            return true;
+        });
+    } catch(const std::runtime_error &) {
+        thrown = true;
+    }
+    CHECK(thrown && applied == 5);
+    CHECK(!j.usable());
+
+    // nothing left behind
+    CHECK(read_journal(path, generation).segments.size() == 20);
+}
+
+TEST(journal_replay_reads_the_file_it_opened)
+{
+    // The segments are decrypted from a mapping of the file, a new journal
+    // created meanwhile replaces the file but not the mapping.
+    const auto path = pw_store_test::temp_path("replaced.journal");
+    const auto generation = pw_store::journal::new_generation();
+    {
+        pw_store::journal j(path);
+        CHECK(j.create(PASSWORD, generation));
+        for(int i = 0; i < 10; i++)
+            CHECK(append(j, std::string(50000, static_cast<char>('a' + i))));
+    }
+
+    pw_store::journal j(path);
+    pw_store::journal replacement(path);
+    std::vector<std::string> replayed;
+    CHECK(j.open(PASSWORD, generation,
+                 [&](const char *begin, const char *end) {
+                     if(replayed.empty())
+                         CHECK(replacement.create(
+                             PASSWORD, pw_store::journal::new_generation()));
+                     replayed.emplace_back(begin, end);
+                     return true;
+                 }));
+    CHECK(replayed.size() == 10);
+    CHECK(replayed.back() == std::string(50000, 'j'));
+    pw_store_test::capture_errors errors;
+    CHECK(read_journal(path, generation).segments.empty());
+    CHECK(errors.contains("belongs to another version"));
+}
@@ -0,0 +1,151 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "test.hh"
+
+#include <csignal>
+#include <iostream>
+#include <cstring>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "key_agent.hh"
+#include "local_socket.hh"
+
+namespace
+{
+// SALT ITERATIONS, see key_cache
+std::string key_id(char salt)
+{
+    std::string id(pw_store::SALT_SIZE, salt);
+    pw_store::put_u32(id, 100000);
+    return id;
+}
+
+mode_t file_mode(const std::string &path)
+{
+    struct stat s;
+    return stat(path.c_str(), &s) ? 0 : s.st_mode & 07777;
+}
+
+std::string directory(const std::string &path)
+{
+    return path.substr(0, path.rfind('/'));
+}
+
+int wait_for_exit(pid_t child)
+{
+    int status = 0;
+    if(waitpid(child, &status, 0) != child || !WIFEXITED(status))
+        return -1;
+    return WEXITSTATUS(status);
+}
+}
+
+TEST(local_socket_only_for_the_user)
+{
+    const auto path = pw_store::new_socket_path("test");
+    CHECK(!path.empty());
+    CHECK(file_mode(directory(path)) == 0700);
+    const int listener = pw_store::listen_socket(path);
+    CHECK(listener >= 0);
+    CHECK(file_mode(path) == 0600);
+
+    const int client = pw_store::connect_socket(path);
+    CHECK(client >= 0);
+    const int server = pw_store::accept_connection(listener, 1000);
+    CHECK(server >= 0);
+    CHECK(pw_store::same_user(server));
+    CHECK(pw_store::send_all(client, "ping", 4));
+    char received[4];
+    CHECK(pw_store::receive_all(server, received, sizeof(received)));
+    CHECK(!std::memcmp(received, "ping", 4));
+    pw_store::close_socket(client);
+    CHECK(pw_store::peer_closed(server));
+    pw_store::close_socket(server);
+
+    // nobody connects within the timeout
+    CHECK(pw_store::accept_connection(listener, 10) < 0);
+    pw_store::close_socket(listener);
+    pw_store::remove_socket(path);
+    CHECK(!file_mode(directory(path)));
+}
+
+TEST(local_socket_rejects_other_users)
+{
+    // Only root can connect as another user, and only if the permissions
+    // of the socket allow it.
+    if(geteuid())
+        return;
+    const auto path = pw_store::new_socket_path("test");
+    const int listener = pw_store::listen_socket(path);
+    CHECK(listener >= 0);
+    CHECK(!chmod(directory(path).c_str(), 0711));
+    CHECK(!chmod(path.c_str(), 0666));
+
+    // the child would print the buffered results again
+    std::cout.flush();
+    const pid_t child = fork();
+    if(!child) {
+        alarm(10);
+        if(setgid(65534) || setuid(65534))
+            _exit(1);
+        const int fd = pw_store::connect_socket(path);
+        if(fd < 0)
+            _exit(2);
+        // closed by the listener without a word
+        char c;
+        _exit(read(fd, &c, 1) == 0 ? 0 : 3);
+    }
+    CHECK(child > 0);
+    CHECK(pw_store::accept_connection(listener, 5000) < 0);
+    CHECK(wait_for_exit(child) == 0);
+    pw_store::close_socket(listener);
+    pw_store::remove_socket(path);
+}
+
+TEST(key_agent_caches_keys)
+{
+    const auto path = pw_store::new_socket_path("agent");
+    pw_store::key_agent agent(path, 60);
+    CHECK(agent.listen());
+    // the child would print the buffered results again
+    std::cout.flush();
+    const pid_t child = fork();
+    if(!child)
+        _exit(agent.run() ? 0 : 1);
+    CHECK(child > 0);
+
+    pw_store::agent_key_cache cache(path);
+    unsigned char key[pw_store::KEY_SIZE];
+    std::memset(key, 0x5a, sizeof(key));
+    unsigned char found[pw_store::KEY_SIZE] = {};
+    CHECK(!cache.find(key_id('a'), found));
+    cache.add(key_id('a'), key);
+    CHECK(cache.find(key_id('a'), found));
+    CHECK(!std::memcmp(found, key, sizeof(key)));
+    CHECK(!cache.find(key_id('b'), found));
+    // no SALT ITERATIONS
+    CHECK(!cache.find("a", found));
+
+    kill(child, SIGTERM);
+    CHECK(wait_for_exit(child) == 0);
+    CHECK(!cache.find(key_id('a'), found));
+}
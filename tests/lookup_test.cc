@@ -0,0 +1,166 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "test.hh"
+
+#include <algorithm>
+#include <list>
+
+#include "pwstore.hh"
+
+namespace
+{
+using ids_type = std::vector<pw_store::data_type::id_type>;
+
+const std::vector<std::string> URLS = {
+    "https://mail.example.com", "https://example.org/login",
+    "http://shop.example.de",   "https://bank.test",
+    "https://Example.NET",      "ftp://files.example.com"};
+
+void fill(pw_store::database &db)
+{
+    CHECK(db.parse());
+    for(std::size_t i = 0; i < URLS.size(); i++)
+        CHECK(db.insert(pw_store::data_type(
+            URLS[i], "user" + std::to_string(i), "secret")));
+}
+
+// ids of the lookup of key in storage order
+ids_type lookup_ids(pw_store::database &db, const std::string &key,
+                    pw_store::match_mode mode = pw_store::match_mode::exact)
+{
+    pw_store::result_type result;
+    db.lookup(key, result, mode);
+    ids_type ids;
+    for(const auto &match : result)
+        ids.push_back(match.id);
+    return ids;
+}
+
+// lookup_ids of key in a new database, nothing to narrow
+ids_type new_lookup_ids(const std::string &key,
+                        pw_store::match_mode mode = pw_store::match_mode::exact)
+{
+    pw_store::secure_buffer buffer;
+    pw_store::database db(buffer);
+    fill(db);
+    return lookup_ids(db, key, mode);
+}
+}
+
+TEST(lookup_suffix_array_index)
+{
+    pw_store::secure_buffer trigram_buffer;
+    pw_store::database trigrams(trigram_buffer);
+    fill(trigrams);
+    pw_store::secure_buffer suffix_buffer;
+    pw_store::database suffixes(suffix_buffer);
+    CHECK(suffixes.index() == pw_store::lookup_index::trigrams);
+    suffixes.index(pw_store::lookup_index::suffix_array);
+    CHECK(suffixes.index() == pw_store::lookup_index::suffix_array);
+    fill(suffixes);
+
+    // the second lookup builds the index, keys shorter than a trigram too
+    const std::vector<std::string> keys = {"example", "e",  "xample.co",
+                                           "user3",   "zz", "Example"};
+    for(int round = 0; round < 2; round++)
+        for(const auto &key : keys)
+            CHECK(lookup_ids(suffixes, key) == lookup_ids(trigrams, key));
+    CHECK(lookup_ids(suffixes, "example").size() == 4);
+
+    // rebuilt after changes
+    for(auto db : {&trigrams, &suffixes}) {
+        CHECK(db->remove(2));
+        CHECK(db->insert(pw_store::data_type("https://example.io", "eve",
+                                             "secret")));
+    }
+    for(int round = 0; round < 2; round++)
+        for(const auto &key : keys)
+            CHECK(lookup_ids(suffixes, key) == lookup_ids(trigrams, key));
+    const auto icase = pw_store::match_mode::ignore_case;
+    CHECK(lookup_ids(suffixes, "EXAMPLE", icase) ==
+          lookup_ids(trigrams, "EXAMPLE", icase));
+}
+
+TEST(lookup_narrowing_equals_a_new_search)
+{
+    pw_store::secure_buffer buffer;
+    pw_store::database db(buffer);
+    fill(db);
+
+    // typing, backspace and an unrelated key
+    const auto exact = pw_store::match_mode::exact;
+    const auto icase = pw_store::match_mode::ignore_case;
+    const std::vector<std::pair<std::string, pw_store::match_mode>> keys = {
+        {"e", exact},         {"ex", exact},      {"exa", exact},
+        {"exam", exact},      {"example", exact}, {"example.c", exact},
+        {"example.co", exact}, {"exam", exact},   {"user", exact},
+        {"user1", exact},     {"E", icase},       {"EX", icase},
+        {"eXaMpLe", icase},   {"example.n", icase}, {"example.n", exact},
+        {"ple -url:mail", exact}, {"ple -url:mail.", exact}};
+    for(const auto &key : keys)
+        CHECK(lookup_ids(db, key.first, key.second) ==
+              new_lookup_ids(key.first, key.second));
+
+    // changes between key presses are not missed
+    CHECK(lookup_ids(db, "exam").size() == 4);
+    CHECK(db.insert(pw_store::data_type("https://example.io", "eve", "pw")));
+    auto ids = lookup_ids(db, "examp");
+    CHECK(ids.size() == 5);
+    const auto removed = ids.front();
+    CHECK(db.remove(removed));
+    ids = lookup_ids(db, "exampl");
+    CHECK(ids.size() == 4);
+    CHECK(std::find(std::begin(ids), std::end(ids), removed) ==
+          std::end(ids));
+}
+
+TEST(lookup_parallel_equals_serial)
+{
+    // chunks of several hundred records on machines with several cores
+    const std::size_t records = 20000;
+    std::list<pw_store::data_type> dates;
+    for(std::size_t i = 0; i < records; i++)
+        dates.emplace_back("https://host" + std::to_string(i % 1000) +
+                               ".Example" + std::to_string(i % 7) + ".com",
+                           "user" + std::to_string(i), "secret");
+    pw_store::secure_buffer buffer;
+    pw_store::database db(buffer);
+    CHECK(db.parse());
+    CHECK(db.insert(dates));
+    dates.clear();
+    CHECK(db.parallel_threshold() ==
+          pw_store::database::default_parallel_threshold);
+
+    const auto exact = pw_store::match_mode::exact;
+    const auto icase = pw_store::match_mode::ignore_case;
+    const auto fuzzy = pw_store::match_mode::fuzzy;
+    const std::vector<std::pair<std::string, pw_store::match_mode>> keys = {
+        {"Example3", exact}, {"host12.", exact}, {"user19999", exact},
+        {"example3", icase}, {"USER1234", icase},
+        {"url:host99. -user:user1", exact}, {"hst12x5", fuzzy}};
+    for(const auto &key : keys) {
+        db.parallel_threshold(1);
+        const auto parallel = lookup_ids(db, key.first, key.second);
+        // nothing to narrow for the next lookup
+        CHECK(lookup_ids(db, "\x01").empty());
+        db.parallel_threshold(0);
+        CHECK(lookup_ids(db, key.first, key.second) == parallel);
+        CHECK(!parallel.empty());
+        CHECK(lookup_ids(db, "\x01").empty());
+    }
+}
@@ -0,0 +1,89 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "test.hh"
+
+#include "merge.hh"
+
+namespace
+{
+using records_type = std::vector<pw_store::data_type>;
+
+bool same(const pw_store::data_type &a, const pw_store::data_type &b)
+{
+    return a.url_string == b.url_string && a.username == b.username &&
+           a.password == b.password;
+}
+
+std::vector<pw_store::merged_record>
+merge(std::vector<records_type> inputs)
+{
+    for(auto &input : inputs)
+        pw_store::sort_for_merge(input);
+    std::vector<pw_store::merged_record> merged;
+    pw_store::merge_sorted(inputs, merged);
+    return merged;
+}
+}
+
+TEST(merge_duplicates_once)
+{
+    const pw_store::data_type a("a.com", "ann", "1");
+    const pw_store::data_type b("b.com", "bob", "2");
+    const pw_store::data_type c("c.com", "carol", "3");
+    const auto merged = merge({{c, a, a}, {b, a}, {}});
+
+    CHECK(merged.size() == 3);
+    if(merged.size() != 3)
+        return;
+    CHECK(same(merged[0].date, a));
+    CHECK(same(merged[1].date, b));
+    CHECK(same(merged[2].date, c));
+    CHECK(merged[0].inputs == std::vector<bool>({true, true, false}));
+    CHECK(merged[1].inputs == std::vector<bool>({false, true, false}));
+    CHECK(merged[2].inputs == std::vector<bool>({true, false, false}));
+    for(const auto &record : merged)
+        CHECK(!record.conflict);
+}
+
+TEST(merge_conflicts)
+{
+    // same url and user, different passwords
+    const pw_store::data_type old_pw("a.com", "ann", "old");
+    const pw_store::data_type new_pw("a.com", "ann", "new");
+    const pw_store::data_type other_user("a.com", "bob", "old");
+    const auto merged = merge({{old_pw, other_user}, {new_pw}});
+
+    CHECK(merged.size() == 3);
+    if(merged.size() != 3)
+        return;
+    CHECK(same(merged[0].date, new_pw));
+    CHECK(merged[0].conflict);
+    CHECK(merged[0].inputs == std::vector<bool>({false, true}));
+    CHECK(same(merged[1].date, old_pw));
+    CHECK(merged[1].conflict);
+    CHECK(merged[1].inputs == std::vector<bool>({true, false}));
+    CHECK(same(merged[2].date, other_user));
+    CHECK(!merged[2].conflict);
+}
+
+TEST(merge_nothing)
+{
+    CHECK(merge({}).empty());
+    CHECK(merge({{}, {}}).empty());
+}
@@ -0,0 +1,242 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "test.hh"
+
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include "page_file.hh"
+
+namespace
+{
+const std::string PASSWORD = "page file test";
+const std::string GENERATION = "generation";
+
+// database buffer with header lines and count records, see pwstore.hh
+std::string make_database(std::size_t count)
+{
+    std::string lines = "next_id\t" + std::to_string(count + 1) + "\n" +
+                        "journal\t" + GENERATION + "\n";
+    for(std::size_t id = 1; id <= count; id++) {
+        const auto n = std::to_string(id);
+        lines += "https://example.com/" + n + "\tuser" + n + "\tpassword" +
+                 n + "\t" + n + "\t\n";
+    }
+    return lines;
+}
+
+bool write_database(const std::string &path, const std::string &lines)
+{
+    pw_store::secure_buffer buffer;
+    buffer.assign(lines.data(), lines.size());
+    pw_store::page_file file(path);
+    return file.write(PASSWORD, buffer, GENERATION);
+}
+
+// Reads all pages of path. Fails on a wrong password or a modified file.
+bool read_database(const std::string &path, const std::string &password,
+                   std::vector<std::string> &pages, std::string &all)
+{
+    pw_store::page_file file(path);
+    if(!file.open(password))
+        return false;
+    pw_store::secure_buffer buffer;
+    const bool read = file.read(buffer, [&pages](const char *begin,
+                                                 const char *end) {
+        pages.emplace_back(begin, end);
+        return true;
+    });
+    all.assign(buffer.data(), buffer.size());
+    return read;
+}
+
+class memory_cache : public pw_store::key_cache
+{
+public:
+    bool find(const std::string &id,
+              unsigned char key[pw_store::KEY_SIZE]) override
+    {
+        const auto entry = keys.find(id);
+        if(entry == keys.end())
+            return false;
+        std::memcpy(key, entry->second.data(), pw_store::KEY_SIZE);
+        return true;
+    }
+    void add(const std::string &id,
+             const unsigned char key[pw_store::KEY_SIZE]) override
+    {
+        keys[id].assign(reinterpret_cast<const char *>(key),
+                        pw_store::KEY_SIZE);
+    }
+
+private:
+    std::map<std::string, std::string> keys;
+};
+}
+
+TEST(page_file_round_trip)
+{
+    const auto path = pw_store_test::temp_path("round_trip.pages");
+    const auto lines = make_database(500);
+    CHECK(write_database(path, lines));
+    CHECK(pw_store::page_file::detect(path) ==
+          pw_store::page_file::format::pages);
+
+    std::vector<std::string> pages;
+    std::string all;
+    CHECK(read_database(path, PASSWORD, pages, all));
+    CHECK(all == lines);
+    CHECK(pages.size() > 1);
+    std::string joined;
+    for(const auto &page : pages) {
+        CHECK(!page.empty() && page.back() == '\n');
+        joined += page;
+    }
+    CHECK(joined == lines);
+
+    pw_store::page_file file(path);
+    CHECK(file.open(PASSWORD));
+    CHECK(file.record_count() == 500);
+    CHECK(file.plaintext_size() == lines.size());
+    CHECK(file.journal_generation() == GENERATION);
+}
+
+TEST(page_file_many_pages_round_trip)
+{
+    // enough pages to decrypt them in parallel, given several cores
+    const auto path = pw_store_test::temp_path("many.pages");
+    const auto lines = make_database(20000);
+    CHECK(write_database(path, lines));
+
+    std::vector<std::string> pages;
+    std::string all;
+    CHECK(read_database(path, PASSWORD, pages, all));
+    CHECK(pages.size() >= 64);
+    CHECK(all == lines);
+}
+
+TEST(page_file_read_page)
+{
+    const auto path = pw_store_test::temp_path("read_page.pages");
+    CHECK(write_database(path, make_database(500)));
+    pw_store::page_file file(path);
+    CHECK(file.open(PASSWORD));
+
+    pw_store::secure_buffer page;
+    bool found = false;
+    CHECK(file.read_page(321, page, found));
+    CHECK(found);
+    const std::string text(page.data(), page.size());
+    CHECK(text.find("\tuser321\tpassword321\t321\t\n") != std::string::npos);
+    CHECK(text.size() < pw_store::page_file::page_size * 2);
+
+    CHECK(file.read_page(501, page, found));
+    CHECK(!found);
+}
+
+TEST(page_file_wrong_password_fails)
+{
+    const auto path = pw_store_test::temp_path("password.pages");
+    CHECK(write_database(path, make_database(10)));
+    pw_store_test::capture_errors errors;
+    pw_store::page_file file(path);
+    CHECK(!file.open("wrong " + PASSWORD));
+}
+
+TEST(page_file_modified_page_fails)
+{
+    const auto path = pw_store_test::temp_path("modified.pages");
+    CHECK(write_database(path, make_database(500)));
+    auto data = pw_store_test::read_file(path);
+    data.back() ^= 1;
+    pw_store_test::write_file(path, data);
+
+    pw_store_test::capture_errors errors;
+    std::vector<std::string> pages;
+    std::string all;
+    CHECK(!read_database(path, PASSWORD, pages, all));
+    CHECK(all.empty());
+    CHECK(errors.contains("failed authentication"));
+}
+
+TEST(page_file_rewrite_with_cached_key)
+{
+    memory_cache cache;
+    pw_store::set_key_cache(&cache);
+    const auto path = pw_store_test::temp_path("cached.pages");
+    pw_store::page_file file(path);
+    const auto first = make_database(10);
+    pw_store::secure_buffer buffer;
+    buffer.assign(first.data(), first.size());
+    CHECK(file.write(PASSWORD, buffer, GENERATION));
+    const auto id = file.key_id();
+    CHECK(!id.empty());
+
+    // an empty password keeps salt and key
+    const auto second = make_database(20);
+    buffer.assign(second.data(), second.size());
+    CHECK(file.write("", buffer, GENERATION));
+    CHECK(file.key_id() == id);
+    pw_store::set_key_cache(nullptr);
+
+    std::vector<std::string> pages;
+    std::string all;
+    CHECK(read_database(path, PASSWORD, pages, all));
+    CHECK(all == second);
+}
+
+TEST(page_file_spliced_page_fails)
+{
+    memory_cache cache;
+    pw_store::set_key_cache(&cache);
+    const auto path = pw_store_test::temp_path("spliced.pages");
+    pw_store::page_file file(path);
+    const auto lines = make_database(500);
+    pw_store::secure_buffer buffer;
+    buffer.assign(lines.data(), lines.size());
+    CHECK(file.write(PASSWORD, buffer, GENERATION));
+    const auto older = pw_store_test::read_file(path);
+    // same key, same pages
+    CHECK(file.write("", buffer, GENERATION));
+    pw_store::set_key_cache(nullptr);
+    auto newer = pw_store_test::read_file(path);
+    CHECK(older.size() == newer.size());
+
+    // the last page of the older file replaces the one of the newer file
+    std::vector<std::string> pages;
+    std::string all;
+    CHECK(read_database(path, PASSWORD, pages, all));
+    const auto last_page = pw_store::SEGMENT_OVERHEAD + pages.back().size();
+    CHECK(older.compare(older.size() - last_page, last_page, newer,
+                        newer.size() - last_page, last_page) != 0);
+    newer.replace(newer.size() - last_page, last_page, older,
+                  older.size() - last_page, last_page);
+    pw_store_test::write_file(path, newer);
+
+    pw_store_test::capture_errors errors;
+    pw_store::page_file spliced(path);
+    CHECK(spliced.open(PASSWORD));
+    pw_store::secure_buffer page;
+    bool found = false;
+    CHECK(spliced.read_page(1, page, found));
+    CHECK(found);
+    CHECK(!spliced.read_page(500, page, found));
+    CHECK(errors.contains("failed authentication"));
+}
@@ -0,0 +1,137 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "test.hh"
+
+#include <algorithm>
+
+#include "pwstore.hh"
+#include "query.hh"
+
+namespace
+{
+std::string compile_error(const std::string &text)
+{
+    pw_store::query q;
+    std::string error;
+    CHECK(!q.compile(text, false, error));
+    return error;
+}
+
+bool matches(const std::string &text, const std::string &url,
+             const std::string &user, bool ignore_case = false)
+{
+    pw_store::query q;
+    std::string error;
+    CHECK(q.compile(text, ignore_case, error));
+    const std::string pass = "secret";
+    const pw_store::record r({url.data(), url.size()},
+                             {user.data(), user.size()},
+                             {pass.data(), pass.size()}, 1);
+    return q.matches(r);
+}
+
+// urls of the lookup of key in a database of the urls, sorted
+std::vector<std::string> lookup_urls(const std::vector<std::string> &urls,
+                                     const std::string &key,
+                                     pw_store::match_mode mode)
+{
+    pw_store::secure_buffer buffer;
+    pw_store::database db(buffer);
+    CHECK(db.parse());
+    for(const auto &url : urls)
+        CHECK(db.insert(pw_store::data_type(url, "user", "secret")));
+    pw_store::result_type result;
+    db.lookup(key, result, mode);
+    std::vector<std::string> found;
+    for(const auto &match : result)
+        found.push_back(match.url_string.str());
+    std::sort(std::begin(found), std::end(found));
+    return found;
+}
+}
+
+TEST(query_is_query)
+{
+    using pw_store::query;
+    CHECK(query::is_query("url:example"));
+    CHECK(query::is_query("mail user:admin"));
+    CHECK(query::is_query("-staging"));
+    CHECK(query::is_query("(mail OR imap)"));
+    CHECK(query::is_query("mail AND imap"));
+    CHECK(query::is_query("NOT test"));
+    CHECK(!query::is_query("example.com"));
+    CHECK(!query::is_query("a-b"));
+    CHECK(!query::is_query("mailto:x"));
+    CHECK(!query::is_query("ORACLE"));
+    CHECK(!query::is_query("- x"));
+}
+
+TEST(query_compile_errors)
+{
+    CHECK(compile_error("url:\"my bank") == "missing closing quote");
+    CHECK(compile_error("url:") == "empty term");
+    CHECK(compile_error("") == "empty query");
+    CHECK(compile_error("mail )") == "unexpected ')'");
+    CHECK(compile_error("mail AND") == "missing term at the end");
+    CHECK(compile_error("(mail OR imap") == "missing ')'");
+    CHECK(compile_error("mail OR OR imap") == "missing term before OR");
+}
+
+TEST(query_matches)
+{
+    CHECK(matches("url:example user:admin", "example.com", "admin"));
+    CHECK(!matches("url:example user:admin", "example.com", "root"));
+    CHECK(!matches("url:admin", "example.com", "admin"));
+    CHECK(matches("admin", "example.com", "admin"));
+    CHECK(matches("url:example -url:staging", "example.com", "root"));
+    CHECK(!matches("url:example -url:staging", "staging.example.com", "x"));
+    CHECK(matches("(url:mail OR url:imap) AND NOT user:test", "imap.org",
+                  "me"));
+    CHECK(!matches("(url:mail OR url:imap) AND NOT user:test", "imap.org",
+                   "test"));
+    CHECK(matches("url:\"my bank\"", "my bank online", "me"));
+    CHECK(!matches("url:EXAMPLE", "example.com", "me"));
+    CHECK(matches("url:EXAMPLE", "example.com", "me", true));
+}
+
+TEST(query_lookup)
+{
+    const std::vector<std::string> urls = {"a-foo.com", "bar.com"};
+    CHECK(lookup_urls(urls, "-foo", pw_store::match_mode::exact) ==
+          std::vector<std::string>({"bar.com"}));
+    CHECK(lookup_urls(urls, "url:FOO", pw_store::match_mode::ignore_case) ==
+          std::vector<std::string>({"a-foo.com"}));
+}
+
+TEST(query_fuzzy_keys_are_no_queries)
+{
+    const std::vector<std::string> urls = {"a-foo.com", "bar.com",
+                                           "url:x.org"};
+    CHECK(lookup_urls(urls, "-foo", pw_store::match_mode::fuzzy) ==
+          std::vector<std::string>({"a-foo.com"}));
+    CHECK(lookup_urls(urls, "url:x", pw_store::match_mode::fuzzy) ==
+          std::vector<std::string>({"url:x.org"}));
+}
+
+TEST(query_invalid_is_plain_text)
+{
+    const std::vector<std::string> urls = {"(abc", "abc"};
+    CHECK(lookup_urls(urls, "(abc", pw_store::match_mode::exact) ==
+          std::vector<std::string>({"(abc"}));
+}
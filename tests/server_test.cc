@@ -0,0 +1,202 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "test.hh"
+
+#include <chrono>
+#include <csignal>
+#include <iostream>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "local_socket.hh"
+#include "pwstore_server.hh"
+
+namespace
+{
+using client_type = pw_store_api_cxx::pwstore_client;
+using status = client_type::status;
+const std::string PASSWORD = "server test";
+
+// A server for a new database with two records in a child process. The
+// socket is removed with it.
+class test_server
+{
+public:
+    test_server(const std::string &name, std::time_t lock_timeout)
+        : db_file(pw_store_test::temp_path(name)),
+          socket(pw_store::new_socket_path("server")),
+          db(db_file, PASSWORD), server(db, socket, lock_timeout), child(-1)
+    {
+        CHECK(db.add(pw_store::data_type("https://mail.example.com", "ann",
+                                         "secret1")));
+        CHECK(db.add(pw_store::data_type("https://shop.example.org", "bob",
+                                         "secret2")));
+        CHECK(db.sync());
+        CHECK(server.listen());
+        // the child would print the buffered results again
+        std::cout.flush();
+        child = fork();
+        if(!child) {
+            alarm(60);
+            _exit(server.run() ? 0 : 1);
+        }
+        CHECK(child > 0);
+    }
+    ~test_server()
+    {
+        kill(child, SIGTERM);
+        int exit_status = 0;
+        CHECK(waitpid(child, &exit_status, 0) == child &&
+              WIFEXITED(exit_status) && !WEXITSTATUS(exit_status));
+    }
+
+    const std::string db_file;
+    const std::string socket;
+
+private:
+    pw_store_api_cxx::pwstore_api db;
+    pw_store_api_cxx::pwstore_server server;
+    pid_t child;
+};
+
+std::vector<pw_store::data_type::id_type>
+lookup_ids(client_type &client, const std::string &key, status expected)
+{
+    std::vector<client_type::match> matches;
+    CHECK(client.lookup(key, {}, pw_store::match_mode::exact, matches) ==
+          expected);
+    std::vector<pw_store::data_type::id_type> ids;
+    for(const auto &m : matches)
+        ids.push_back(m.first);
+    return ids;
+}
+
+// run_command of ./pwstore with args, the server at socket answers it.
+int run_pwstore(const std::string &socket, const std::string &args,
+                std::string &output)
+{
+    return pw_store_test::run_command("PWSTORE_SERVER_SOCK='" + socket +
+                                          "' ./pwstore " + args +
+                                          " </dev/null 2>&1",
+                                      output);
+}
+
+// records of the database file, as another process opening it sees them
+std::size_t records_on_disk(const std::string &db_file,
+                            const std::string &key)
+{
+    pw_store_api_cxx::pwstore_api db(db_file, PASSWORD);
+    CHECK(db);
+    pw_store::result_type matches;
+    CHECK(db.lookup(matches, key, {}));
+    return matches.size();
+}
+}
+
+TEST(server_requests)
+{
+    const test_server server("requests.db", 120);
+    client_type client(server.socket);
+
+    CHECK(lookup_ids(client, "example", status::ok).size() == 2);
+    const auto ids = lookup_ids(client, "mail", status::ok);
+    CHECK(ids.size() == 1);
+    std::vector<client_type::match> matches;
+    CHECK(client.lookup("", ids, pw_store::match_mode::exact, matches) ==
+          status::ok);
+    CHECK(matches.size() == 1 && matches[0].second.username == "ann" &&
+          matches[0].second.password.empty());
+
+    pw_store::data_type date;
+    CHECK(!ids.empty() && client.get(ids.front(), date) == status::ok);
+    CHECK(date.url_string == "https://mail.example.com" &&
+          date.username == "ann" && date.password == "secret1");
+    CHECK(client.get(12345, date) == status::failed);
+
+    // changes are on disk when they are acknowledged
+    CHECK(client.add(pw_store::data_type("https://new.example.net", "carol",
+                                         "secret3")) == status::ok);
+    CHECK(records_on_disk(server.db_file, "carol") == 1);
+    const auto added = lookup_ids(client, "carol", status::ok);
+    CHECK(added.size() == 1);
+    CHECK(client.remove(added) == status::ok);
+    CHECK(records_on_disk(server.db_file, "carol") == 0);
+    CHECK(client.remove({12345}) == status::failed);
+    CHECK(lookup_ids(client, "example", status::ok).size() == 2);
+}
+
+TEST(server_idle_client_blocks_nobody)
+{
+    const test_server server("idle.db", 120);
+    // half a request header, then nothing
+    const int idle = pw_store::connect_socket(server.socket);
+    CHECK(idle >= 0);
+    CHECK(pw_store::send_all(idle, "l\1", 2));
+    const int silent = pw_store::connect_socket(server.socket);
+    CHECK(silent >= 0);
+
+    client_type client(server.socket);
+    const auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < 5; i++)
+        CHECK(lookup_ids(client, "example", status::ok).size() == 2);
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+    CHECK(ms < 500);
+
+    // a second client with its own connection
+    client_type other(server.socket);
+    CHECK(lookup_ids(other, "shop", status::ok).size() == 1);
+    pw_store::close_socket(idle);
+    pw_store::close_socket(silent);
+}
+
+TEST(server_locks_when_idle)
+{
+    // the child reports the lock and the wrong password
+    pw_store_test::capture_errors errors;
+    const test_server server("lock.db", 1);
+    client_type client(server.socket);
+    CHECK(lookup_ids(client, "example", status::ok).size() == 2);
+
+    // locked after more than a second without requests
+    sleep(3);
+    CHECK(lookup_ids(client, "example", status::locked).empty());
+    pw_store::data_type date;
+    CHECK(client.get(1, date) == status::locked);
+    CHECK(client.unlock("wrong " + PASSWORD) == status::failed);
+    CHECK(lookup_ids(client, "example", status::locked).empty());
+    CHECK(client.unlock(PASSWORD) == status::ok);
+    CHECK(lookup_ids(client, "example", status::ok).size() == 2);
+}
+
+TEST(server_cli_lookup_of_a_negated_first_term)
+{
+    const test_server server("cli.db", 120);
+    const std::string db = "-f '" + server.db_file + "' ";
+    std::string output;
+
+    CHECK(run_pwstore(server.socket, db + "lookup -- -user:ann", output) == 0);
+    CHECK(output.find("\"bob\"") != std::string::npos);
+    CHECK(output.find("\"ann\"") == std::string::npos);
+
+    // without -- it is an unknown flag and the key is missing
+    CHECK(run_pwstore(server.socket, db + "lookup -user:ann", output) == 1);
+    CHECK(output.find("\"bob\"") == std::string::npos);
+}
@@ -0,0 +1,107 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "test.hh"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "simd_find.hh"
+
+namespace
+{
+const char *naive_find(const char *begin, const char *end, const char *key,
+                       std::size_t key_size)
+{
+    if(!key_size)
+        return begin;
+    return std::search(begin, end, key, key + key_size);
+}
+
+// Every kernel against naive_find for haystacks starting at every offset of
+// a 64 byte block and of every length up to a few blocks, so matches land
+// in the vector part and in the scalar tail. The bytes around the haystack
+// complete the key, a kernel reading past end finds it there.
+void compare_kernels(const std::string &key)
+{
+    const std::size_t max_size = 3 * 64 + 7;
+    std::string storage(64 + max_size + 64 + key.size(), 'a');
+    for(const auto &kernel : pw_store::find_kernels()) {
+        for(std::size_t offset = 0; offset < 64; offset++) {
+            for(std::size_t size = 0; size <= max_size; size++) {
+                for(std::size_t at : {std::size_t(0), size / 2,
+                                      size >= key.size() ? size - key.size()
+                                                         : std::size_t(0),
+                                      size ? size - 1 : std::size_t(0)}) {
+                    std::fill(std::begin(storage), std::end(storage), 'a');
+                    char *const begin = &storage[64 + offset];
+                    char *const end = begin + size;
+                    // partial or whole key right behind end and before begin
+                    std::copy(std::begin(key), std::end(key), end);
+                    std::copy(std::begin(key), std::end(key),
+                              begin - key.size());
+                    // and one occurrence inside, maybe cut off by end
+                    const std::size_t fits =
+                        std::min(key.size(), size - std::min(at, size));
+                    std::copy(key.data(), key.data() + fits, begin + at);
+
+                    const char *const expected =
+                        naive_find(begin, end, key.data(), key.size());
+                    const char *const found =
+                        kernel.find(begin, end, key.data(), key.size());
+                    if(found != expected) {
+                        std::cerr << kernel.name << ": key \"" << key
+                                  << "\" offset " << offset << " size "
+                                  << size << " at " << at << "\n";
+                        CHECK(found == expected);
+                        return;
+                    }
+                }
+            }
+        }
+    }
+}
+}
+
+TEST(simd_find_kernels_equal_naive_search)
+{
+    CHECK(!pw_store::find_kernels().empty());
+    for(const std::string key :
+        {"x", "xy", "xax", "xyz", "example.com", "xaaaaaaaaaaaaaaax",
+         "xyzxyzxyzxyzxyzxyzxyzxyzxyzxyzxyzx"})
+        compare_kernels(key);
+}
+
+TEST(simd_find_edge_cases)
+{
+    const std::string text = "https://mail.example.com";
+    const char *const begin = text.data();
+    const char *const end = begin + text.size();
+    for(const auto &kernel : pw_store::find_kernels()) {
+        CHECK(kernel.find(begin, end, "", 0) == begin);
+        CHECK(kernel.find(begin, begin, "h", 1) == begin);
+        CHECK(kernel.find(begin, end, "https", 5) == begin);
+        CHECK(kernel.find(begin, end, "com", 3) == end - 3);
+        CHECK(kernel.find(begin, end, "coms", 4) == end);
+        // longer than the haystack
+        const std::string longer = text + "/";
+        CHECK(kernel.find(begin, end, longer.data(), longer.size()) == end);
+    }
+    CHECK(pw_store::simd_find(begin, end, "example", 7) == begin + 13);
+}
@@ -0,0 +1,163 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "test.hh"
+
+#include <cctype>
+#include <thread>
+
+#include "stats.hh"
+
+namespace
+{
+// Minimal JSON syntax check: true if the text at p is one value, as far as
+// stats::to_json writes them (objects, arrays, strings, numbers, true,
+// false).
+class json_checker
+{
+public:
+    explicit json_checker(const std::string &text)
+        : p(text.data()), end(text.data() + text.size())
+    {
+    }
+
+    bool valid()
+    {
+        const bool ok = value();
+        skip_space();
+        return ok && p == end;
+    }
+
+private:
+    void skip_space()
+    {
+        while(p < end && std::isspace(static_cast<unsigned char>(*p)))
+            p++;
+    }
+    bool literal(const std::string &word)
+    {
+        if(static_cast<std::size_t>(end - p) < word.size() ||
+           word.compare(0, word.size(), p, word.size()))
+            return false;
+        p += word.size();
+        return true;
+    }
+    bool string()
+    {
+        if(p == end || *p++ != '"')
+            return false;
+        while(p < end && *p != '"') {
+            if(*p == '\\' && ++p == end)
+                return false;
+            p++;
+        }
+        return p++ < end;
+    }
+    bool number()
+    {
+        const char *const begin = p;
+        if(p < end && *p == '-')
+            p++;
+        while(p < end && (std::isdigit(static_cast<unsigned char>(*p)) ||
+                          *p == '.' || *p == 'e' || *p == 'E' || *p == '+' ||
+                          *p == '-'))
+            p++;
+        return p > begin && std::isdigit(static_cast<unsigned char>(p[-1]));
+    }
+    template <typename F> bool sequence(char close, F element)
+    {
+        skip_space();
+        if(p < end && *p == close)
+            return ++p, true;
+        while(true) {
+            if(!element())
+                return false;
+            skip_space();
+            if(p == end)
+                return false;
+            const char c = *p++;
+            if(c == close)
+                return true;
+            if(c != ',')
+                return false;
+        }
+    }
+    bool value()
+    {
+        skip_space();
+        if(p == end)
+            return false;
+        switch(*p) {
+        case '{':
+            p++;
+            return sequence('}', [this]() {
+                skip_space();
+                if(!string())
+                    return false;
+                skip_space();
+                return p < end && *p++ == ':' && value();
+            });
+        case '[':
+            p++;
+            return sequence(']', [this]() { return value(); });
+        case '"':
+            return string();
+        case 't':
+            return literal("true");
+        case 'f':
+            return literal("false");
+        default:
+            return number();
+        }
+    }
+
+    const char *p;
+    const char *const end;
+};
+}
+
+TEST(stats_json_checker)
+{
+    CHECK(json_checker("{\"a\": [1, 2.5, true], \"b\": {}}").valid());
+    CHECK(!json_checker("{\"a\": [1, 2.5, true]").valid());
+    CHECK(!json_checker("{\"a\" 1}").valid());
+    CHECK(!json_checker("[1,]").valid());
+}
+
+TEST(stats_phases_as_json)
+{
+    pw_store::stats::enable();
+    CHECK(pw_store::stats::enabled());
+    {
+        const pw_store::stats::phase timing("test phase", 10);
+    }
+    // phases on other threads add up
+    std::thread other([]() {
+        pw_store::stats::phase timing("test phase");
+        timing.add_bytes(5);
+    });
+    other.join();
+
+    const auto json = pw_store::stats::to_json("test", true, 1.5);
+    CHECK(json_checker(json).valid());
+    CHECK(json.find("{\"command\": \"test\", \"ok\": true, ") == 0);
+    CHECK(json.find("\"total_ms\": 1.5") != std::string::npos);
+    CHECK(json.find("{\"name\": \"test phase\", \"calls\": 2, \"ms\": ") !=
+          std::string::npos);
+    CHECK(json.find("\"bytes\": 15, \"allocations\": ") != std::string::npos);
+    CHECK(json.find('\n') == std::string::npos);
+}
@@ -0,0 +1,74 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _TEST_HH_
+#define _TEST_HH_
+
+#include <sstream>
+#include <string>
+
+// Minimal unit tests for "make check". TEST(name) defines and registers a
+// test, CHECK(condition) reports a failed condition and the test goes on.
+namespace pw_store_test
+{
+using test_function = void (*)();
+bool add_test(const char *name, test_function test);
+void fail(const char *file, int line, const char *condition);
+
+// path of name in a directory removed after all tests
+std::string temp_path(const std::string &name);
+std::string read_file(const std::string &path);
+void write_file(const std::string &path, const std::string &data);
+// Run command with sh, e.g. ./pwstore built by "make check". Returns its
+// exit code, -1 if it did not exit, and its output in output.
+int run_command(const std::string &command, std::string &output);
+
+// Collects std::cerr, e.g. the warnings a test provokes.
+class capture_errors
+{
+public:
+    capture_errors();
+    ~capture_errors();
+    capture_errors(const capture_errors &) = delete;
+    capture_errors &operator=(const capture_errors &) = delete;
+
+    std::string text() const { return captured.str(); }
+    bool contains(const std::string &s) const
+    {
+        return text().find(s) != std::string::npos;
+    }
+
+private:
+    std::ostringstream captured;
+    std::streambuf *previous;
+};
+}
+
+#define TEST(name)                                                            \
+    static void name();                                                       \
+    static const bool name##_registered =                                     \
+        pw_store_test::add_test(#name, name);                                 \
+    static void name()
+
+#define CHECK(condition)                                                      \
+    do {                                                                      \
+        if(!(condition))                                                      \
+            pw_store_test::fail(__FILE__, __LINE__, #condition);              \
+    } while(0)
+
+#endif
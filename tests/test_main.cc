@@ -0,0 +1,141 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "test.hh"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+std::vector<std::pair<const char *, pw_store_test::test_function>> &tests()
+{
+    static std::vector<std::pair<const char *, pw_store_test::test_function>>
+        registered;
+    return registered;
+}
+
+std::size_t failures = 0;
+std::string temp_dir;
+
+void remove_temp_dir()
+{
+    if(temp_dir.empty())
+        return;
+    if(DIR *dir = opendir(temp_dir.c_str())) {
+        while(const dirent *entry = readdir(dir)) {
+            const std::string name(entry->d_name);
+            if(name != "." && name != "..")
+                std::remove((temp_dir + "/" + name).c_str());
+        }
+        closedir(dir);
+    }
+    rmdir(temp_dir.c_str());
+}
+}
+
+bool pw_store_test::add_test(const char *name, test_function test)
+{
+    tests().emplace_back(name, test);
+    return true;
+}
+
+void pw_store_test::fail(const char *file, int line, const char *condition)
+{
+    std::cout << "  " << file << ":" << line << ": CHECK(" << condition
+              << ") failed\n";
+    failures++;
+}
+
+std::string pw_store_test::temp_path(const std::string &name)
+{
+    if(temp_dir.empty()) {
+        std::string dir = "/tmp/pwstore_test-XXXXXX";
+        if(!mkdtemp(&dir[0])) {
+            std::cerr << "Error: creating a temporary directory failed.\n";
+            std::exit(EXIT_FAILURE);
+        }
+        temp_dir = dir;
+    }
+    return temp_dir + "/" + name;
+}
+
+std::string pw_store_test::read_file(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in),
+                       std::istreambuf_iterator<char>());
+}
+
+void pw_store_test::write_file(const std::string &path,
+                               const std::string &data)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << data;
+}
+
+int pw_store_test::run_command(const std::string &command,
+                               std::string &output)
+{
+    output.clear();
+    FILE *const out = popen(command.c_str(), "r");
+    if(!out)
+        return -1;
+    char chunk[4096];
+    std::size_t n;
+    while((n = std::fread(chunk, 1, sizeof(chunk), out)) > 0)
+        output.append(chunk, n);
+    const int status = pclose(out);
+    return status != -1 && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+pw_store_test::capture_errors::capture_errors()
+    : previous(std::cerr.rdbuf(captured.rdbuf()))
+{
+}
+
+pw_store_test::capture_errors::~capture_errors()
+{
+    std::cerr.rdbuf(previous);
+}
+
+int main()
+{
+    std::size_t failed_tests = 0;
+    for(const auto &test : tests()) {
+        const auto failures_before = failures;
+        test.second();
+        const bool ok = failures == failures_before;
+        std::cout << (ok ? "ok     " : "FAILED ") << test.first << "\n";
+        if(!ok)
+            failed_tests++;
+    }
+    remove_temp_dir();
+    std::cout << tests().size() - failed_tests << " of " << tests().size()
+              << " tests passed.\n";
+    return failed_tests ? EXIT_FAILURE : EXIT_SUCCESS;
+}
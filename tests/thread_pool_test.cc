@@ -0,0 +1,62 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "test.hh"
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include "thread_pool.hh"
+
+TEST(thread_pool_runs_every_task_once)
+{
+    pw_store::thread_pool pool(4);
+    CHECK(pool.size() == 4);
+    for(const std::size_t count : {0, 1, 3, 1000}) {
+        std::vector<std::atomic<int>> runs(count);
+        for(auto &r : runs)
+            r = 0;
+        pool.run(count, [&runs](std::size_t i) { runs[i]++; });
+        for(const auto &r : runs)
+            CHECK(r == 1);
+    }
+}
+
+TEST(thread_pool_rethrows_after_all_tasks)
+{
+    pw_store::thread_pool pool(4);
+    std::atomic<std::size_t> finished(0);
+    bool thrown = false;
+    try {
+        pool.run(100, [&finished](std::size_t i) {
+            finished++;
+            if(i == 10)
+                throw std::runtime_error("task 10");
+        });
+    } catch(const std::runtime_error &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(finished == 100);
+
+    // still usable
+    finished = 0;
+    pool.run(10, [&finished](std::size_t) { finished++; });
+    CHECK(finished == 10);
+}
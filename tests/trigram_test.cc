@@ -0,0 +1,131 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "test.hh"
+
+#include <deque>
+
+#include "trigram_index.hh"
+
+namespace
+{
+using ids_type = std::vector<pw_store::data_type::id_type>;
+
+// Keeps the fields the records refer to.
+struct record_list
+{
+    void add(const std::string &url, const std::string &user,
+             pw_store::data_type::id_type id)
+    {
+        fields.push_back(url);
+        fields.push_back(user);
+        records.push_back(make_record(id));
+    }
+    pw_store::record make_record(pw_store::data_type::id_type id)
+    {
+        const auto &url = fields[fields.size() - 2];
+        const auto &user = fields.back();
+        return pw_store::record({url.data(), url.size()},
+                                {user.data(), user.size()}, {"", 0}, id);
+    }
+
+    std::deque<std::string> fields;
+    std::vector<pw_store::record> records;
+};
+
+ids_type find(const pw_store::trigram_index &index, const std::string &key)
+{
+    ids_type ids;
+    CHECK(index.find(key, ids));
+    return ids;
+}
+}
+
+TEST(trigram_index_find)
+{
+    record_list list;
+    list.add("alpha.com", "ann", 1);
+    list.add("beta.org", "bob", 2);
+    list.add("gamma.net", "carol", 4);
+    pw_store::trigram_index index;
+    CHECK(!index.built());
+    index.build(list.records);
+    CHECK(index.built());
+
+    CHECK(find(index, "alpha") == ids_type({1}));
+    CHECK(find(index, "ALPHA") == ids_type({1}));
+    CHECK(find(index, "carol") == ids_type({4}));
+    CHECK(find(index, "org") == ids_type({2}));
+    CHECK(find(index, "delta").empty());
+    ids_type ids;
+    CHECK(!index.find("al", ids));
+    CHECK(ids.empty());
+
+    index.clear();
+    CHECK(!index.built());
+}
+
+TEST(trigram_index_insert_and_remove)
+{
+    record_list list;
+    list.add("alpha.com", "ann", 1);
+    list.add("beta.org", "bob", 2);
+    pw_store::trigram_index index;
+    index.build(list.records);
+
+    list.add("alphabet.net", "dave", 5);
+    index.insert(list.records.back());
+    CHECK(find(index, "alpha") == ids_type({1, 5}));
+    // ids below the largest one, e.g. from a journal
+    list.add("alpha.de", "eve", 3);
+    index.insert(list.records.back());
+    CHECK(find(index, "alpha") == ids_type({1, 3, 5}));
+    CHECK(find(index, "eve") == ids_type({3}));
+
+    index.remove(1);
+    CHECK(find(index, "alpha") == ids_type({3, 5}));
+    index.remove(1);
+    CHECK(find(index, "alpha") == ids_type({3, 5}));
+}
+
+TEST(trigram_index_compaction)
+{
+    record_list list;
+    for(pw_store::data_type::id_type id = 1; id <= 8; id++)
+        list.add("host" + std::to_string(id) + ".example.com", "admin", id);
+    pw_store::trigram_index index;
+    index.build(list.records);
+    const auto bytes = index.posting_bytes();
+    CHECK(find(index, "example").size() == 8);
+
+    // two of eight removed ids are only filtered
+    index.remove(2);
+    index.remove(4);
+    CHECK(index.posting_bytes() == bytes);
+    CHECK(find(index, "example") == ids_type({1, 3, 5, 6, 7, 8}));
+    // a third one drops them from the postings
+    index.remove(6);
+    CHECK(index.posting_bytes() < bytes);
+    CHECK(find(index, "example") == ids_type({1, 3, 5, 7, 8}));
+    CHECK(find(index, "host4").empty());
+    CHECK(find(index, "host5") == ids_type({5}));
+
+    list.add("host9.example.com", "admin", 9);
+    index.insert(list.records.back());
+    CHECK(find(index, "example") == ids_type({1, 3, 5, 7, 8, 9}));
+}
@@ -0,0 +1,102 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "thread_pool.hh"
+
+#include <algorithm>
+
+pw_store::thread_pool::thread_pool(std::size_t threads)
+    : task(nullptr), count(0), next(0), finished(0), stopping(false)
+{
+    for(std::size_t i = 1; i < threads; i++)
+        workers.emplace_back(&thread_pool::work, this);
+}
+
+pw_store::thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(auto &worker : workers)
+        worker.join();
+}
+
+std::size_t pw_store::thread_pool::default_size()
+{
+    // Scans are memory bound, a few threads saturate the bandwidth.
+    const std::size_t max_threads = 8;
+    return std::max<std::size_t>(
+        1, std::min<std::size_t>(std::thread::hardware_concurrency(),
+                                 max_threads));
+}
+
+void pw_store::thread_pool::run(std::size_t task_count,
+                                const std::function<void(std::size_t)> &fn)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    task = &fn;
+    count = task_count;
+    next = 0;
+    finished = 0;
+    error = nullptr;
+    wake.notify_all();
+
+    run_tasks(lock);
+    done.wait(lock, [this]() { return finished == count; });
+
+    task = nullptr;
+    count = next = finished = 0;
+    std::exception_ptr e;
+    std::swap(e, error);
+    lock.unlock();
+    if(e)
+        std::rethrow_exception(e);
+}
+
+void pw_store::thread_pool::work()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        wake.wait(lock, [this]() { return stopping || next < count; });
+        if(stopping)
+            return;
+        run_tasks(lock);
+    }
+}
+
+// Called with lock held, returns with lock held.
+void pw_store::thread_pool::run_tasks(std::unique_lock<std::mutex> &lock)
+{
+    while(next < count) {
+        const std::size_t i = next++;
+        lock.unlock();
+        std::exception_ptr e;
+        try {
+            (*task)(i);
+        } catch(...) {
+            e = std::current_exception();
+        }
+        lock.lock();
+        if(e && !error)
+            error = e;
+        if(++finished == count)
+            done.notify_all();
+    }
+}
@@ -0,0 +1,72 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _THREAD_POOL_HH_
+#define _THREAD_POOL_HH_
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pw_store
+{
+
+// Fixed set of worker threads for splitting one job into independent tasks.
+// The calling thread works on the tasks too, run() returns when all of them
+// are done. Not reentrant: only one run() at a time.
+class thread_pool
+{
+public:
+    // threads including the calling thread, at least one.
+    explicit thread_pool(std::size_t threads);
+    ~thread_pool();
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    std::size_t size() const { return workers.size() + 1; }
+
+    // Call task(i) for every i in [0, count). The first exception thrown by
+    // a task is rethrown after all tasks finished.
+    void run(std::size_t count, const std::function<void(std::size_t)> &task);
+
+    // Threads worth using on this machine.
+    static std::size_t default_size();
+
+private:
+    void work();
+    void run_tasks(std::unique_lock<std::mutex> &lock);
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::vector<std::thread> workers;
+
+    const std::function<void(std::size_t)> *task;
+    std::size_t count;
+    std::size_t next;
+    std::size_t finished;
+    std::exception_ptr error;
+    bool stopping;
+};
+}
+
+#endif
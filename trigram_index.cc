@@ -0,0 +1,317 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "trigram_index.hh"
+
+#include <algorithm>
+
+#include "secure_arena.hh"
+
+namespace
+{
+
+typedef pw_store::data_type::id_type id_type;
+
+std::uint32_t gram_at(const char *p)
+{
+    return (static_cast<std::uint32_t>(
+                static_cast<unsigned char>(pw_store::fold_case(p[0])))
+                << 16 |
+            static_cast<std::uint32_t>(
+                static_cast<unsigned char>(pw_store::fold_case(p[1])))
+                << 8 |
+            static_cast<unsigned char>(pw_store::fold_case(p[2]))) +
+           1;
+}
+
+void add_grams(const char *data, std::size_t size,
+               std::vector<std::uint32_t> &grams)
+{
+    for(std::size_t i = 0; i + pw_store::trigram_index::gram_size <= size;
+        i++)
+        grams.push_back(gram_at(data + i));
+}
+
+// distinct trigrams of url and username
+void record_grams(const pw_store::record &r,
+                  std::vector<std::uint32_t> &grams)
+{
+    grams.clear();
+    add_grams(r.url_string.data, r.url_string.size, grams);
+    add_grams(r.username.data, r.username.size, grams);
+    std::sort(std::begin(grams), std::end(grams));
+    grams.erase(std::unique(std::begin(grams), std::end(grams)),
+                std::end(grams));
+}
+
+void put_varint(std::string &out, id_type value)
+{
+    while(value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+id_type get_varint(const char *&p)
+{
+    id_type value = 0;
+    for(unsigned shift = 0;; shift += 7) {
+        const unsigned char byte = *p++;
+        value |= static_cast<id_type>(byte & 0x7f) << shift;
+        if(!(byte & 0x80))
+            return value;
+    }
+}
+
+void decode(const std::string &deltas, std::vector<id_type> &ids)
+{
+    const char *p = deltas.data();
+    const char *const end = p + deltas.size();
+    id_type id = 0;
+    while(p < end) {
+        id += get_varint(p);
+        ids.push_back(id);
+    }
+}
+
+void encode(const std::vector<id_type> &ids, std::string &deltas)
+{
+    deltas.clear();
+    id_type previous = 0;
+    for(const auto id : ids) {
+        put_varint(deltas, id - previous);
+        previous = id;
+    }
+}
+
+// Spread the three bytes of a trigram over the low bits used by the table.
+std::uint32_t hash(std::uint32_t gram)
+{
+    gram ^= gram >> 16;
+    gram *= 0x45d9f3b;
+    gram ^= gram >> 16;
+    return gram;
+}
+
+// Keep the ids also in deltas, in place.
+void intersect(std::vector<id_type> &ids, const std::string &deltas)
+{
+    const char *p = deltas.data();
+    const char *const end = p + deltas.size();
+    id_type id = 0;
+    std::size_t in = 0;
+    std::size_t out = 0;
+    while(in < ids.size() && p < end) {
+        id += get_varint(p);
+        while(in < ids.size() && ids[in] < id)
+            in++;
+        if(in < ids.size() && ids[in] == id)
+            ids[out++] = ids[in++];
+    }
+    ids.resize(out);
+}
+}
+
+void pw_store::trigram_index::build(const std::vector<record> &records)
+{
+    clear();
+    valid = true;
+
+    // In id order every insert() only appends to the postings.
+    std::vector<const record *> sorted;
+    sorted.reserve(records.size());
+    for(const auto &r : records)
+        sorted.push_back(&r);
+    std::sort(std::begin(sorted), std::end(sorted),
+              [](const record *a, const record *b) { return a->id < b->id; });
+    for(const auto r : sorted)
+        insert(*r);
+}
+
+void pw_store::trigram_index::clear()
+{
+    // the trigrams are fragments of the keys
+    for(auto &p : table)
+        wipe(reinterpret_cast<char *>(&p.gram), sizeof(p.gram));
+    std::vector<posting>().swap(table);
+    used = 0;
+    records = 0;
+    removed.clear();
+    valid = false;
+}
+
+void pw_store::trigram_index::insert(const record &r)
+{
+    if(!valid)
+        return;
+    // The stale postings of a removed record with the same id stay, they
+    // only add candidates.
+    if(!removed.erase(r.id))
+        records++;
+
+    std::vector<std::uint32_t> grams;
+    record_grams(r, grams);
+    std::vector<id_type> ids;
+    for(const auto gram : grams) {
+        posting &p = get_posting(gram);
+        if(!p.count || r.id > p.last) {
+            put_varint(p.deltas, r.id - p.last);
+            p.last = r.id;
+            p.count++;
+            continue;
+        }
+        // e.g. records of a journal written by another session
+        ids.clear();
+        decode(p.deltas, ids);
+        const auto pos = std::lower_bound(std::begin(ids), std::end(ids), r.id);
+        if(pos != std::end(ids) && *pos == r.id)
+            continue;
+        ids.insert(pos, r.id);
+        encode(ids, p.deltas);
+        p.count = ids.size();
+    }
+}
+
+void pw_store::trigram_index::remove(data_type::id_type id)
+{
+    if(!valid || !removed.insert(id).second)
+        return;
+    if(4 * removed.size() > records)
+        compact();
+}
+
+void pw_store::trigram_index::compact()
+{
+    std::vector<id_type> ids;
+    for(auto &p : table) {
+        if(!p.count)
+            continue;
+        ids.clear();
+        decode(p.deltas, ids);
+        std::size_t out = 0;
+        for(const auto id : ids)
+            if(!removed.count(id))
+                ids[out++] = id;
+        if(out == ids.size())
+            continue;
+        ids.resize(out);
+        encode(ids, p.deltas);
+        p.count = ids.size();
+        p.last = ids.empty() ? 0 : ids.back();
+    }
+    records -= removed.size();
+    removed.clear();
+}
+
+bool pw_store::trigram_index::find(const std::string &key,
+                                   std::vector<data_type::id_type> &ids) const
+{
+    if(!valid || key.size() < gram_size)
+        return false;
+
+    std::vector<std::uint32_t> grams;
+    add_grams(key.data(), key.size(), grams);
+    std::sort(std::begin(grams), std::end(grams));
+    grams.erase(std::unique(std::begin(grams), std::end(grams)),
+                std::end(grams));
+    std::vector<const posting *> postings;
+    for(const auto gram : grams) {
+        const std::size_t slot = find_posting(gram);
+        if(slot == table.size() || !table[slot].count)
+            return true;
+        postings.push_back(&table[slot]);
+    }
+
+    // Start with the shortest posting, the candidates only shrink.
+    std::sort(std::begin(postings), std::end(postings),
+              [](const posting *a, const posting *b) {
+                  return a->count < b->count;
+              });
+    std::vector<id_type> candidates;
+    candidates.reserve(postings.front()->count);
+    decode(postings.front()->deltas, candidates);
+    for(std::size_t i = 1; i < postings.size() && !candidates.empty(); i++)
+        intersect(candidates, postings[i]->deltas);
+    if(!removed.empty())
+        candidates.erase(std::remove_if(std::begin(candidates),
+                                        std::end(candidates),
+                                        [this](id_type id) {
+                                            return removed.count(id) != 0;
+                                        }),
+                         std::end(candidates));
+
+    ids.insert(std::end(ids), std::begin(candidates), std::end(candidates));
+    return true;
+}
+
+std::size_t pw_store::trigram_index::posting_bytes() const
+{
+    std::size_t bytes = 0;
+    for(const auto &p : table)
+        bytes += p.deltas.size();
+    return bytes;
+}
+
+std::size_t pw_store::trigram_index::find_posting(std::uint32_t gram) const
+{
+    if(table.empty())
+        return table.size();
+    const std::size_t mask = table.size() - 1;
+    for(std::size_t i = hash(gram) & mask;; i = (i + 1) & mask) {
+        if(table[i].gram == gram)
+            return i;
+        if(!table[i].gram)
+            return table.size();
+    }
+}
+
+pw_store::trigram_index::posting &
+pw_store::trigram_index::get_posting(std::uint32_t gram)
+{
+    const std::size_t found = find_posting(gram);
+    if(found != table.size())
+        return table[found];
+
+    // at most half full
+    if(2 * (used + 1) > table.size())
+        grow();
+    const std::size_t mask = table.size() - 1;
+    std::size_t i = hash(gram) & mask;
+    while(table[i].gram)
+        i = (i + 1) & mask;
+    table[i].gram = gram;
+    used++;
+    return table[i];
+}
+
+void pw_store::trigram_index::grow()
+{
+    std::vector<posting> old(std::max<std::size_t>(1024, 2 * table.size()));
+    old.swap(table);
+    const std::size_t mask = table.size() - 1;
+    for(auto &p : old) {
+        if(!p.gram)
+            continue;
+        std::size_t i = hash(p.gram) & mask;
+        while(table[i].gram)
+            i = (i + 1) & mask;
+        table[i] = std::move(p);
+        wipe(reinterpret_cast<char *>(&p.gram), sizeof(p.gram));
+    }
+}
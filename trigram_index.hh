@@ -0,0 +1,95 @@
+/*
+Copyright (C) 2014 Reiter Wolfgang wr0112358@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _TRIGRAM_INDEX_HH_
+#define _TRIGRAM_INDEX_HH_
+
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "pwstore.hh"
+
+namespace pw_store
+{
+
+// Inverted index from the case folded trigrams of url and username to the
+// ids of the records containing them. Postings are sorted ids, stored as
+// varint encoded deltas. Keyed by id instead of slot, the index stays valid
+// when records move, and insert() and remove() keep it up to date without
+// a rebuild: inserting a record with a new largest id only appends to the
+// postings of its trigrams, removed ids are filtered from the results until
+// they make up a quarter of the index and are dropped from all postings.
+class trigram_index
+{
+public:
+    static const std::size_t gram_size = 3;
+
+    trigram_index() : used(0), records(0), valid(false) {}
+    ~trigram_index() { clear(); }
+
+    void build(const std::vector<record> &records);
+    void clear();
+    bool built() const { return valid; }
+
+    // No-ops while the index is not built.
+    void insert(const record &r);
+    void remove(data_type::id_type id);
+
+    // Append the ids of all records with url or username containing every
+    // trigram of key to ids, in ascending order. These are candidates only,
+    // case is ignored and the trigrams may be in any order. Returns false
+    // for keys shorter than gram_size, the index can not answer those.
+    bool find(const std::string &key,
+              std::vector<data_type::id_type> &ids) const;
+
+    // size of the encoded postings
+    std::size_t posting_bytes() const;
+
+private:
+    struct posting
+    {
+        posting() : gram(0), count(0), last(0) {}
+
+        // trigram + 1, 0 marks an empty slot of the table
+        std::uint32_t gram;
+        std::uint32_t count;
+        // largest id, the base of the next delta
+        data_type::id_type last;
+        std::string deltas;
+    };
+
+    // slot of gram in table, table.size() if it is missing
+    std::size_t find_posting(std::uint32_t gram) const;
+    posting &get_posting(std::uint32_t gram);
+    void grow();
+    // drop the removed ids from all postings
+    void compact();
+
+    // open addressing with linear probing, power of two size
+    std::vector<posting> table;
+    std::size_t used;
+    // indexed records, including the removed ones
+    std::size_t records;
+    std::unordered_set<data_type::id_type> removed;
+    bool valid;
+};
+}
+
+#endif